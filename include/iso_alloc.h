@@ -1,6 +1,9 @@
 /* iso_alloc.h - A secure memory allocator
  * Copyright 2020 - chris.rohlf@gmail.com */
 
+#pragma once
+
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,12 +13,61 @@
 #endif
 
 typedef void iso_alloc_zone_handle;
+typedef void iso_cache_handle;
+
+/* Flags for iso_alloc_zone_reset. RELEASE gives pages that
+ * only hold free chunks back to the kernel */
+#define ISO_ZONE_RESET_RELEASE 0x1
+
+/* Selects the security mitigations applied to every chunk
+ * in a custom zone. Zones made by iso_alloc_new_zone have
+ * all of them, clear_chunk_on_free only when the library
+ * is built with SANITIZE_CHUNKS */
+typedef struct iso_alloc_zone_configuration {
+    bool random_allocation_pattern;             /* Hand out free chunks in an unpredictable order, otherwise in address order and reuse free'd chunks LIFO */
+    bool adjacent_canary_verification_on_alloc; /* Verify the canary of a previously used chunk before handing it out */
+    bool adjacent_canary_verification_on_free;  /* Verify the canaries of the chunks on either side of a free'd chunk */
+    bool clear_chunk_on_free;                   /* Overwrite chunks when they are free'd */
+    bool double_free_detection;                 /* Abort on a double free instead of ignoring it */
+} iso_alloc_zone_configuration;
+
+/* Object cache constructors and destructors are called
+ * with a pointer to the object */
+typedef void (*iso_cache_ctor)(void *p);
+typedef void (*iso_cache_dtor)(void *p);
+
+/* Allocation counts are bucketed by chunk size. Bucket 0
+ * holds chunks <= 16 bytes and each following bucket holds
+ * chunks up to twice the size of the previous one. The last
+ * bucket counts big zone allocations */
+#define ISO_ALLOC_STATS_SIZE_CLASSES 16
+
+struct iso_alloc_stats {
+    uint64_t allocs[ISO_ALLOC_STATS_SIZE_CLASSES]; /* Allocations per size class */
+    uint64_t frees[ISO_ALLOC_STATS_SIZE_CLASSES];  /* Frees per size class */
+    uint64_t bytes_in_use;                         /* Bytes in chunks and big zones currently handed out */
+    uint64_t zones_created;                        /* Zones created since startup */
+    uint64_t zones_used;                           /* Zones currently held by the root */
+    uint64_t cache_refills;                        /* Free bit slot cache refills */
+    uint64_t cpu_cache_hits;                       /* Allocations served by a per-CPU cache */
+    uint64_t fast_path_hits;                       /* Allocations served by a zone in the thread zone cache */
+    uint64_t slow_path_hits;                       /* Allocations that searched all zones */
+    uint64_t extra_slow_path_hits;                 /* Allocations that created a new zone */
+    uint64_t big_zone_reuse_hits;                  /* Big allocations that reused a free big zone */
+    uint64_t big_zone_new;                         /* Big allocations that mapped a new big zone */
+    uint64_t lock_contention;                      /* Lock acquisitions that had to spin */
+    uint64_t near_hits;                            /* iso_alloc_near allocations placed close to their hint */
+    uint64_t zone_pool_hits;                       /* Zones created with pages mapped ahead of time by the zone pool */
+    uint64_t zones_retired;                        /* Empty zones whose pages were decommitted */
+    uint64_t zones_recycled;                       /* Zones created in the descriptor of a retired zone */
+};
 
 #if CPP_SUPPORT
 extern "C" {
 #endif
 EXTERNAL_API void *iso_alloc(size_t size);
 EXTERNAL_API void *iso_calloc(size_t nmemb, size_t size);
+EXTERNAL_API void *iso_alloc_near(void *hint, size_t size);
 EXTERNAL_API void iso_free(void *p);
 EXTERNAL_API void iso_free_permanently(void *p);
 EXTERNAL_API void *iso_realloc(void *p, size_t size);
@@ -26,7 +78,11 @@ EXTERNAL_API char *iso_strndup(const char *str, size_t n);
 EXTERNAL_API char *iso_strndup_from_zone(iso_alloc_zone_handle *zone, const char *str, size_t n);
 EXTERNAL_API iso_alloc_zone_handle *iso_alloc_from_zone(iso_alloc_zone_handle *zone, size_t size);
 EXTERNAL_API iso_alloc_zone_handle *iso_alloc_new_zone(size_t size);
+EXTERNAL_API int32_t iso_alloc_reserve(size_t size, size_t count);
+EXTERNAL_API int32_t iso_alloc_set_watermark(size_t size, size_t free_chunks);
+EXTERNAL_API iso_alloc_zone_handle *iso_alloc_new_zone_with_config(size_t size, const iso_alloc_zone_configuration *config);
 EXTERNAL_API void iso_alloc_destroy_zone(iso_alloc_zone_handle *zone);
+EXTERNAL_API void iso_alloc_zone_reset(iso_alloc_zone_handle *zone, uint32_t flags);
 EXTERNAL_API void iso_alloc_protect_root();
 EXTERNAL_API void iso_alloc_unprotect_root();
 EXTERNAL_API uint64_t iso_alloc_detect_zone_leaks(iso_alloc_zone_handle *zone);
@@ -35,6 +91,11 @@ EXTERNAL_API uint64_t iso_alloc_zone_mem_usage(iso_alloc_zone_handle *zone);
 EXTERNAL_API uint64_t iso_alloc_mem_usage();
 EXTERNAL_API void iso_verify_zones();
 EXTERNAL_API void iso_verify_zone(iso_alloc_zone_handle *zone);
+EXTERNAL_API int32_t iso_alloc_get_stats(struct iso_alloc_stats *stats);
+EXTERNAL_API iso_cache_handle *iso_cache_create(size_t size, iso_cache_ctor ctor, iso_cache_dtor dtor);
+EXTERNAL_API void *iso_cache_alloc(iso_cache_handle *cache);
+EXTERNAL_API void iso_cache_free(iso_cache_handle *cache, void *p);
+EXTERNAL_API void iso_cache_destroy(iso_cache_handle *cache);
 
 #if EXPERIMENTAL
 EXTERNAL_API void iso_alloc_search_stack(void *p);
@@ -0,0 +1,272 @@
+/* iso_alloc.hpp - A secure memory allocator
+ * Copyright 2021 - chris.rohlf@gmail.com */
+
+/* Header only C++ interfaces that bind allocations to a
+ * private IsoAlloc zone. iso::allocator<T> is an STL
+ * allocator that serves single objects, such as the nodes
+ * of a std::map or std::list, from a zone made for exactly
+ * sizeof(T). iso::zone_resource is a std::pmr::memory_resource
+ * over a private zone with a chunk size chosen at runtime.
+ *
+ * Requests that don't fit the private zone, or arrive once
+ * it is full, fall back to iso_alloc. Everything is free'd
+ * with iso_free, which finds the owning zone itself.
+ *
+ * iso::object_pool<T> is an object cache that keeps free'd
+ * objects constructed so they can be reused without running
+ * the constructor again */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+
+extern "C" {
+#include "iso_alloc.h"
+}
+
+namespace iso {
+
+/* Chunks in a zone are carved from page aligned memory
+ * at multiples of the chunk size, so a chunk is aligned
+ * to the lowest set bit of the chunk size. Zones never
+ * use chunks smaller than 8 bytes */
+constexpr std::size_t kMinChunkAlign = 8;
+constexpr std::size_t kMaxChunkAlign = 4096;
+
+/* Largest chunk size a private zone can have */
+constexpr std::size_t kMaxZoneChunkSize = 262144;
+
+constexpr std::size_t chunk_size_for(std::size_t size, std::size_t align) {
+    std::size_t a = (align > kMinChunkAlign) ? align : kMinChunkAlign;
+    return (size + (a - 1)) & ~(a - 1);
+}
+
+constexpr std::size_t chunk_align_of(std::size_t chunk_size) {
+    std::size_t a = chunk_size & (~chunk_size + 1);
+    return (a > kMaxChunkAlign) ? kMaxChunkAlign : a;
+}
+
+inline bool is_aligned(const void *p, std::size_t align) {
+    return (reinterpret_cast<std::uintptr_t>(p) & (align - 1)) == 0;
+}
+
+/* Fallback for requests a private zone can't serve */
+inline void *alloc_fallback(std::size_t bytes, std::size_t align) {
+    void *p = iso_alloc(bytes);
+
+    if(p == nullptr) {
+        throw std::bad_alloc();
+    }
+
+    if(!is_aligned(p, align)) {
+        iso_free(p);
+        throw std::bad_alloc();
+    }
+
+    return p;
+}
+
+/* The zone for objects of type T. It is created the first
+ * time it is used and lives for the rest of the program
+ * so copies and rebinds of an allocator are always equal */
+template <typename T>
+class type_zone {
+  public:
+    static constexpr std::size_t chunk_size = chunk_size_for(sizeof(T), alignof(T));
+
+    static_assert(alignof(T) <= kMaxChunkAlign, "iso::allocator can't align chunks beyond a page");
+
+    static iso_alloc_zone_handle *get() {
+        if(chunk_size > kMaxZoneChunkSize) {
+            return nullptr;
+        }
+
+        static iso_alloc_zone_handle *zone = iso_alloc_new_zone(chunk_size);
+        return zone;
+    }
+};
+
+template <typename T>
+class allocator {
+  public:
+    using value_type = T;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using propagate_on_container_move_assignment = std::true_type;
+    using is_always_equal = std::true_type;
+
+    template <typename U>
+    struct rebind {
+        using other = allocator<U>;
+    };
+
+    allocator() noexcept = default;
+
+    template <typename U>
+    allocator(const allocator<U> &) noexcept {}
+
+    /* Hot Path: a single object comes straight from the
+     * zone for T without searching for a zone that fits */
+    [[nodiscard]] T *allocate(std::size_t n) {
+        if(__builtin_expect(n == 1, 1)) {
+            iso_alloc_zone_handle *zone = type_zone<T>::get();
+
+            if(__builtin_expect(zone != nullptr, 1)) {
+                void *p = iso_alloc_from_zone(zone, sizeof(T));
+
+                if(__builtin_expect(p != nullptr, 1)) {
+                    return static_cast<T *>(p);
+                }
+            }
+        }
+
+        if(n > max_size()) {
+            throw std::bad_array_new_length();
+        }
+
+        return static_cast<T *>(alloc_fallback(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *p, std::size_t) noexcept {
+        iso_free(p);
+    }
+
+    constexpr std::size_t max_size() const noexcept {
+        return std::numeric_limits<std::size_t>::max() / sizeof(T);
+    }
+};
+
+template <typename T, typename U>
+constexpr bool operator==(const allocator<T> &, const allocator<U> &) noexcept {
+    return true;
+}
+
+template <typename T, typename U>
+constexpr bool operator!=(const allocator<T> &, const allocator<U> &) noexcept {
+    return false;
+}
+
+/* A memory resource that owns a private zone. Requests
+ * up to chunk_size bytes that the chunk alignment can
+ * satisfy come from the zone. The zone is destroyed with
+ * the resource, which must outlive everything allocated
+ * from it */
+class zone_resource : public std::pmr::memory_resource {
+  public:
+    explicit zone_resource(std::size_t chunk_size) : chunk_size_(chunk_size_for(chunk_size, kMinChunkAlign)),
+                                                     chunk_align_(chunk_align_of(chunk_size_)),
+                                                     zone_(nullptr) {
+        if(chunk_size_ == 0 || chunk_size_ > kMaxZoneChunkSize) {
+            throw std::bad_alloc();
+        }
+
+        zone_ = iso_alloc_new_zone(chunk_size_);
+
+        if(zone_ == nullptr) {
+            throw std::bad_alloc();
+        }
+    }
+
+    ~zone_resource() override {
+        iso_alloc_destroy_zone(zone_);
+    }
+
+    zone_resource(const zone_resource &) = delete;
+    zone_resource &operator=(const zone_resource &) = delete;
+
+    std::size_t chunk_size() const noexcept {
+        return chunk_size_;
+    }
+
+    iso_alloc_zone_handle *zone() const noexcept {
+        return zone_;
+    }
+
+  protected:
+    void *do_allocate(std::size_t bytes, std::size_t align) override {
+        if(__builtin_expect(bytes <= chunk_size_ && align <= chunk_align_, 1)) {
+            void *p = iso_alloc_from_zone(zone_, bytes);
+
+            if(__builtin_expect(p != nullptr, 1)) {
+                return p;
+            }
+        }
+
+        return alloc_fallback(bytes, align);
+    }
+
+    void do_deallocate(void *p, std::size_t, std::size_t) override {
+        iso_free(p);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+
+  private:
+    std::size_t chunk_size_;
+    std::size_t chunk_align_;
+    iso_alloc_zone_handle *zone_;
+};
+
+/* Objects are default constructed when the cache makes
+ * them and destructed when it gives them back to a zone.
+ * put() doesn't destruct the object, so get() may return
+ * an object in whatever state it was put back in. The
+ * constructor and destructor are called from the C
+ * library and must not throw. Objects still cached by
+ * other threads when the pool is destroyed are released
+ * without being destructed */
+template <typename T>
+class object_pool {
+    static_assert(std::is_nothrow_default_constructible<T>::value, "iso::object_pool objects must be nothrow default constructible");
+    static_assert(std::is_nothrow_destructible<T>::value, "iso::object_pool objects must be nothrow destructible");
+    static_assert(alignof(T) <= kMaxChunkAlign, "iso::object_pool can't align objects beyond a page");
+
+  public:
+    object_pool() : cache_(iso_cache_create(chunk_size_for(sizeof(T), alignof(T)), construct, destruct)) {
+        if(cache_ == nullptr) {
+            throw std::bad_alloc();
+        }
+    }
+
+    ~object_pool() {
+        iso_cache_destroy(cache_);
+    }
+
+    object_pool(const object_pool &) = delete;
+    object_pool &operator=(const object_pool &) = delete;
+
+    [[nodiscard]] T *get() {
+        void *p = iso_cache_alloc(cache_);
+
+        if(p == nullptr) {
+            throw std::bad_alloc();
+        }
+
+        return static_cast<T *>(p);
+    }
+
+    void put(T *p) noexcept {
+        iso_cache_free(cache_, p);
+    }
+
+  private:
+    static void construct(void *p) noexcept {
+        ::new(p) T();
+    }
+
+    static void destruct(void *p) noexcept {
+        static_cast<T *>(p)->~T();
+    }
+
+    iso_cache_handle *cache_;
+};
+} // namespace iso
@@ -33,9 +33,17 @@
 #include <unistd.h>
 
 #if THREAD_SUPPORT
+#include <fcntl.h>
+#include <poll.h>
 #include <pthread.h>
+#if __cplusplus
+/* stdatomic.h is only usable from C++23 onward */
+#include <atomic>
+using std::atomic_flag;
+#else
 #include <stdatomic.h>
 #endif
+#endif
 
 #if UNINIT_READ_SANITY
 #include <fcntl.h>
@@ -51,6 +59,9 @@
 
 #if HEAP_PROFILER
 #include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
 #endif
 
 #ifndef MADV_DONTNEED
@@ -164,6 +175,20 @@
 
 #define CANARY_COUNT_DIV 100
 
+/* Select the low (in use) and high (was used) bit of
+ * every chunk in a bitmap qword */
+#define RESET_LOW_BITS_MASK 0x5555555555555555ULL
+#define RESET_HIGH_BITS_MASK 0xaaaaaaaaaaaaaaaaULL
+
+/* Pages released by a zone reset are likely to be used
+ * again soon. MADV_FREE lets the kernel reclaim them
+ * only under memory pressure */
+#if MADV_FREE
+#define RESET_RELEASE_ADVICE MADV_FREE
+#else
+#define RESET_RELEASE_ADVICE MADV_DONTNEED
+#endif
+
 #define ALIGNMENT 8
 
 #define WHICH_BIT(bit_slot) \
@@ -218,6 +243,15 @@
 #define GET_CHUNK_COUNT(zone) \
     (ZONE_USER_SIZE / zone->chunk_size)
 
+/* Each zone keeps a count of its chunks in each bitmap
+ * state so usage and fullness checks don't need to
+ * walk the bitmap. Chunks in state 00 are not counted */
+#define GET_FREE_CHUNK_COUNT(zone) \
+    (GET_CHUNK_COUNT(zone) - zone->chunks_in_use - zone->chunks_canary)
+
+#define GET_NEVER_USED_CHUNK_COUNT(zone) \
+    (GET_FREE_CHUNK_COUNT(zone) - zone->chunks_was_used)
+
 /* This is the maximum number of zones iso_alloc can
  * create. This is a completely arbitrary number but
  * it does correspond to the size of the _root.zones
@@ -266,8 +300,11 @@
 
 #define MAX_DEFAULT_ZONE_SZ ZONE_8192
 
-/* The size of our bit slot freelist */
+/* The size of our bit slot freelist. A generated
+ * target config may pick a different size */
+#if !TARGET_CONFIG
 #define BIT_SLOT_CACHE_SZ 128
+#endif
 
 /* The size of the thread cache */
 #define THREAD_ZONE_CACHE_SZ 8
@@ -286,20 +323,101 @@
 #define POINTER_FROM_BITSLOT(zone, bit_slot) \
     ((void *) zone->user_pages_start + ((bit_slot / BITS_PER_CHUNK) * zone->chunk_size));
 
+#if ALLOC_STATS
+/* Allocations are counted per power of 2 chunk size
+ * starting at ZONE_16. The last class is big zones */
+#define STATS_SIZE_CLASSES 16
+#define STATS_BIG_CLASS (STATS_SIZE_CLASSES - 1)
+#define STATS_MIN_SHIFT 4
+
+#define STATS_SIZE_CLASS(sz) \
+    ((sz) <= ZONE_16 ? 0 : ((sz) > SMALL_SZ_MAX ? STATS_BIG_CLASS : ((BITS_PER_QWORD - __builtin_clzll((sz) -1)) - STATS_MIN_SHIFT)))
+
+/* Most of these counters are only ever written while
+ * holding either the root or the big zone lock. They
+ * don't need an atomic read-modify-write, a relaxed
+ * load and store is enough to keep readers that don't
+ * take the lock from observing a torn value. Counters
+ * that are written without a lock use STATS_ATOMIC_ADD
+ * and STATS_ATOMIC_SUB */
+typedef struct {
+    /* Written while holding the root lock */
+    uint64_t allocs[STATS_SIZE_CLASSES];
+    uint64_t frees[STATS_SIZE_CLASSES];
+    uint64_t bytes_in_use;
+    uint64_t zones_created;
+    uint64_t cache_refills;
+    uint64_t fast_path_hits;
+    uint64_t slow_path_hits;
+    uint64_t extra_slow_path_hits;
+    uint64_t near_hits;
+    uint64_t zone_pool_hits;
+    uint64_t zones_retired;
+    uint64_t zones_recycled;
+    /* Written while holding the big zone lock */
+    uint64_t big_allocs;
+    uint64_t big_frees;
+    uint64_t big_bytes_in_use;
+    uint64_t big_zone_reuse_hits;
+    uint64_t big_zone_new;
+    /* Written without holding a lock */
+    uint64_t cpu_cache_allocs[STATS_SIZE_CLASSES];
+    uint64_t cpu_cache_frees[STATS_SIZE_CLASSES];
+    uint64_t cpu_cache_bytes;
+    uint64_t lock_contention;
+} iso_alloc_stats_counters;
+
+extern iso_alloc_stats_counters _stats;
+
+#define STATS_ADD(f, n) \
+    __atomic_store_n(&_stats.f, __atomic_load_n(&_stats.f, __ATOMIC_RELAXED) + (n), __ATOMIC_RELAXED);
+
+#define STATS_SUB(f, n) \
+    __atomic_store_n(&_stats.f, __atomic_load_n(&_stats.f, __ATOMIC_RELAXED) - (n), __ATOMIC_RELAXED);
+
+#define STATS_INC(f) \
+    STATS_ADD(f, 1)
+
+#define STATS_ATOMIC_ADD(f, n) \
+    __atomic_fetch_add(&_stats.f, (n), __ATOMIC_RELAXED);
+
+#define STATS_ATOMIC_SUB(f, n) \
+    __atomic_fetch_sub(&_stats.f, (n), __ATOMIC_RELAXED);
+#else
+#define STATS_ADD(f, n)
+#define STATS_SUB(f, n)
+#define STATS_INC(f)
+#define STATS_ATOMIC_ADD(f, n)
+#define STATS_ATOMIC_SUB(f, n)
+#endif
+
 #if THREAD_SUPPORT
 extern atomic_flag root_busy_flag;
 extern atomic_flag big_zone_busy_flag;
 
-#define LOCK_ROOT() \
-    do {            \
-    } while(atomic_flag_test_and_set(&root_busy_flag));
+/* Only count contention when the first attempt
+ * to take the lock fails so the uncontended
+ * path is unchanged */
+#define LOCK_ROOT()                                               \
+    do {                                                          \
+        if(UNLIKELY(atomic_flag_test_and_set(&root_busy_flag))) { \
+            STATS_ATOMIC_ADD(lock_contention, 1);                 \
+            do {                                                  \
+            } while(atomic_flag_test_and_set(&root_busy_flag));   \
+        }                                                         \
+    } while(0)
 
 #define UNLOCK_ROOT() \
     atomic_flag_clear(&root_busy_flag);
 
-#define LOCK_BIG_ZONE() \
-    do {                \
-    } while(atomic_flag_test_and_set(&big_zone_busy_flag));
+#define LOCK_BIG_ZONE()                                               \
+    do {                                                              \
+        if(UNLIKELY(atomic_flag_test_and_set(&big_zone_busy_flag))) { \
+            STATS_ATOMIC_ADD(lock_contention, 1);                     \
+            do {                                                      \
+            } while(atomic_flag_test_and_set(&big_zone_busy_flag));   \
+        }                                                             \
+    } while(0)
 
 #define UNLOCK_BIG_ZONE() \
     atomic_flag_clear(&big_zone_busy_flag);
@@ -322,7 +440,35 @@ extern uint32_t g_page_size;
  * profile by adjusting the next few lines below. */
 extern uint32_t _default_zone_count;
 
-#if SMALL_MEM_STARTUP
+/* The most default zones a runtime zone layout
+ * may ask for */
+#define MAX_DEFAULT_ZONES 64
+
+/* Default zones can also be read at startup from an
+ * environment variable or a file. Both hold a list of
+ * size:count[:prepopulate] entries separated by commas
+ * or whitespace, e.g. "64:2:y,256:1,4096:4:n". Files
+ * may contain # comments. The variable takes priority */
+#define ZONE_LAYOUT_ENV_STR "ISO_ALLOC_ZONE_LAYOUT"
+#define ZONE_LAYOUT_FILE_ENV_STR "ISO_ALLOC_ZONE_LAYOUT_FILE"
+#define ZONE_LAYOUT_MAX_FILE_SZ 4096
+
+/* A layout always gets a zone for every power of 2
+ * size from SMALLEST_ZONE up to this size, even if it
+ * doesn't list them */
+#define ZONE_LAYOUT_BASELINE_MAX ZONE_128
+
+typedef struct {
+    uint32_t size;
+    bool prepopulate;
+} iso_zone_layout_entry;
+
+#if TARGET_CONFIG
+/* Generated from profiler data by the profiler tool.
+ * See PROFILER.md. This defines SMALLEST_ZONE,
+ * BIT_SLOT_CACHE_SZ and default_zones */
+#include "iso_alloc_target_config.h"
+#elif SMALL_MEM_STARTUP
 /* ZONE_USER_SIZE * sizeof(default_zones) = ~32 mb */
 #define SMALLEST_ZONE ZONE_64
 static uint64_t default_zones[] = {ZONE_64, ZONE_256, ZONE_512, ZONE_1024};
@@ -360,21 +506,35 @@ static uint64_t default_zones[] = {ZONE_256, ZONE_256, ZONE_512, ZONE_512};
 static uint64_t default_zones[] = {ZONE_512, ZONE_512, ZONE_512, ZONE_1024};
 #endif
 
+#if BIT_SLOT_CACHE_SZ >= 255
+#error "BIT_SLOT_CACHE_SZ must be less than 255"
+#endif
+
 typedef uint64_t bit_slot_t;
 typedef int64_t bitmap_index_t;
 
 /* The API allows for consumers of the library to
  * create their own zones for unique data/object
- * types. This structure allows the caller to define
- * which security mitigations should be applied to
- * all allocations within the zone */
-typedef struct {
-    bool random_allocation_pattern;
-    bool adjacent_canary_verification_on_alloc;
-    bool adjacent_canary_verification_on_free;
-    bool clear_chunk_on_free;
-    bool double_free_detection;
-} iso_alloc_zone_configuration;
+ * types. An iso_alloc_zone_configuration, defined in
+ * the public iso_alloc.h header, lets the caller pick
+ * which security mitigations apply to all allocations
+ * within the zone. It is stored in the zone as flags */
+#define ZONE_RANDOM_ALLOCATION_PATTERN 0x1
+#define ZONE_CANARY_CHECK_ON_ALLOC 0x2
+#define ZONE_CANARY_CHECK_ON_FREE 0x4
+#define ZONE_CLEAR_CHUNK_ON_FREE 0x8
+#define ZONE_DOUBLE_FREE_DETECTION 0x10
+
+#if SANITIZE_CHUNKS && !ENABLE_ASAN
+#define ZONE_DEFAULT_CLEAR_CHUNK ZONE_CLEAR_CHUNK_ON_FREE
+#else
+#define ZONE_DEFAULT_CLEAR_CHUNK 0
+#endif
+
+/* Every internally managed zone, and every custom zone
+ * created without a configuration, gets all of them */
+#define ZONE_DEFAULT_CONFIG (ZONE_RANDOM_ALLOCATION_PATTERN | ZONE_CANARY_CHECK_ON_ALLOC | ZONE_CANARY_CHECK_ON_FREE | \
+                             ZONE_DEFAULT_CLEAR_CHUNK | ZONE_DOUBLE_FREE_DETECTION)
 
 typedef struct {
     void *user_pages_start;     /* Start of the pages backing this zone */
@@ -384,9 +544,18 @@ typedef struct {
     uint64_t pointer_mask;      /* Each zone has its own pointer protection secret */
     uint32_t chunk_size;        /* Size of chunks managed by this zone */
     uint32_t bitmap_size;       /* Size of the bitmap in bytes */
+    uint32_t chunks_in_use;     /* Number of chunks in state 10 */
+    uint32_t chunks_was_used;   /* Number of chunks in state 01 */
+    uint32_t chunks_canary;     /* Number of chunks in state 11 */
+    uint32_t bump_chunk;        /* Next chunk a sequential zone looks at when it has no free'd chunk to reuse */
     bool internally_managed;    /* Zones can be managed by iso_alloc or custom */
     bool is_full;               /* Indicates whether this zone is full to avoid expensive free bit slot searches */
+#if ZONE_RETIREMENT
+    bool is_retired;           /* This zone was empty, its pages are decommitted and its descriptor can be recycled */
+    uint32_t chunks_permanent; /* Number of chunks in state 11 that were permanently free'd */
+#endif
     uint16_t index;             /* Zone index */
+    uint8_t config;             /* ZONE_* mitigation flags */
 #if CPU_PIN
     uint8_t cpu_core; /* What CPU core this zone is pinned to */
 #endif
@@ -409,6 +578,321 @@ typedef struct {
 
 static __thread _tzc thread_zone_cache[THREAD_ZONE_CACHE_SZ];
 static __thread size_t thread_zone_cache_count;
+
+#if ZONE_RETIREMENT
+/* A thread zone cache filled before a zone descriptor was
+ * recycled may describe the zone that used to be there */
+static __thread uint64_t thread_zone_cache_generation;
+#endif
+#endif
+
+#if PER_CPU_CACHE
+/* The number of chunks each CPU can cache per size class */
+#define PER_CPU_CACHE_SZ 32
+
+/* There is one size class for each power of 2
+ * between ZONE_16 and MAX_DEFAULT_ZONE_SZ */
+#define PER_CPU_CACHE_MIN_SHIFT 4
+#define PER_CPU_CACHE_CLASSES 10
+
+/* Upper bound on the number of CPU caches we create */
+#define MAX_CPU_CACHES 1024
+
+/* Each CPU core gets a cache of chunks that were recently
+ * free'd on that core. These chunks remain marked as in
+ * use in their zone bitmap and can be handed back out
+ * without taking the root lock. The lock here is rarely
+ * contended because only threads scheduled on the same
+ * core race for it */
+typedef struct {
+#if THREAD_SUPPORT
+    atomic_flag lock;
+#endif
+    uint16_t count[PER_CPU_CACHE_CLASSES];
+    void *chunks[PER_CPU_CACHE_CLASSES][PER_CPU_CACHE_SZ];
+} __attribute__((aligned(64))) iso_cpu_cache;
+
+/* The zone pointers in the root are masked and unmasked
+ * in place by whoever holds the root lock, so the free
+ * path finds cacheable zones in a table of these instead.
+ * Both pointers are masked with _cpu_cache_secret and
+ * user_pages_start is 0 when a zone's chunks can't be
+ * cached. An entry is only changed under the root lock */
+typedef struct {
+    uintptr_t user_pages_start;
+    uintptr_t bitmap_start;
+    size_t chunk_size;
+} iso_cpu_cache_zone;
+
+extern iso_cpu_cache *_cpu_caches;
+extern uint32_t _cpu_cache_count;
+extern uint64_t _cpu_cache_secret;
+
+#if THREAD_SUPPORT
+#define LOCK_CPU_CACHE(cc) \
+    do {                   \
+    } while(atomic_flag_test_and_set(&cc->lock));
+
+#define UNLOCK_CPU_CACHE(cc) \
+    atomic_flag_clear(&cc->lock);
+#else
+#define LOCK_CPU_CACHE(cc)
+#define UNLOCK_CPU_CACHE(cc)
+#endif
+#endif
+
+#if ADAPTIVE_ZONES
+/* Allocations up to ADAPTIVE_MAX_SZ bytes are counted
+ * in 16 byte buckets */
+#define ADAPTIVE_BUCKET_SHIFT 4
+#define ADAPTIVE_MAX_SZ ZONE_1024
+#define ADAPTIVE_BUCKETS ((ADAPTIVE_MAX_SZ >> ADAPTIVE_BUCKET_SHIFT) + 1)
+#define ADAPTIVE_BUCKET(sz) (((sz) + ((1 << ADAPTIVE_BUCKET_SHIFT) - 1)) >> ADAPTIVE_BUCKET_SHIFT)
+
+/* Counts are evaluated every ADAPTIVE_WINDOW counted
+ * allocations. A bucket that received 1/ADAPTIVE_MIN_SHARE
+ * of them in ADAPTIVE_SUSTAIN_WINDOWS windows in a row
+ * gets a zone of its own if its power of 2 zone would
+ * waste at least 1/ADAPTIVE_MIN_WASTE of each chunk */
+#define ADAPTIVE_WINDOW 65536
+#define ADAPTIVE_MIN_SHARE 16
+#define ADAPTIVE_SUSTAIN_WINDOWS 2
+#define ADAPTIVE_MIN_WASTE 4
+
+/* Counts and the window are updated without a lock.
+ * Everything else is protected by the root lock. Routes
+ * hold a zone index + 1 so that 0 means no route */
+typedef struct {
+    uint32_t window_remaining;
+    uint32_t counts[ADAPTIVE_BUCKETS];
+    uint32_t routes[ADAPTIVE_BUCKETS];
+    uint8_t streaks[ADAPTIVE_BUCKETS];
+} iso_adaptive_zones;
+
+extern iso_adaptive_zones _adaptive_zones;
+
+/* Sizes with a dedicated zone skip the CPU cache, which
+ * only holds chunks from power of 2 zones. So does every
+ * size once the window is used up, so it is evaluated */
+#define ADAPTIVE_SKIP_CPU_CACHE(sz)                                                          \
+    ((sz) <= ADAPTIVE_MAX_SZ &&                                                              \
+     (__atomic_load_n(&_adaptive_zones.window_remaining, __ATOMIC_RELAXED) == 0 ||           \
+      __atomic_load_n(&_adaptive_zones.routes[ADAPTIVE_BUCKET(sz)], __ATOMIC_RELAXED) != 0))
+#else
+#define ADAPTIVE_SKIP_CPU_CACHE(sz) false
+#endif
+
+/* The bitmap of a zone with SMALLEST_ZONE chunks, which
+ * is the largest bitmap any zone has */
+#define ZONE_MAX_BITMAP_SIZE (((ZONE_USER_SIZE / SMALLEST_ZONE) << BITS_PER_CHUNK_SHIFT) >> BITS_PER_BYTE_SHIFT)
+
+#if ZONE_RETIREMENT
+/* Zones that become empty are queued and every time
+ * ZONE_RETIRE_BATCH of them are queued the empty internal
+ * zones, other than the default zones, that go beyond the
+ * first ZONE_RETIRE_KEEP of each chunk size are retired.
+ * Their pages are decommitted but stay mapped and their
+ * descriptors are recycled by the next zones created */
+#define ZONE_RETIRE_KEEP 1
+#define ZONE_RETIRE_BATCH 8
+
+extern uint64_t _zone_recycle_generation;
+#endif
+
+#if PACKED_BITMAPS
+/* Bitmaps of PACKED_BITMAP_MAX bytes or less, which belong
+ * to zones with chunks of 2048 bytes or larger, are packed
+ * into shared arenas of BITMAP_ARENA_PAGES pages that sit
+ * between two guard pages. Each page holds bitmaps of one
+ * power of 2 size, at least PACKED_BITMAP_MIN bytes */
+#define PACKED_BITMAP_MIN 16
+#define PACKED_BITMAP_MAX 1024
+#define BITMAP_ARENA_PAGES 32
+#define BITMAP_PAGE_SLOTS 256
+#define BITMAP_PAGE_WORDS (BITMAP_PAGE_SLOTS / 64)
+
+/* Enough arenas for MAX_ZONES of the largest packed
+ * bitmaps with 4096 byte pages */
+#define MAX_BITMAP_ARENAS (((MAX_ZONES * PACKED_BITMAP_MAX) / (BITMAP_ARENA_PAGES * 4096)) + 2)
+
+typedef struct {
+    uint64_t used[BITMAP_PAGE_WORDS];
+    uint16_t slot_size;
+    uint16_t in_use;
+} iso_bitmap_page;
+
+typedef struct {
+    uint8_t *start;
+    iso_bitmap_page pages[BITMAP_ARENA_PAGES];
+} iso_bitmap_arena;
+#endif
+
+#if ZONE_ARENA
+/* Zones are carved out of arenas reserved with PROT_NONE,
+ * ZONE_ARENA_SLOTS zones at a time. Each slot holds room
+ * for the largest bitmap, a guard page, the user pages and
+ * a guard page. A bitmap ends right below the guard page
+ * in its slot and the unused room below it stays PROT_NONE,
+ * as does the guard page at the end of the slot before it.
+ * Only the bitmap and user pages are made RW so neighbours
+ * share their guard pages and no guard needs an mprotect */
+#define ZONE_ARENA_SLOTS 256
+#endif
+
+#if ZONE_POOL
+#if !THREAD_SUPPORT
+#error "ZONE_POOL requires THREAD_SUPPORT"
+#endif
+
+/* The zone pool thread keeps ZONE_POOL_SZ zones worth of
+ * pages mapped, guarded and faulted in. Their bitmaps are
+ * sized for SMALLEST_ZONE chunks so a zone of any chunk
+ * size can use them. Zones with larger chunks unmap the
+ * start of the bitmap they don't need */
+#define ZONE_POOL_SZ 2
+
+typedef struct {
+    void *bitmap_start;
+    void *user_pages_start;
+} iso_zone_pool_entry;
+#endif
+
+/* The trace recorder writes a header followed by one
+ * record per malloc, calloc, realloc, memalign or free
+ * call made through the hooks. Records are buffered per
+ * thread and appended to the trace file a buffer at a
+ * time so they are only ordered within a thread. The
+ * replay tool sorts them by timestamp. A free record
+ * is timestamped before the chunk is released and an
+ * allocation record after it is returned so a pointer
+ * that is reused always sorts after the free */
+/* Each process writes its own trace to the path with
+ * its pid appended, so a child that is exec'd or forked
+ * never writes into the trace of its parent */
+#define TRACE_PATH_ENV_STR "ISO_ALLOC_TRACE_PATH"
+#define TRACE_DEFAULT_PATH "iso_alloc.trace"
+#define TRACE_MAGIC 0x49534f54
+#define TRACE_VERSION 1
+#define TRACE_BUFFER_RECORDS 4096
+
+#define TRACE_OP_MALLOC 0
+#define TRACE_OP_CALLOC 1
+#define TRACE_OP_REALLOC 2
+#define TRACE_OP_FREE 3
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t start_ns; /* CLOCK_MONOTONIC time of the first record */
+} iso_trace_header;
+
+/* Pointers are recorded as they were returned and act
+ * as ids. The replay tool maps them to its own chunks */
+typedef struct {
+    uint64_t timestamp; /* Nanoseconds since start_ns */
+    uint64_t ptr;       /* Pointer returned or free'd */
+    uint64_t old_ptr;   /* Pointer passed to realloc */
+    uint64_t size;      /* Requested size, nmemb * size for calloc */
+    uint32_t tid;
+    uint32_t op;
+} iso_trace_record;
+
+#if ALLOC_TRACE
+/* Only the owning thread adds records. It publishes
+ * count with a release store so the destructor can flush
+ * the buffer of a thread that is still running. The lock
+ * is held while the buffer is written out */
+typedef struct iso_trace_buffer {
+    struct iso_trace_buffer *next;
+    atomic_flag lock;
+    uint32_t tid;
+    uint32_t count;
+    iso_trace_record records[TRACE_BUFFER_RECORDS];
+} iso_trace_buffer;
+
+#define TRACE_OP(op, p, old, s) \
+    _iso_alloc_trace(op, p, old, s)
+#else
+#define TRACE_OP(op, p, old, s)
+#endif
+
+/* An object cache hands out objects of one size from
+ * zones that belong to the cache. Objects are constructed
+ * once when they leave a zone and destructed when they go
+ * back to one. In between, free'd objects are kept in
+ * their constructed state in per-thread magazines, two
+ * per cache per thread, and a per-cache depot of spare
+ * magazines. Cached objects stay marked as in use in the
+ * zone bitmap so their canaries are never written over
+ * the constructed object. Each cache zone has a bitmap
+ * with one bit per chunk that is set while the chunk is
+ * in a magazine so a double free is still detected */
+#define MAX_OBJECT_CACHES 64
+#define CACHE_MAGAZINE_SZ 64
+#define CACHE_MAX_ZONES 16
+
+/* Full magazines the depot keeps before they are flushed
+ * back to the zones */
+#define CACHE_DEPOT_MAX 16
+
+typedef struct iso_magazine {
+    struct iso_magazine *next;
+    uint32_t count;
+    void *objects[CACHE_MAGAZINE_SZ];
+} iso_magazine;
+
+typedef struct {
+    iso_alloc_zone *zones[CACHE_MAX_ZONES];
+    uintptr_t zone_start[CACHE_MAX_ZONES];   /* Unmasked user_pages_start of each zone */
+    uintptr_t bitmap_start[CACHE_MAX_ZONES]; /* Unmasked bitmap_start of each zone */
+    uint64_t *cached[CACHE_MAX_ZONES];       /* Bits for chunks that are in a magazine */
+    uint32_t zone_count;                     /* Published with a release store after a zone's entries */
+    size_t size; /* Chunk size of the cache zones */
+    void (*ctor)(void *p);
+    void (*dtor)(void *p);
+    iso_magazine *full;
+    iso_magazine *empty;
+    uint32_t full_count;
+    uint64_t generation; /* Changes each time the slot is reused, zero when free */
+#if THREAD_SUPPORT
+    atomic_flag lock;
+#endif
+} iso_object_cache;
+
+/* Per-thread magazines for one cache. A generation that
+ * doesn't match the cache means the cache was destroyed
+ * since this thread last used it */
+typedef struct {
+    iso_magazine *loaded;
+    iso_magazine *previous;
+    uint64_t generation;
+} iso_cache_magazines;
+
+/* Size classes the zone provisioner thread keeps at
+ * least free_chunks free chunks for. The thread sleeps
+ * until an allocation takes a size below its mark, then
+ * creates zones for it. Both are set with the root lock
+ * held and checked by every allocation from a zone */
+#define MAX_WATERMARKS 16
+
+typedef struct {
+    size_t size;
+    size_t free_chunks;
+} iso_alloc_watermark;
+
+extern uint32_t _watermarks_armed;
+extern bool _provisioner_wake_pending;
+
+#if THREAD_SUPPORT
+#define LOCK_OBJECT_CACHE(c) \
+    do {                     \
+    } while(atomic_flag_test_and_set(&c->lock));
+
+#define UNLOCK_OBJECT_CACHE(c) \
+    atomic_flag_clear(&c->lock);
+#else
+#define LOCK_OBJECT_CACHE(c)
+#define UNLOCK_OBJECT_CACHE(c)
 #endif
 
 /* Meta data for big allocations are allocated near the
@@ -440,26 +924,229 @@ typedef struct {
     iso_alloc_zone zones[MAX_ZONES];
 } __attribute__((aligned(sizeof(int64_t)))) iso_alloc_root;
 
+/* Free chunks are bucketed by the log2 of their chunk
+ * size, from 1 byte up to SMALL_SZ_MAX (2^18) bytes */
+#define HEAP_USAGE_CLASSES 19
+
+#define HEAP_USAGE_CLASS(sz) \
+    ((sz) <= 1 ? 0 : (BITS_PER_QWORD - __builtin_clzll((sz) -1)))
+
+#if SIZE_CLASSES
+/* Zones created on demand hold chunks of one of these
+ * size classes. Up to ZONE_64 they are 16 bytes apart,
+ * after that there are 4 classes per power of 2, e.g.
+ * 128, 160, 192, 224, 256. A chunk is never more than
+ * 20% larger than the request it was rounded up from
+ * and there are only SIZE_CLASS_COUNT distinct sizes
+ * of zone below SMALL_SZ_MAX */
+#define SIZE_CLASS_COUNT 52
+#define SIZE_CLASSES_PER_DOUBLING 4
+
+/* floor(log2(sz - 1)) for sz > ZONE_64 */
+#define SIZE_CLASS_LG(sz) \
+    ((BITS_PER_QWORD - 1) - __builtin_clzll((sz) -1))
+
+#define SIZE_CLASS(sz) \
+    ((sz) <= ZONE_16 ? 0 : ((sz) <= ZONE_64 ? (((sz) -1) >> 4) : (((SIZE_CLASS_LG(sz) - 6) << 2) + (((sz) -1) >> (SIZE_CLASS_LG(sz) - 2)))))
+
+#define SIZE_CLASS_SIZE(c) \
+    ((c) < 4 ? (((size_t) (c) + 1) << 4) : ((((size_t) (c) &3) + 5) << (((c) >> 2) + 3)))
+
+#define SIZE_CLASS_ROUND(sz) \
+    SIZE_CLASS_SIZE(SIZE_CLASS(sz))
+
+/* Zones created on demand with chunks larger than the
+ * size class of a request are not used for it while a
+ * zone for its class can still be created. Adaptive zones
+ * give hot small sizes a zone of their own so those are
+ * left to them */
+#if ADAPTIVE_ZONES
+#define SIZE_CLASS_STRICT_MIN ADAPTIVE_MAX_SZ
+#else
+#define SIZE_CLASS_STRICT_MIN 0
+#endif
+
+/* Default zones serve every request in their power of 2
+ * class up to this size. Above it a default chunk can
+ * waste more than a page so a size class zone is made */
+#define SIZE_CLASS_DEFAULT_STRICT_MIN ZONE_4096
+
+#define ZONE_FIT_CLASSES SIZE_CLASS_COUNT
+#define ZONE_FIT_CLASS(sz) SIZE_CLASS(sz)
+#define ZONE_FIT_CLASS_MIN(c) ((c) == 0 ? 0 : SIZE_CLASS_SIZE((c) -1))
+#else
+#define ZONE_FIT_CLASSES HEAP_USAGE_CLASSES
+#define ZONE_FIT_CLASS(sz) HEAP_USAGE_CLASS(sz)
+#define ZONE_FIT_CLASS_MIN(c) ((1ULL << (c)) >> 1)
+#endif
+
+/* Default zones are sorted by chunk size. For each size
+ * class this holds the index of the first default zone
+ * that could fit a chunk of that class. Any zones created
+ * later are found after the default zones */
+extern uint32_t _default_zone_fit[ZONE_FIT_CLASSES];
+
+/* A snapshot of how zone and big zone memory is being
+ * used. This is what backs the mallinfo family of
+ * interfaces exported by malloc_hook.c */
+typedef struct {
+    uint64_t zone_bytes;                           /* User pages mapped by all zones */
+    uint64_t zone_in_use_bytes;                    /* Bytes in chunks currently handed out */
+    uint64_t zone_free_bytes;                      /* Bytes in free chunks */
+    uint64_t zone_free_chunks;                     /* Number of free chunks */
+    uint64_t canary_bytes;                         /* Bytes in canary and permanently free'd chunks */
+    uint64_t big_zones;                            /* Number of big zones */
+    uint64_t big_zone_bytes;                       /* User pages mapped by all big zones */
+    uint64_t big_in_use_bytes;                     /* Bytes in big zones currently handed out */
+    uint64_t big_free_zones;                       /* Number of free big zones */
+    uint64_t free_chunks[HEAP_USAGE_CLASSES];      /* Free chunks per size class */
+    uint64_t free_chunk_bytes[HEAP_USAGE_CLASSES]; /* Free bytes per size class */
+} iso_alloc_heap_usage;
+
 #if HEAP_PROFILER
-#define PROFILER_ODDS 10000
-#define HG_SIZE 65535
+/* The profiler samples on average once every
+ * PROFILER_SAMPLE_RATE bytes allocated by a thread */
+#define PROFILER_SAMPLE_RATE 524288
+#define PROFILER_RNG_BITS 26
 #define CHUNK_USAGE_THRESHOLD 75
 #define PROFILER_ENV_STR "ISO_ALLOC_PROFILER_FILE_PATH"
 #define PROFILER_FILE_PATH "iso_alloc_profiler.data"
-#define PROFILER_STACK_DEPTH 2
-
-uint64_t _allocation_count;
-uint64_t _sampled_count;
+#define PROFILER_PPROF_ENV_STR "ISO_ALLOC_PROFILER_PPROF_PATH"
+#define PROFILER_PPROF_FILE_PATH "iso_alloc_profiler.heap"
+
+/* Setting either of these switches the profiler data
+ * file from the text format written at exit to a
+ * stream of binary snapshots appended to it. The
+ * interval is in seconds and the signal is a number
+ * e.g. 12 for SIGUSR2 */
+#define PROFILER_INTERVAL_ENV_STR "ISO_ALLOC_PROFILER_INTERVAL"
+#define PROFILER_SIGNAL_ENV_STR "ISO_ALLOC_PROFILER_SIGNAL"
+
+/* The maximum number of frames recorded for each
+ * sampled allocation. Frames are collected by walking
+ * frame pointers so the target should be built with
+ * -fno-omit-frame-pointer */
+#define PROFILER_STACK_DEPTH 16
+
+/* Frames belonging to the profiler and _iso_alloc */
+#define PROFILER_SKIP_FRAMES 2
+
+/* Frame pointers further apart than this are assumed
+ * to be garbage and end the stack walk */
+#define PROFILER_MAX_FRAME_SIZE 1048576
+
+/* The number of unique stacks the profiler can track
+ * and the number of sampled chunks that can be live
+ * at the same time. Both must be a power of 2 */
+#define PROFILER_STACK_TABLE_SZ 4096
+#define PROFILER_LIVE_SAMPLES 16384
+
+/* Each thread counts down the bytes it allocates and
+ * takes a sample when the count reaches 0. The next
+ * countdown is drawn from an exponential distribution
+ * so the chance a byte is sampled doesn't depend on
+ * the size of the allocation it belongs to */
+typedef struct {
+    int64_t bytes_until_sample; /* Bytes left to allocate before the next sample */
+    uint64_t allocation_count;  /* Allocations not yet merged into _allocation_count */
+    uint64_t sampled_count;     /* Samples not yet merged into _sampled_count */
+    uint64_t rng;               /* Per-thread PRNG state */
+    bool initialized;
+} iso_profiler_thread_state;
+
+extern uint64_t _allocation_count;
+extern uint64_t _sampled_count;
+
+/* Sampled allocations are also counted by the log2
+ * of their size. The last class holds big zone sizes */
+#define PROFILER_SIZE_CLASSES (HEAP_USAGE_CLASSES + 1)
+#define PROFILER_SIZE_CLASS(sz) \
+    ((sz) > SMALL_SZ_MAX ? HEAP_USAGE_CLASSES : HEAP_USAGE_CLASS(sz))
+
+extern uint64_t _profiler_size_samples[PROFILER_SIZE_CLASSES];
+
+/* Sampled allocations are deduplicated by call stack.
+ * Each unique stack keeps counts for all the sampled
+ * allocations made from it and for those still live */
+typedef struct {
+    uint64_t hash;
+    uint64_t alloc_count;
+    uint64_t alloc_bytes;
+    uint64_t in_use_count;
+    uint64_t in_use_bytes;
+    uint32_t depth;
+    void *frames[PROFILER_STACK_DEPTH];
+} iso_profiler_stack;
+
+/* Sampled chunks that have not been free'd yet. This
+ * is how a free is attributed back to its stack */
+typedef struct {
+    void *p;
+    uint64_t size;
+    uint32_t stack;
+} iso_profiler_live_sample;
 
-int32_t profiler_fd;
-uint32_t caller_hg[HG_SIZE];
+extern int32_t profiler_fd;
+extern iso_profiler_stack *_profiler_stacks;
+extern iso_profiler_live_sample *_profiler_live;
+extern uint32_t _profiler_stack_count;
+extern uint32_t _profiler_live_count;
+extern uint64_t _profiler_dropped;
 
 typedef struct {
     uint64_t total;
     uint64_t count;
 } zone_profiler_map_t;
 
-zone_profiler_map_t _zone_profiler_map[SMALL_SZ_MAX];
+extern zone_profiler_map_t _zone_profiler_map[SMALL_SZ_MAX];
+
+/* Binary snapshots are appended to the profiler data
+ * file with a single write each. Every record starts
+ * with the number of bytes that follow the length
+ * field so a reader can skip records it doesn't
+ * understand or detect one truncated by a SIGKILL.
+ * All fields are native endian */
+#define PROFILER_SNAPSHOT_MAGIC 0x49534f50
+#define PROFILER_SNAPSHOT_VERSION 2
+
+#define PROFILER_SNAPSHOT_INTERVAL 0
+#define PROFILER_SNAPSHOT_SIGNAL 1
+#define PROFILER_SNAPSHOT_EXIT 2
+
+typedef struct {
+    uint32_t length;        /* Bytes in this record after this field */
+    uint32_t magic;         /* PROFILER_SNAPSHOT_MAGIC */
+    uint32_t version;       /* PROFILER_SNAPSHOT_VERSION */
+    uint32_t reason;        /* PROFILER_SNAPSHOT_INTERVAL/SIGNAL/EXIT */
+    uint64_t timestamp;     /* CLOCK_REALTIME in nanoseconds */
+    uint64_t allocated;     /* Total allocations merged so far */
+    uint64_t sampled;       /* Total samples merged so far */
+    uint64_t dropped;       /* Samples lost to a full stack table */
+    uint64_t size_samples[PROFILER_SIZE_CLASSES];
+    uint32_t zone_entries;  /* iso_profiler_snapshot_zone records that follow */
+    uint32_t stack_entries; /* iso_profiler_snapshot_stack records that follow them */
+} iso_profiler_snapshot_hdr;
+
+/* One entry per chunk size across all zones */
+typedef struct {
+    uint32_t chunk_size;
+    uint32_t zones;
+    uint64_t chunks;
+    uint64_t chunks_in_use;
+    uint64_t full_samples; /* Samples that found a zone above CHUNK_USAGE_THRESHOLD */
+} iso_profiler_snapshot_zone;
+
+typedef struct {
+    uint64_t hash;
+    uint64_t alloc_count;
+    uint64_t alloc_bytes;
+    uint64_t in_use_count;
+    uint64_t in_use_bytes;
+} iso_profiler_snapshot_stack;
+
+#define PROFILER_SNAPSHOT_MAX_SZ (sizeof(iso_profiler_snapshot_hdr) +                \
+                                  (MAX_ZONES * sizeof(iso_profiler_snapshot_zone)) + \
+                                  (PROFILER_STACK_TABLE_SZ * sizeof(iso_profiler_snapshot_stack)))
 #endif
 
 #if ALLOC_SANITY
@@ -506,35 +1193,49 @@ extern _sane_allocation_t _sane_allocations[MAX_SANE_SAMPLES];
 /* The global root */
 extern iso_alloc_root *_root;
 
+/* Defined in the public iso_alloc.h header */
+struct iso_alloc_stats;
+
 INTERNAL_HIDDEN INLINE void check_big_canary(iso_alloc_big_zone *big);
 INTERNAL_HIDDEN INLINE void check_canary(iso_alloc_zone *zone, void *p);
 INTERNAL_HIDDEN INLINE void iso_clear_user_chunk(uint8_t *p, size_t size);
 INTERNAL_HIDDEN INLINE void fill_free_bit_slot_cache(iso_alloc_zone *zone);
 INTERNAL_HIDDEN INLINE void insert_free_bit_slot(iso_alloc_zone *zone, int64_t bit_slot);
 INTERNAL_HIDDEN INLINE void write_canary(iso_alloc_zone *zone, void *p);
-INTERNAL_HIDDEN INLINE int64_t check_canary_no_abort(iso_alloc_zone *zone, void *p);
-INTERNAL_HIDDEN INLINE uint64_t _get_backtrace_hash(uint32_t frames);
+INTERNAL_HIDDEN int64_t check_canary_no_abort(iso_alloc_zone *zone, void *p);
 INTERNAL_HIDDEN INLINE size_t next_pow2(size_t sz);
+INTERNAL_HIDDEN size_t _iso_new_zone_chunk_size(size_t size);
 INTERNAL_HIDDEN INLINE void flush_thread_zone_cache(void);
 INTERNAL_HIDDEN FLATTEN void iso_free_chunk_from_zone(iso_alloc_zone *zone, void *p, bool permanent);
 INTERNAL_HIDDEN iso_alloc_zone *is_zone_usable(iso_alloc_zone *zone, size_t size);
 INTERNAL_HIDDEN iso_alloc_zone *iso_find_zone_fit(size_t size);
 INTERNAL_HIDDEN iso_alloc_zone *iso_new_zone(size_t size, bool internal);
 INTERNAL_HIDDEN iso_alloc_zone *_iso_new_zone(size_t size, bool internal);
+INTERNAL_HIDDEN iso_alloc_zone *_iso_new_zone_with_config(size_t size, bool internal, uint8_t config);
+INTERNAL_HIDDEN iso_alloc_zone *iso_new_zone_with_config(size_t size, bool internal, uint8_t config);
 INTERNAL_HIDDEN iso_alloc_zone *iso_find_zone_bitmap_range(void *p);
 INTERNAL_HIDDEN iso_alloc_zone *iso_find_zone_range(void *p);
 INTERNAL_HIDDEN bit_slot_t iso_scan_zone_free_slot_slow(iso_alloc_zone *zone);
+INTERNAL_HIDDEN bit_slot_t iso_scan_zone_free_slot_near(iso_alloc_zone *zone, void *hint);
 INTERNAL_HIDDEN bit_slot_t iso_scan_zone_free_slot(iso_alloc_zone *zone);
 INTERNAL_HIDDEN bit_slot_t get_next_free_bit_slot(iso_alloc_zone *zone);
 INTERNAL_HIDDEN iso_alloc_root *iso_alloc_new_root(void);
 INTERNAL_HIDDEN bool iso_does_zone_fit(iso_alloc_zone *zone, size_t size);
+INTERNAL_HIDDEN bool iso_zone_fits_size(iso_alloc_zone *zone, size_t size);
+INTERNAL_HIDDEN uint64_t _iso_free_chunks_for_size(size_t size);
 INTERNAL_HIDDEN void create_canary_chunks(iso_alloc_zone *zone);
 INTERNAL_HIDDEN void iso_alloc_initialize_global_root(void);
+INTERNAL_HIDDEN void _iso_alloc_create_default_zones(void);
+INTERNAL_HIDDEN void _iso_alloc_populate_zone(iso_alloc_zone *zone);
 INTERNAL_HIDDEN void mprotect_pages(void *p, size_t size, int32_t protection);
 INTERNAL_HIDDEN void create_guard_page(void *p);
 INTERNAL_HIDDEN void *mmap_rw_pages(size_t size, bool populate);
+INTERNAL_HIDDEN void *_iso_map_guarded_pages(size_t size, int32_t advice);
+INTERNAL_HIDDEN void _iso_map_zone_pages(size_t bitmap_size, void **bitmap_start, void **user_pages_start);
+INTERNAL_HIDDEN void _iso_populate_pages(void *p, size_t size);
 INTERNAL_HIDDEN void _iso_alloc_destroy_zone(iso_alloc_zone *zone);
 INTERNAL_HIDDEN void _verify_zone(iso_alloc_zone *zone);
+INTERNAL_HIDDEN void _verify_big_zone(iso_alloc_big_zone *big);
 INTERNAL_HIDDEN void _verify_all_zones(void);
 INTERNAL_HIDDEN void verify_zone(iso_alloc_zone *zone);
 INTERNAL_HIDDEN void verify_all_zones(void);
@@ -545,6 +1246,9 @@ INTERNAL_HIDDEN void _iso_alloc_unprotect_root(void);
 INTERNAL_HIDDEN void _unmap_zone(iso_alloc_zone *zone);
 INTERNAL_HIDDEN void *_iso_big_alloc(size_t size);
 INTERNAL_HIDDEN void *_iso_alloc(iso_alloc_zone *zone, size_t size);
+INTERNAL_HIDDEN void *__iso_alloc(iso_alloc_zone *zone, void *hint, size_t size);
+INTERNAL_HIDDEN void *_iso_alloc_near(void *hint, size_t size);
+INTERNAL_HIDDEN void *iso_alloc_near_zone(void *hint, size_t size);
 INTERNAL_HIDDEN void *_iso_alloc_bitslot_from_zone(bit_slot_t bitslot, iso_alloc_zone *zone);
 INTERNAL_HIDDEN void *_iso_calloc(size_t nmemb, size_t size);
 INTERNAL_HIDDEN void *_iso_alloc_ptr_search(void *n);
@@ -557,12 +1261,16 @@ INTERNAL_HIDDEN uint64_t _iso_alloc_big_zone_mem_usage();
 INTERNAL_HIDDEN uint64_t __iso_alloc_big_zone_mem_usage();
 INTERNAL_HIDDEN uint64_t _iso_alloc_mem_usage(void);
 INTERNAL_HIDDEN uint64_t __iso_alloc_mem_usage(void);
+INTERNAL_HIDDEN void _iso_alloc_heap_usage(iso_alloc_heap_usage *usage);
+INTERNAL_HIDDEN size_t _iso_alloc_trim_zone(iso_alloc_zone *zone, int32_t advice);
+INTERNAL_HIDDEN void _iso_alloc_zone_reset(iso_alloc_zone *zone, bool release);
+INTERNAL_HIDDEN size_t _iso_alloc_trim(void);
 INTERNAL_HIDDEN uint64_t rand_uint64(void);
 INTERNAL_HIDDEN size_t _iso_chunk_size(void *p);
 INTERNAL_HIDDEN int8_t *_fmt(uint64_t n, uint32_t base);
 INTERNAL_HIDDEN void _iso_alloc_printf(int32_t fd, const char *f, ...);
 INTERNAL_HIDDEN void _initialize_profiler(void);
-INTERNAL_HIDDEN void _iso_alloc_profile(void);
+INTERNAL_HIDDEN int32_t _iso_alloc_get_stats(struct iso_alloc_stats *stats);
 
 #if ALLOC_SANITY
 #if UNINIT_READ_SANITY
@@ -574,6 +1282,75 @@ INTERNAL_HIDDEN int32_t _remove_from_sane_trace(void *p);
 INTERNAL_HIDDEN _sane_allocation_t *_get_sane_alloc(void *p);
 #endif
 
+#if HEAP_PROFILER
+INTERNAL_HIDDEN bool _iso_alloc_profile(size_t size);
+INTERNAL_HIDDEN void _iso_alloc_profile_sample(void *p, size_t size);
+INTERNAL_HIDDEN void _iso_alloc_profile_free(void *p);
+INTERNAL_HIDDEN void _iso_alloc_profile_merge_thread(void);
+INTERNAL_HIDDEN void _iso_alloc_profiler_dump(void);
+INTERNAL_HIDDEN void _iso_alloc_profiler_snapshot(uint32_t reason);
+#endif
+
+#if RUNTIME_ZONE_LAYOUT
+INTERNAL_HIDDEN uint32_t _iso_alloc_load_zone_layout(iso_zone_layout_entry *layout);
+#endif
+
+#if ADAPTIVE_ZONES
+INTERNAL_HIDDEN void _iso_adaptive_count(size_t size);
+INTERNAL_HIDDEN iso_alloc_zone *_iso_adaptive_zone(size_t size);
+#endif
+
+#if ZONE_ARENA
+INTERNAL_HIDDEN void _iso_zone_arena_map(size_t bitmap_size, void **bitmap_start, void **user_pages_start);
+INTERNAL_HIDDEN void _iso_zone_arena_unmap(void *bitmap_start, size_t bitmap_size, void *user_pages_start);
+#endif
+
+#if ZONE_RETIREMENT
+INTERNAL_HIDDEN void _iso_zone_emptied(iso_alloc_zone *zone);
+INTERNAL_HIDDEN iso_alloc_zone *_iso_recycle_zone(size_t size, bool *mapped);
+#endif
+
+#if PACKED_BITMAPS
+INTERNAL_HIDDEN void *_iso_bitmap_arena_alloc(size_t size);
+INTERNAL_HIDDEN bool _iso_bitmap_arena_owns(void *p);
+INTERNAL_HIDDEN bool _iso_bitmap_arena_free(void *p);
+#endif
+
+#if ZONE_POOL
+INTERNAL_HIDDEN void _iso_zone_pool_init(void);
+INTERNAL_HIDDEN bool _iso_zone_pool_claim(iso_alloc_zone *zone);
+#endif
+
+#if ALLOC_TRACE
+INTERNAL_HIDDEN void _iso_alloc_trace_init(void);
+INTERNAL_HIDDEN void _iso_alloc_trace_dtor(void);
+INTERNAL_HIDDEN void _iso_alloc_trace(uint32_t op, void *p, void *old, size_t size);
+#endif
+
+INTERNAL_HIDDEN int32_t _iso_alloc_reserve(size_t size, size_t count);
+INTERNAL_HIDDEN int32_t _iso_alloc_set_watermark(size_t size, size_t free_chunks);
+INTERNAL_HIDDEN void _iso_alloc_provisioner_wake(void);
+#if THREAD_SUPPORT
+INTERNAL_HIDDEN int32_t _iso_wake_pipe_create(int32_t fds[2]);
+INTERNAL_HIDDEN void _iso_wake_pipe_drain(int32_t fd);
+INTERNAL_HIDDEN void _iso_wake_pipe_write(int32_t fd);
+#endif
+INTERNAL_HIDDEN void _iso_watermark_chunk_taken(iso_alloc_zone *zone);
+
+INTERNAL_HIDDEN iso_object_cache *_iso_cache_create(size_t size, void (*ctor)(void *), void (*dtor)(void *));
+INTERNAL_HIDDEN void *_iso_cache_alloc(iso_object_cache *cache);
+INTERNAL_HIDDEN void _iso_cache_free(iso_object_cache *cache, void *p);
+INTERNAL_HIDDEN void _iso_cache_destroy(iso_object_cache *cache);
+
+#if PER_CPU_CACHE
+INTERNAL_HIDDEN void _iso_cpu_cache_init(void);
+INTERNAL_HIDDEN void _iso_cpu_cache_flush(void);
+INTERNAL_HIDDEN void *_iso_cpu_cache_alloc(size_t size);
+INTERNAL_HIDDEN bool _iso_cpu_cache_free(void *p, bool permanent);
+INTERNAL_HIDDEN void _iso_cpu_cache_zone_update(iso_alloc_zone *zone);
+INTERNAL_HIDDEN void _iso_cpu_cache_zone_remove(iso_alloc_zone *zone);
+#endif
+
 #if EXPERIMENTAL
 INTERNAL_HIDDEN void _iso_alloc_search_stack(uint8_t *stack_start);
 #endif
@@ -10,6 +10,7 @@ atomic_flag big_zone_busy_flag;
 
 uint32_t g_page_size;
 uint32_t _default_zone_count;
+uint32_t _default_zone_fit[ZONE_FIT_CLASSES];
 iso_alloc_root *_root;
 
 
@@ -65,6 +66,12 @@ INTERNAL_HIDDEN void create_canary_chunks(iso_alloc_zone *zone) {
             bm_idx = 0;
         }
 
+        /* Don't count a chunk twice if rand_uint64()
+         * returned the same index more than once */
+        if((GET_BIT(bm[bm_idx], 0)) == 0) {
+            zone->chunks_canary++;
+        }
+
         /* Set the 1st and 2nd bits as 1 */
         SET_BIT(bm[bm_idx], 0);
         SET_BIT(bm[bm_idx], 1);
@@ -94,6 +101,10 @@ INTERNAL_HIDDEN void _verify_all_zones(void) {
 INTERNAL_HIDDEN void _verify_zone(iso_alloc_zone *zone) {
     return;
 }
+
+INTERNAL_HIDDEN void _verify_big_zone(iso_alloc_big_zone *big) {
+    return;
+}
 #else
 
 /* Verify the integrity of all canary chunks and the
@@ -143,17 +154,36 @@ INTERNAL_HIDDEN void _verify_all_zones(void) {
     }
 }
 
+/* check_big_canary is always inlined so callers outside
+ * of this file verify a big zone through this instead */
+INTERNAL_HIDDEN void _verify_big_zone(iso_alloc_big_zone *big) {
+    check_big_canary(big);
+}
+
 INTERNAL_HIDDEN void _verify_zone(iso_alloc_zone *zone) {
     UNMASK_ZONE_PTRS(zone);
     bitmap_index_t *bm = (bitmap_index_t *) zone->bitmap_start;
     bitmap_index_t max_bm_idx = GET_MAX_BITMASK_INDEX(zone);
     bit_slot_t bit_slot;
     int64_t bit;
+    uint32_t in_use = 0;
+    uint32_t was_used = 0;
+    uint32_t canary = 0;
 
     for(bitmap_index_t i = 0; i < max_bm_idx; i++) {
         for(int64_t j = 1; j < BITS_PER_QWORD; j += BITS_PER_CHUNK) {
             bit = GET_BIT(bm[i], j);
 
+            if((GET_BIT(bm[i], (j - 1))) == 1) {
+                if(bit == 1) {
+                    canary++;
+                } else {
+                    in_use++;
+                }
+            } else if(bit == 1) {
+                was_used++;
+            }
+
             /* If this bit is set it is either a free chunk or
              * a canary chunk. Either way it should have a set
              * of canaries we can verify */
@@ -165,6 +195,13 @@ INTERNAL_HIDDEN void _verify_zone(iso_alloc_zone *zone) {
         }
     }
 
+    /* The per-zone counters are only ever updated
+     * alongside the bitmap so they must agree */
+    if(UNLIKELY(in_use != zone->chunks_in_use || was_used != zone->chunks_was_used || canary != zone->chunks_canary)) {
+        LOG_AND_ABORT("Zone[%d] chunk counters (%d, %d, %d) do not match its bitmap (%d, %d, %d)", zone->index,
+                      zone->chunks_in_use, zone->chunks_was_used, zone->chunks_canary, in_use, was_used, canary);
+    }
+
     MASK_ZONE_PTRS(zone);
     return;
 }
@@ -181,20 +218,36 @@ INTERNAL_HIDDEN INLINE void fill_free_bit_slot_cache(iso_alloc_zone *zone) {
     bitmap_index_t max_bitmap_idx = GET_MAX_BITMASK_INDEX(zone);
     bit_slot_t bit_slot;
 
+    STATS_INC(cache_refills);
+
     /* This gives us an arbitrary spot in the bitmap to
      * start searching but may mean we end up with a smaller
      * cache. This may negatively affect performance but
      * leads to a less predictable free list */
-    bitmap_index_t bm_idx = ALIGN_SZ_DOWN((rand_uint64() & (max_bitmap_idx - 1)));
+    bitmap_index_t bm_idx = 0;
 
-    if(0 > bm_idx) {
-        bm_idx = 0;
+    /* Without a random allocation pattern the lowest free
+     * chunks are handed out first, which keeps the objects
+     * of a zone close together */
+    if((zone->config & ZONE_RANDOM_ALLOCATION_PATTERN) != 0) {
+        bm_idx = ALIGN_SZ_DOWN((rand_uint64() & (max_bitmap_idx - 1)));
+
+        if(0 > bm_idx) {
+            bm_idx = 0;
+        }
     }
 
     memset(zone->free_bit_slot_cache, BAD_BIT_SLOT, sizeof(zone->free_bit_slot_cache));
     zone->free_bit_slot_cache_usable = 0;
     uint8_t free_bit_slot_cache_index;
 
+    /* A sequential zone has no use for the cache until
+     * every chunk has been handed out at least once */
+    if((zone->config & ZONE_RANDOM_ALLOCATION_PATTERN) == 0 && zone->bump_chunk < GET_CHUNK_COUNT(zone)) {
+        zone->free_bit_slot_cache_index = 0;
+        return;
+    }
+
     for(free_bit_slot_cache_index = 0; free_bit_slot_cache_index < BIT_SLOT_CACHE_SZ; bm_idx++) {
         /* Don't index outside of the bitmap or
          * we will return inaccurate bit slots */
@@ -256,7 +309,53 @@ INTERNAL_HIDDEN INLINE void insert_free_bit_slot(iso_alloc_zone *zone, int64_t b
     zone->free_bit_slot_cache_index++;
 }
 
+/* Zones without a random allocation pattern hand out the
+ * most recently free'd chunk first, then free chunks in
+ * address order from a high water mark. The mark only
+ * moves forward until a reset, so before the first reset
+ * it only finds chunks that were never used. Once it
+ * reaches the end the zone falls back to the normal cache
+ * refill and bitmap scans */
+INTERNAL_HIDDEN INLINE bit_slot_t get_next_sequential_bit_slot(iso_alloc_zone *zone) {
+    bitmap_index_t *bm = (bitmap_index_t *) zone->bitmap_start;
+
+    while(zone->free_bit_slot_cache_index > zone->free_bit_slot_cache_usable) {
+        zone->free_bit_slot_cache_index--;
+        bit_slot_t bit_slot = zone->free_bit_slot_cache[zone->free_bit_slot_cache_index];
+        zone->free_bit_slot_cache[zone->free_bit_slot_cache_index] = BAD_BIT_SLOT;
+
+        /* The high water mark may have handed this chunk
+         * out since it was cached */
+        if((GET_BIT(bm[bit_slot >> BITS_PER_QWORD_SHIFT], WHICH_BIT(bit_slot))) == 0) {
+            zone->next_free_bit_slot = bit_slot;
+            return bit_slot;
+        }
+    }
+
+    uint64_t chunk_count = GET_CHUNK_COUNT(zone);
+
+    while(zone->bump_chunk < chunk_count) {
+        bit_slot_t bit_slot = ((bit_slot_t) zone->bump_chunk << BITS_PER_CHUNK_SHIFT);
+        bitmap_index_t b = bm[bit_slot >> BITS_PER_QWORD_SHIFT];
+        zone->bump_chunk++;
+
+        /* Skip chunks in use and canary chunks. Chunks that
+         * were free'd before a reset are handed out too, their
+         * canary is checked like any other used chunk */
+        if((GET_BIT(b, WHICH_BIT(bit_slot))) == 0) {
+            zone->next_free_bit_slot = bit_slot;
+            return bit_slot;
+        }
+    }
+
+    return BAD_BIT_SLOT;
+}
+
 INTERNAL_HIDDEN bit_slot_t get_next_free_bit_slot(iso_alloc_zone *zone) {
+    if((zone->config & ZONE_RANDOM_ALLOCATION_PATTERN) == 0) {
+        return get_next_sequential_bit_slot(zone);
+    }
+
     if(0 > zone->free_bit_slot_cache_usable || zone->free_bit_slot_cache_usable >= BIT_SLOT_CACHE_SZ ||
        zone->free_bit_slot_cache_usable > zone->free_bit_slot_cache_index) {
         return BAD_BIT_SLOT;
@@ -303,6 +402,50 @@ INTERNAL_HIDDEN void *mmap_rw_pages(size_t size, bool populate) {
     return p;
 }
 
+/* Maps size bytes of pages between two guard pages and
+ * returns the start of the usable pages. Uses g_page_size
+ * as the zone pool thread calls this without the root */
+INTERNAL_HIDDEN void *_iso_map_guarded_pages(size_t size, int32_t advice) {
+    void *p = mmap_rw_pages(size + (g_page_size << 1), true);
+    void *pages = p + g_page_size;
+
+    create_guard_page(p);
+    create_guard_page((void *) ROUND_UP_PAGE((uintptr_t) pages + size));
+
+    madvise(pages, size, MADV_WILLNEED);
+    madvise(pages, size, advice);
+
+    return pages;
+}
+
+/* Maps the bitmap and user pages of a zone, each between
+ * guard pages */
+INTERNAL_HIDDEN void _iso_map_zone_pages(size_t bitmap_size, void **bitmap_start, void **user_pages_start) {
+#if PACKED_BITMAPS
+    /* Small bitmaps don't need pages of their own */
+    *bitmap_start = _iso_bitmap_arena_alloc(bitmap_size);
+
+    if(*bitmap_start != NULL) {
+        bitmap_size = 0;
+    }
+#endif
+
+#if ZONE_ARENA
+    _iso_zone_arena_map(bitmap_size, bitmap_start, user_pages_start);
+#else
+    /* Bitmap pages are accessed often and usually in sequential order */
+    if(bitmap_size != 0) {
+        *bitmap_start = _iso_map_guarded_pages(bitmap_size, MADV_SEQUENTIAL);
+    }
+
+    /* All user pages use MAP_POPULATE. This might seem like we are asking
+     * the kernel to commit a lot of memory for us that we may never use
+     * but when we call create_canary_chunks() that will happen anyway.
+     * User pages will be accessed in an unpredictable order */
+    *user_pages_start = _iso_map_guarded_pages(ZONE_USER_SIZE, MADV_RANDOM);
+#endif
+}
+
 INTERNAL_HIDDEN void mprotect_pages(void *p, size_t size, int32_t protection) {
     size = ROUND_UP_PAGE(size);
 
@@ -333,6 +476,85 @@ INTERNAL_HIDDEN iso_alloc_root *iso_alloc_new_root(void) {
     return r;
 }
 
+/* Faults in size bytes of pages starting at p */
+INTERNAL_HIDDEN void _iso_populate_pages(void *p, size_t size) {
+#if __linux__ && defined(MADV_POPULATE_WRITE)
+    if(madvise(p, size, MADV_POPULATE_WRITE) == OK) {
+        return;
+    }
+#endif
+
+#if !ENABLE_ASAN
+    /* Older kernels don't support MADV_POPULATE_WRITE so
+     * we write to each page. Canary chunks may already be
+     * written so we store back what we read */
+    for(size_t i = 0; i < size; i += g_page_size) {
+        volatile uint8_t *b = (volatile uint8_t *) p + i;
+        *b = *b;
+    }
+#endif
+}
+
+/* Faults in all user pages of a zone so the first
+ * allocations from it don't take page faults */
+INTERNAL_HIDDEN void _iso_alloc_populate_zone(iso_alloc_zone *zone) {
+    UNMASK_ZONE_PTRS(zone);
+    _iso_populate_pages(zone->user_pages_start, ZONE_USER_SIZE);
+    MASK_ZONE_PTRS(zone);
+}
+
+/* Creates the default zones from the runtime zone
+ * layout if there is one or from default_zones */
+INTERNAL_HIDDEN void _iso_alloc_create_default_zones(void) {
+    iso_zone_layout_entry layout[MAX_DEFAULT_ZONES];
+    iso_alloc_zone *zone = NULL;
+    uint32_t count = 0;
+
+#if RUNTIME_ZONE_LAYOUT
+    count = _iso_alloc_load_zone_layout(layout);
+#endif
+
+    if(count == 0) {
+        count = sizeof(default_zones) >> 3;
+
+        for(uint32_t i = 0; i < count; i++) {
+            layout[i].size = default_zones[i];
+            layout[i].prepopulate = false;
+        }
+
+        /* This call to mlock may fail if memory limits
+         * are set too low. This will not affect us
+         * at runtime. It just means some of the default
+         * zone meta data may get swapped to disk */
+        mlock(&default_zones, sizeof(default_zones));
+    }
+
+    for(uint32_t i = 0; i < count; i++) {
+        if(!(zone = _iso_new_zone(layout[i].size, true))) {
+            LOG_AND_ABORT("Failed to create a new zone");
+        }
+
+        if(layout[i].prepopulate == true) {
+            _iso_alloc_populate_zone(zone);
+        }
+    }
+
+    _default_zone_count = count;
+
+    /* A chunk in size class c is larger than the class
+     * below it so any default zone with chunks that small
+     * or smaller can be skipped when searching for a zone */
+    for(uint32_t c = 0; c < ZONE_FIT_CLASSES; c++) {
+        uint32_t i = 0;
+
+        while(i < count && _root->zones[i].chunk_size <= ZONE_FIT_CLASS_MIN(c)) {
+            i++;
+        }
+
+        _default_zone_fit[c] = i;
+    }
+}
+
 INTERNAL_HIDDEN void iso_alloc_initialize_global_root(void) {
     /* Do not allow a reinitialization unless root is NULL */
     if(_root != NULL) {
@@ -345,20 +567,13 @@ INTERNAL_HIDDEN void iso_alloc_initialize_global_root(void) {
         LOG_AND_ABORT("Could not initialize global root");
     }
 
-    iso_alloc_zone *zone = NULL;
-    _default_zone_count = sizeof(default_zones) >> 3;
-
-    for(int64_t i = 0; i < _default_zone_count; i++) {
-        if(!(zone = _iso_new_zone(default_zones[i], true))) {
-            LOG_AND_ABORT("Failed to create a new zone");
-        }
-    }
+#if PER_CPU_CACHE
+    /* The default zones are recorded in the CPU cache
+     * zone table as they are created */
+    _iso_cpu_cache_init();
+#endif
 
-    /* This call to mlock may fail if memory limits
-     * are set too low. This will not affect us
-     * at runtime. It just means some of the default
-     * zone meta data may get swapped to disk */
-    mlock(&default_zones, sizeof(default_zones));
+    _iso_alloc_create_default_zones();
 
     _root->zone_handle_mask = rand_uint64();
     _root->big_zone_next_mask = rand_uint64();
@@ -385,6 +600,14 @@ __attribute__((constructor(FIRST_CTOR))) void iso_alloc_ctor(void) {
     iso_alloc_initialize_global_root();
     _initialize_profiler();
 
+#if ALLOC_TRACE
+    _iso_alloc_trace_init();
+#endif
+
+#if ZONE_POOL
+    _iso_zone_pool_init();
+#endif
+
 #if ALLOC_SANITY && UNINIT_READ_SANITY
     if(_page_fault_thread == 0) {
         int32_t s = pthread_create(&_page_fault_thread, NULL, _page_fault_thread_handler, NULL);
@@ -401,16 +624,38 @@ INTERNAL_HIDDEN INLINE void flush_thread_zone_cache() {
     /* The thread zone cache needs to be invalidated */
     memset(thread_zone_cache, 0x0, sizeof(thread_zone_cache));
     thread_zone_cache_count = 0;
+#if ZONE_RETIREMENT
+    thread_zone_cache_generation = _zone_recycle_generation;
+#endif
 #endif
 }
 
 INTERNAL_HIDDEN void _unmap_zone(iso_alloc_zone *zone) {
-    munmap(zone->bitmap_start, zone->bitmap_size);
-    munmap(zone->bitmap_start - _root->system_page_size, _root->system_page_size);
-    munmap(zone->bitmap_start + zone->bitmap_size, _root->system_page_size);
+    size_t bitmap_size = zone->bitmap_size;
+
+#if PER_CPU_CACHE
+    _iso_cpu_cache_zone_remove(zone);
+#endif
+
+#if PACKED_BITMAPS
+    if(_iso_bitmap_arena_free(zone->bitmap_start) == true) {
+        bitmap_size = 0;
+    }
+#endif
+
+#if ZONE_ARENA
+    _iso_zone_arena_unmap(zone->bitmap_start, bitmap_size, zone->user_pages_start);
+#else
+    if(bitmap_size != 0) {
+        munmap(zone->bitmap_start, bitmap_size);
+        munmap(zone->bitmap_start - _root->system_page_size, _root->system_page_size);
+        munmap(zone->bitmap_start + bitmap_size, _root->system_page_size);
+    }
+
     munmap(zone->user_pages_start, ZONE_USER_SIZE);
     munmap(zone->user_pages_start - _root->system_page_size, _root->system_page_size);
     munmap(zone->user_pages_start + ZONE_USER_SIZE, _root->system_page_size);
+#endif
 }
 
 INTERNAL_HIDDEN void _iso_alloc_destroy_zone(iso_alloc_zone *zone) {
@@ -433,8 +678,27 @@ INTERNAL_HIDDEN void _iso_alloc_destroy_zone(iso_alloc_zone *zone) {
         memset(zone->bitmap_start, 0x0, zone->bitmap_size);
         memset(zone->user_pages_start, 0x0, ZONE_USER_SIZE);
 
+        /* Give the memory back to the OS before the zone is
+         * primed again. It will still be available if we try
+         * to use it. A packed bitmap shares its page with the
+         * bitmaps of other zones so it is left alone */
+#if PACKED_BITMAPS
+        if(_iso_bitmap_arena_owns(zone->bitmap_start) == false) {
+            madvise(zone->bitmap_start, zone->bitmap_size, MADV_DONTNEED);
+        }
+#else
+        madvise(zone->bitmap_start, zone->bitmap_size, MADV_DONTNEED);
+#endif
+        madvise(zone->user_pages_start, ZONE_USER_SIZE, MADV_DONTNEED);
+
+        zone->chunks_in_use = 0;
+        zone->chunks_was_used = 0;
+        zone->chunks_canary = 0;
+
         /* Take over the zone to be used internally */
         zone->internally_managed = true;
+        zone->config = ZONE_DEFAULT_CONFIG;
+        zone->bump_chunk = 0;
         zone->is_full = false;
 
         /* Reusing custom zones has the potential for introducing
@@ -447,13 +711,12 @@ INTERNAL_HIDDEN void _iso_alloc_destroy_zone(iso_alloc_zone *zone) {
         /* Prime the next_free_bit_slot member */
         get_next_free_bit_slot(zone);
 
+#if PER_CPU_CACHE
+        _iso_cpu_cache_zone_update(zone);
+#endif
+
         MASK_ZONE_PTRS(zone);
 #endif
-        /* If we are destroying the zone lets give the memory
-         * back to the OS. It will still be available if we
-         * try to use it */
-        madvise(zone->bitmap_start, zone->bitmap_size, MADV_DONTNEED);
-        madvise(zone->user_pages_start, ZONE_USER_SIZE, MADV_DONTNEED);
         POISON_ZONE(zone);
         UNLOCK_ROOT();
         return;
@@ -469,31 +732,17 @@ INTERNAL_HIDDEN void _iso_alloc_destroy_zone(iso_alloc_zone *zone) {
 __attribute__((destructor(LAST_DTOR))) void iso_alloc_dtor(void) {
     LOCK_ROOT();
 
-#if HEAP_PROFILER
-    _iso_alloc_printf(profiler_fd, "allocated=%d\n", _allocation_count);
-    _iso_alloc_printf(profiler_fd, "sampled=%d\n", _sampled_count);
-
-    for(uint32_t i = 0; i < _root->zones_used; i++) {
-        iso_alloc_zone *zone = &_root->zones[i];
-        _zone_profiler_map[zone->chunk_size].total++;
-    }
-
-    for(uint32_t i = 0; i < HG_SIZE; i++) {
-        if(caller_hg[i] != 0) {
-            _iso_alloc_printf(profiler_fd, "backtrace_hash=0x%x,calls=%d\n", i, caller_hg[i]);
-        }
-    }
+#if PER_CPU_CACHE
+    /* Cached chunks are still marked as in use */
+    _iso_cpu_cache_flush();
+#endif
 
-    for(uint32_t i = 0; i < SMALL_SZ_MAX; i++) {
-        if(_zone_profiler_map[i].count != 0) {
-            _iso_alloc_printf(profiler_fd, "%d,%d,%d\n", i, _zone_profiler_map[i].total, _zone_profiler_map[i].count);
-        }
-    }
+#if HEAP_PROFILER
+    _iso_alloc_profiler_dump();
+#endif
 
-    if(profiler_fd != ERR) {
-        close(profiler_fd);
-        profiler_fd = ERR;
-    }
+#if ALLOC_TRACE
+    _iso_alloc_trace_dtor();
 #endif
 
 #if DEBUG && (LEAK_DETECTOR || MEM_USAGE)
@@ -561,17 +810,21 @@ __attribute__((destructor(LAST_DTOR))) void iso_alloc_dtor(void) {
 }
 
 INTERNAL_HIDDEN iso_alloc_zone *iso_new_zone(size_t size, bool internal) {
+    return iso_new_zone_with_config(size, internal, ZONE_DEFAULT_CONFIG);
+}
+
+INTERNAL_HIDDEN iso_alloc_zone *iso_new_zone_with_config(size_t size, bool internal, uint8_t config) {
     LOCK_ROOT();
-    iso_alloc_zone *zone = _iso_new_zone(size, internal);
+    iso_alloc_zone *zone = _iso_new_zone_with_config(size, internal, config);
     UNLOCK_ROOT();
     return zone;
 }
 
 INTERNAL_HIDDEN iso_alloc_zone *_iso_new_zone(size_t size, bool internal) {
-    if(_root->zones_used >= MAX_ZONES) {
-        LOG_AND_ABORT("Cannot allocate additional zones");
-    }
+    return _iso_new_zone_with_config(size, internal, ZONE_DEFAULT_CONFIG);
+}
 
+INTERNAL_HIDDEN iso_alloc_zone *_iso_new_zone_with_config(size_t size, bool internal, uint8_t config) {
     if(size > SMALL_SZ_MAX) {
         LOG("Request for chunk of %ld bytes should be handled by big alloc path", size);
         return NULL;
@@ -587,11 +840,36 @@ INTERNAL_HIDDEN iso_alloc_zone *_iso_new_zone(size_t size, bool internal) {
         size = SMALLEST_ZONE;
     }
 
-    iso_alloc_zone *new_zone = &_root->zones[_root->zones_used];
+    iso_alloc_zone *new_zone = NULL;
+    bool premapped = false;
+
+#if ZONE_RETIREMENT
+    /* The descriptor of a retired zone is used first */
+    new_zone = _iso_recycle_zone(size, &premapped);
+#endif
+
+    bool recycled = (new_zone != NULL);
+
+    if(recycled == false) {
+        if(_root->zones_used >= MAX_ZONES) {
+            LOG_AND_ABORT("Cannot allocate additional zones");
+        }
+
+        new_zone = &_root->zones[_root->zones_used];
+        new_zone->index = _root->zones_used;
+    }
 
     new_zone->internally_managed = internal;
+    new_zone->config = config;
+    new_zone->bump_chunk = 0;
     new_zone->is_full = false;
     new_zone->chunk_size = size;
+    new_zone->chunks_in_use = 0;
+    new_zone->chunks_was_used = 0;
+    new_zone->chunks_canary = 0;
+#if ZONE_RETIREMENT
+    new_zone->chunks_permanent = 0;
+#endif
 
     /* If a caller requests an allocation that is >=(ZONE_USER_SIZE/2)
      * then we need to allocate a minimum size bitmap */
@@ -600,38 +878,18 @@ INTERNAL_HIDDEN iso_alloc_zone *_iso_new_zone(size_t size, bool internal) {
 
     /* Most of the following fields are effectively immutable
      * and should not change once they are set */
+#if ZONE_POOL
+    /* Take the pages from a zone the pool thread mapped
+     * ahead of time if there is one */
+    if(internal == true && premapped == false) {
+        premapped = _iso_zone_pool_claim(new_zone);
+    }
+#endif
 
-    void *p = mmap_rw_pages(new_zone->bitmap_size + (_root->system_page_size << 1), true);
-
-    void *bitmap_pages_guard_below = p;
-    new_zone->bitmap_start = (p + _root->system_page_size);
-
-    void *bitmap_pages_guard_above = (void *) ROUND_UP_PAGE((uintptr_t) p + (new_zone->bitmap_size + _root->system_page_size));
-
-    create_guard_page(bitmap_pages_guard_below);
-    create_guard_page(bitmap_pages_guard_above);
-
-    /* Bitmap pages are accessed often and usually in sequential order */
-    madvise(new_zone->bitmap_start, new_zone->bitmap_size, MADV_WILLNEED);
-    madvise(new_zone->bitmap_start, new_zone->bitmap_size, MADV_SEQUENTIAL);
-
-    /* All user pages use MAP_POPULATE. This might seem like we are asking
-     * the kernel to commit a lot of memory for us that we may never use
-     * but when we call create_canary_chunks() that will happen anyway */
-    p = mmap_rw_pages(ZONE_USER_SIZE + (_root->system_page_size << 1), true);
-
-    void *user_pages_guard_below = p;
-    new_zone->user_pages_start = (p + _root->system_page_size);
-    void *user_pages_guard_above = (void *) ROUND_UP_PAGE((uintptr_t) p + (ZONE_USER_SIZE + _root->system_page_size));
-
-    create_guard_page(user_pages_guard_below);
-    create_guard_page(user_pages_guard_above);
-
-    /* User pages will be accessed in an unpredictable order */
-    madvise(new_zone->user_pages_start, ZONE_USER_SIZE, MADV_WILLNEED);
-    madvise(new_zone->user_pages_start, ZONE_USER_SIZE, MADV_RANDOM);
+    if(premapped == false) {
+        _iso_map_zone_pages(new_zone->bitmap_size, &new_zone->bitmap_start, &new_zone->user_pages_start);
+    }
 
-    new_zone->index = _root->zones_used;
     new_zone->canary_secret = rand_uint64();
     new_zone->pointer_mask = rand_uint64();
 
@@ -648,10 +906,18 @@ INTERNAL_HIDDEN iso_alloc_zone *_iso_new_zone(size_t size, bool internal) {
     new_zone->cpu_core = sched_getcpu();
 #endif
 
+#if PER_CPU_CACHE
+    _iso_cpu_cache_zone_update(new_zone);
+#endif
+
     POISON_ZONE(new_zone);
     MASK_ZONE_PTRS(new_zone);
 
-    _root->zones_used++;
+    if(recycled == false) {
+        _root->zones_used++;
+    }
+
+    STATS_INC(zones_created);
 
     return new_zone;
 }
@@ -715,6 +981,13 @@ INTERNAL_HIDDEN iso_alloc_zone *is_zone_usable(iso_alloc_zone *zone, size_t size
         return zone;
     }
 
+    /* Every chunk is either in use or a canary, there
+     * is no point in searching the bitmap */
+    if(GET_FREE_CHUNK_COUNT(zone) == 0) {
+        zone->is_full = true;
+        return NULL;
+    }
+
     UNMASK_ZONE_PTRS(zone);
 
     /* If the cache for this zone is empty we should
@@ -757,6 +1030,18 @@ INTERNAL_HIDDEN iso_alloc_zone *is_zone_usable(iso_alloc_zone *zone, size_t size
 }
 
 /* Implements the check for iso_find_zone_fit */
+#if SIZE_CLASSES
+/* The default zones are powers of 2 so without this a
+ * 4100 byte request would take an 8192 byte chunk even
+ * though the extra slow path makes a 5120 byte zone.
+ * Smaller requests still use the default zones so they
+ * don't each get an 8 MB zone of their own */
+INTERNAL_HIDDEN INLINE bool iso_zone_above_size_class(iso_alloc_zone *zone, size_t size) {
+    size_t strict_min = (zone->index < _default_zone_count) ? SIZE_CLASS_DEFAULT_STRICT_MIN : SIZE_CLASS_STRICT_MIN;
+    return size > strict_min && zone->chunk_size > SIZE_CLASS_ROUND(size) && _root->zones_used < MAX_ZONES;
+}
+#endif
+
 INTERNAL_HIDDEN bool iso_does_zone_fit(iso_alloc_zone *zone, size_t size) {
 #if CPU_PIN
     if(zone->cpu_core != sched_getcpu()) {
@@ -776,6 +1061,12 @@ INTERNAL_HIDDEN bool iso_does_zone_fit(iso_alloc_zone *zone, size_t size) {
         return false;
     }
 
+#if SIZE_CLASSES
+    if(iso_zone_above_size_class(zone, size) == true) {
+        return false;
+    }
+#endif
+
     /* We found a zone, lets try to find a free slot in it */
     zone = is_zone_usable(zone, size);
 
@@ -786,23 +1077,65 @@ INTERNAL_HIDDEN bool iso_does_zone_fit(iso_alloc_zone *zone, size_t size) {
     }
 }
 
+/* The size checks iso_does_zone_fit makes, without
+ * looking for a free slot in the zone */
+INTERNAL_HIDDEN bool iso_zone_fits_size(iso_alloc_zone *zone, size_t size) {
+    if(zone->internally_managed == false || zone->chunk_size < size) {
+        return false;
+    }
+
+#if ZONE_RETIREMENT
+    if(zone->is_retired == true) {
+        return false;
+    }
+#endif
+
+    if(zone->chunk_size >= ZONE_1024 && size <= ZONE_128) {
+        return false;
+    }
+
+    if(size > ZONE_1024 && zone->chunk_size >= (size << WASTED_SZ_MULTIPLIER_SHIFT)) {
+        return false;
+    }
+
+#if SIZE_CLASSES
+    if(iso_zone_above_size_class(zone, size) == true) {
+        return false;
+    }
+#endif
+
+    return true;
+}
+
+/* Counts the free chunks in every zone that could
+ * serve an allocation of size bytes */
+INTERNAL_HIDDEN uint64_t _iso_free_chunks_for_size(size_t size) {
+    uint64_t free_chunks = 0;
+
+    for(int32_t i = 0; i < _root->zones_used; i++) {
+        iso_alloc_zone *zone = &_root->zones[i];
+
+        if(iso_zone_fits_size(zone, size) == true) {
+            free_chunks += GET_FREE_CHUNK_COUNT(zone);
+        }
+    }
+
+    return free_chunks;
+}
+
 /* Finds a zone that can fit this allocation request */
 INTERNAL_HIDDEN iso_alloc_zone *iso_find_zone_fit(size_t size) {
     iso_alloc_zone *zone = NULL;
     int32_t i = 0;
 
-#if !SMALL_MEM_STARTUP
-    /* A simple optimization to find which default zone
-     * should fit this allocation. If we fail then a
-     * slower iterative approach is used. The longer a
-     * program runs the more likely we will fail this
-     * fast path as default zones may fill up */
-    if(size >= ZONE_512 && size <= ZONE_8192) {
-        i = _default_zone_count >> 1;
-    } else if(size > ZONE_8192) {
-        i = _default_zone_count;
+    /* A simple optimization to skip the default zones
+     * that are too small for this allocation. If we fail
+     * then we keep searching every zone after them. The
+     * longer a program runs the more likely we will fail
+     * this fast path as default zones may fill up */
+    if(size <= SMALL_SZ_MAX) {
+        i = _default_zone_fit[ZONE_FIT_CLASS(size)];
     }
-#endif
 
     for(; i < _root->zones_used; i++) {
         zone = &_root->zones[i];
@@ -925,12 +1258,21 @@ INTERNAL_HIDDEN void *_iso_big_alloc(size_t size) {
         big->canary_a = ((uint64_t) big ^ bswap_64((uint64_t) big->user_pages_start) ^ _root->big_zone_canary_secret);
         big->canary_b = big->canary_a;
 
+        STATS_INC(big_zone_new);
+        STATS_INC(big_allocs);
+        STATS_ADD(big_bytes_in_use, big->size);
+
         UNLOCK_BIG_ZONE();
         return big->user_pages_start;
     } else {
         check_big_canary(big);
         big->free = false;
         UNPOISON_BIG_ZONE(big);
+
+        STATS_INC(big_zone_reuse_hits);
+        STATS_INC(big_allocs);
+        STATS_ADD(big_bytes_in_use, big->size);
+
         UNLOCK_BIG_ZONE();
         return big->user_pages_start;
     }
@@ -965,12 +1307,22 @@ INTERNAL_HIDDEN void *_iso_alloc_bitslot_from_zone(bit_slot_t bitslot, iso_alloc
      * or it's a canary chunk. In either case this means it
      * has a canary written in its first dword. Here we check
      * that canary and abort if its been corrupted */
-#if !ENABLE_ASAN && !DISABLE_CANARY
     if((GET_BIT(b, (which_bit + 1))) == 1) {
-        check_canary(zone, p);
+#if !ENABLE_ASAN && !DISABLE_CANARY
+        if((zone->config & ZONE_CANARY_CHECK_ON_ALLOC) != 0) {
+            check_canary(zone, p);
+        }
+
         memset(p, 0x0, CANARY_SIZE);
-    }
 #endif
+        zone->chunks_was_used--;
+    }
+
+    zone->chunks_in_use++;
+
+    if(UNLIKELY(_watermarks_armed != 0)) {
+        _iso_watermark_chunk_taken(zone);
+    }
 
     /* Set the in-use bit */
     SET_BIT(b, which_bit);
@@ -994,7 +1346,74 @@ INTERNAL_HIDDEN INLINE size_t next_pow2(size_t sz) {
     return sz + 1;
 }
 
+/* Returns the chunk size of the zone the extra slow
+ * path creates for an allocation of size bytes */
+INTERNAL_HIDDEN size_t _iso_new_zone_chunk_size(size_t size) {
+#if SIZE_CLASSES
+    /* Round the size up to its size class so that
+     * every request in the class can share the zone */
+    return SIZE_CLASS_ROUND(size);
+#else
+    /* The size requested is above default zone sizes
+     * but we can still create it. iso_new_zone will
+     * align the requested size for us */
+    if(size > ZONE_8192) {
+        return size;
+    }
+
+    /* For chunks smaller than 8192 bytes we
+     * bump the size up to the next power of 2 */
+    return next_pow2(size);
+#endif
+}
+
+/* Unlocks the root after a chunk was taken from a zone.
+ * If that took a size below its watermark the zone
+ * provisioner is woken here, outside of the lock */
+INTERNAL_HIDDEN INLINE void _unlock_root_after_alloc(void) {
+    bool wake = _provisioner_wake_pending;
+
+    if(UNLIKELY(wake == true)) {
+        _provisioner_wake_pending = false;
+    }
+
+    UNLOCK_ROOT();
+
+    if(UNLIKELY(wake == true)) {
+        _iso_alloc_provisioner_wake();
+    }
+}
+
 INTERNAL_HIDDEN void *_iso_alloc(iso_alloc_zone *zone, size_t size) {
+#if HEAP_PROFILER
+    /* The profiler countdown is per thread and only takes
+     * the root lock when a sample is due. A sample needs
+     * the chunk we hand out so it's recorded afterwards */
+    if(UNLIKELY(_iso_alloc_profile(size) == true)) {
+        void *p = __iso_alloc(zone, NULL, size);
+        _iso_alloc_profile_sample(p, size);
+        return p;
+    }
+#endif
+
+    return __iso_alloc(zone, NULL, size);
+}
+
+/* Same as _iso_alloc but the chunk is placed as close
+ * to hint as possible. See iso_alloc_near_zone */
+INTERNAL_HIDDEN void *_iso_alloc_near(void *hint, size_t size) {
+#if HEAP_PROFILER
+    if(UNLIKELY(_iso_alloc_profile(size) == true)) {
+        void *p = __iso_alloc(NULL, hint, size);
+        _iso_alloc_profile_sample(p, size);
+        return p;
+    }
+#endif
+
+    return __iso_alloc(NULL, hint, size);
+}
+
+INTERNAL_HIDDEN void *__iso_alloc(iso_alloc_zone *zone, void *hint, size_t size) {
 #if ALLOC_SANITY
     /* We only sample allocations smaller than an individual
      * page. We are unlikely to find uninitialized reads on
@@ -1008,12 +1427,36 @@ INTERNAL_HIDDEN void *_iso_alloc(iso_alloc_zone *zone, size_t size) {
     }
 #endif
 
-    LOCK_ROOT();
+    if(UNLIKELY(hint != NULL)) {
+        void *pn = iso_alloc_near_zone(hint, size);
 
-#if HEAP_PROFILER
-    _iso_alloc_profile();
+        if(pn != NULL) {
+            return pn;
+        }
+    }
+
+#if ADAPTIVE_ZONES
+    /* Sizes are counted before the CPU cache is checked
+     * so the ones it serves can still get a zone */
+    if(LIKELY(zone == NULL) && size <= ADAPTIVE_MAX_SZ) {
+        _iso_adaptive_count(size);
+    }
 #endif
 
+#if PER_CPU_CACHE
+    /* Hot Path: Reuse a chunk recently free'd on this
+     * CPU core without taking the root lock */
+    if(LIKELY(zone == NULL) && size <= MAX_DEFAULT_ZONE_SZ && ADAPTIVE_SKIP_CPU_CACHE(size) == false) {
+        void *pc = _iso_cpu_cache_alloc(size);
+
+        if(pc != NULL) {
+            return pc;
+        }
+    }
+#endif
+
+    LOCK_ROOT();
+
     if(UNLIKELY(_root == NULL)) {
         g_page_size = sysconf(_SC_PAGESIZE);
         iso_alloc_initialize_global_root();
@@ -1038,18 +1481,46 @@ INTERNAL_HIDDEN void *_iso_alloc(iso_alloc_zone *zone, size_t size) {
     _verify_all_zones();
 #endif
 
+#if ADAPTIVE_ZONES
+    /* Sizes with sustained demand are routed straight
+     * to a zone created for exactly that size */
+    if(LIKELY(zone == NULL) && size <= ADAPTIVE_MAX_SZ) {
+        zone = _iso_adaptive_zone(size);
+
+        if(zone != NULL) {
+            STATS_INC(fast_path_hits);
+        }
+    }
+#endif
+
 #if THREAD_SUPPORT && THREAD_ZONE_CACHE
     if(LIKELY(zone == NULL)) {
+#if SIZE_CLASSES
+        /* Don't take a cached zone more than a power of 2
+         * larger than the size class of this request */
+        size_t max_chunk_size = SIZE_CLASS_SIZE(SIZE_CLASS(size) + SIZE_CLASSES_PER_DOUBLING - 1);
+#else
+        size_t max_chunk_size = SMALL_SZ_MAX;
+#endif
+
+#if ZONE_RETIREMENT
+        /* Another thread recycled a zone this cache may hold */
+        if(UNLIKELY(thread_zone_cache_generation != _zone_recycle_generation)) {
+            flush_thread_zone_cache();
+        }
+#endif
+
         /* Hot Path: Check the thread cache for a zone this
          * thread recently used for an alloc/free operation.
          * It's likely we are allocating a similar size chunk
          * and this will speed up that operation */
         for(int64_t i = 0; i < thread_zone_cache_count; i++) {
-            if(thread_zone_cache[i].chunk_size >= size) {
+            if(thread_zone_cache[i].chunk_size >= size && thread_zone_cache[i].chunk_size <= max_chunk_size) {
                 bool fit = iso_does_zone_fit(thread_zone_cache[i].zone, size);
 
                 if(fit == true) {
                     zone = thread_zone_cache[i].zone;
+                    STATS_INC(fast_path_hits);
                     break;
                 }
             }
@@ -1064,6 +1535,10 @@ INTERNAL_HIDDEN void *_iso_alloc(iso_alloc_zone *zone, size_t size) {
      * zones we cached above */
     if(LIKELY(zone == NULL)) {
         zone = iso_find_zone_fit(size);
+
+        if(zone != NULL) {
+            STATS_INC(slow_path_hits);
+        }
     }
 
     if(LIKELY(zone != NULL)) {
@@ -1084,18 +1559,10 @@ INTERNAL_HIDDEN void *_iso_alloc(iso_alloc_zone *zone, size_t size) {
     } else {
         /* Extra Slow Path: We need a new zone in order
          * to satisfy this allocation request */
+        STATS_INC(extra_slow_path_hits);
 
-        /* The size requested is above default zone sizes
-         * but we can still create it. iso_new_zone will
-         * align the requested size for us */
-        if(size > ZONE_8192) {
-            zone = _iso_new_zone(size, true);
-        } else {
-            /* For chunks smaller than 8192 bytes we
-             * bump the size up to the next power of 2 */
-            size = next_pow2(size);
-            zone = _iso_new_zone(size, true);
-        }
+        size = _iso_new_zone_chunk_size(size);
+        zone = _iso_new_zone(size, true);
 
         if(UNLIKELY(zone == NULL)) {
             LOG_AND_ABORT("Failed to create a zone for allocation of %zu bytes", size);
@@ -1121,19 +1588,206 @@ INTERNAL_HIDDEN void *_iso_alloc(iso_alloc_zone *zone, size_t size) {
     void *p = _iso_alloc_bitslot_from_zone(free_bit_slot, zone);
     MASK_ZONE_PTRS(zone);
 
+    STATS_INC(allocs[STATS_SIZE_CLASS(zone->chunk_size)]);
+    STATS_ADD(bytes_in_use, zone->chunk_size);
+
 #if THREAD_SUPPORT && THREAD_ZONE_CACHE
     if(thread_zone_cache_count < THREAD_ZONE_CACHE_SZ) {
         thread_zone_cache[thread_zone_cache_count].zone = zone;
         thread_zone_cache[thread_zone_cache_count].chunk_size = zone->chunk_size;
         thread_zone_cache_count++;
     } else {
-        thread_zone_cache_count = 0;
-        thread_zone_cache[thread_zone_cache_count].zone = zone;
-        thread_zone_cache[thread_zone_cache_count].chunk_size = zone->chunk_size;
+        /* Start over with this zone as the only entry */
+        thread_zone_cache[0].zone = zone;
+        thread_zone_cache[0].chunk_size = zone->chunk_size;
+        thread_zone_cache_count = 1;
     }
 #endif
 
-    UNLOCK_ROOT();
+    _unlock_root_after_alloc();
+    return p;
+}
+
+/* Returns the free bit slot in bitmap word bm_idx that is
+ * closest to hint_slot, masked to the chunks between
+ * lo_slot and hi_slot. A chunk after the hint wins a tie */
+INTERNAL_HIDDEN INLINE bit_slot_t near_free_slot_in_word(bitmap_index_t *bm, int64_t bm_idx, int64_t hint_slot,
+                                                         int64_t lo_slot, int64_t hi_slot) {
+    /* A chunk is free when its in-use bit is 0 */
+    uint64_t m = ~(uint64_t) bm[bm_idx] & RESET_LOW_BITS_MASK;
+    int64_t base = (bm_idx << BITS_PER_QWORD_SHIFT);
+
+    if(base < lo_slot) {
+        m &= (~0ULL << (lo_slot - base));
+    }
+
+    if((base + BITS_PER_QWORD) > hi_slot) {
+        m &= ((1ULL << (hi_slot - base)) - 1);
+    }
+
+    if(m == 0) {
+        return BAD_BIT_SLOT;
+    }
+
+    int64_t h = hint_slot - base;
+
+    if(h < 0) {
+        return base + __builtin_ctzll(m);
+    }
+
+    if(h >= BITS_PER_QWORD) {
+        return base + (BITS_PER_QWORD - 1) - __builtin_clzll(m);
+    }
+
+    uint64_t above = (h == (BITS_PER_QWORD - 1)) ? 0 : (m & (~0ULL << (h + 1)));
+    uint64_t below = m & ((1ULL << h) - 1);
+
+    if(above == 0) {
+        return base + (BITS_PER_QWORD - 1) - __builtin_clzll(below);
+    }
+
+    int64_t a = __builtin_ctzll(above);
+
+    if(below != 0) {
+        int64_t b = (BITS_PER_QWORD - 1) - __builtin_clzll(below);
+
+        if((h - b) < (a - h)) {
+            return base + b;
+        }
+    }
+
+    return base + a;
+}
+
+/* Searches the bitmap words that cover the page holding
+ * the hint and the pages on either side of it. Words are
+ * visited in order of their distance from the hint so the
+ * closest free chunk is found without a full scan */
+INTERNAL_HIDDEN bit_slot_t iso_scan_zone_free_slot_near(iso_alloc_zone *zone, void *hint) {
+    bitmap_index_t *bm = (bitmap_index_t *) zone->bitmap_start;
+    uint64_t page_size = _root->system_page_size;
+    uint64_t offset = (uintptr_t) hint - (uintptr_t) zone->user_pages_start;
+    uint64_t page = offset & ~(page_size - 1);
+    uint64_t chunk_count = GET_CHUNK_COUNT(zone);
+    uint64_t hint_chunk = offset / zone->chunk_size;
+
+    uint64_t lo = (page > page_size) ? (page - page_size) / zone->chunk_size : 0;
+    uint64_t hi = (page + (page_size * 2) + zone->chunk_size - 1) / zone->chunk_size;
+
+    /* Chunks larger than a page still look at their
+     * immediate neighbours */
+    if(hint_chunk != 0 && lo > hint_chunk - 1) {
+        lo = hint_chunk - 1;
+    }
+
+    if(hi < hint_chunk + 2) {
+        hi = hint_chunk + 2;
+    }
+
+    if(hi > chunk_count) {
+        hi = chunk_count;
+    }
+
+    int64_t hint_slot = (int64_t) (hint_chunk << BITS_PER_CHUNK_SHIFT);
+    int64_t lo_slot = (int64_t) (lo << BITS_PER_CHUNK_SHIFT);
+    int64_t hi_slot = (int64_t) (hi << BITS_PER_CHUNK_SHIFT);
+    int64_t hint_idx = hint_slot >> BITS_PER_QWORD_SHIFT;
+    int64_t lo_idx = lo_slot >> BITS_PER_QWORD_SHIFT;
+    int64_t hi_idx = (hi_slot - 1) >> BITS_PER_QWORD_SHIFT;
+
+    for(int64_t d = 0; (hint_idx + d) <= hi_idx || (hint_idx - d) >= lo_idx; d++) {
+        bit_slot_t bit_slot;
+
+        if((hint_idx + d) <= hi_idx) {
+            bit_slot = near_free_slot_in_word(bm, hint_idx + d, hint_slot, lo_slot, hi_slot);
+
+            if(bit_slot != BAD_BIT_SLOT) {
+                return bit_slot;
+            }
+        }
+
+        if(d != 0 && (hint_idx - d) >= lo_idx) {
+            bit_slot = near_free_slot_in_word(bm, hint_idx - d, hint_slot, lo_slot, hi_slot);
+
+            if(bit_slot != BAD_BIT_SLOT) {
+                return bit_slot;
+            }
+        }
+    }
+
+    return BAD_BIT_SLOT;
+}
+
+/* A chunk picked outside of get_next_free_bit_slot may
+ * still be queued in the free bit slot cache. It has to
+ * be taken out or the cache would hand it out again */
+INTERNAL_HIDDEN INLINE void remove_free_bit_slot(iso_alloc_zone *zone, bit_slot_t bit_slot) {
+    if(zone->next_free_bit_slot == bit_slot) {
+        zone->next_free_bit_slot = BAD_BIT_SLOT;
+    }
+
+    for(int32_t i = zone->free_bit_slot_cache_usable; i < zone->free_bit_slot_cache_index; i++) {
+        if(zone->free_bit_slot_cache[i] == bit_slot) {
+            zone->free_bit_slot_cache_index--;
+            zone->free_bit_slot_cache[i] = zone->free_bit_slot_cache[zone->free_bit_slot_cache_index];
+            zone->free_bit_slot_cache[zone->free_bit_slot_cache_index] = BAD_BIT_SLOT;
+            return;
+        }
+    }
+}
+
+/* Allocates a chunk from the zone that holds hint, as
+ * close to it as the bitmap allows. Only chunks on the
+ * same page as hint or the pages next to it are used.
+ * Returns NULL to leave anything else to the normal
+ * allocation path */
+INTERNAL_HIDDEN void *iso_alloc_near_zone(void *hint, size_t size) {
+    if(size > SMALL_SZ_MAX) {
+        return NULL;
+    }
+
+    LOCK_ROOT();
+
+    iso_alloc_zone *zone = NULL;
+
+    if(LIKELY(_root != NULL)) {
+        zone = iso_find_zone_range(hint);
+    }
+
+    /* The zone must pass the same size checks as any
+     * zone picked by iso_find_zone_fit. Custom zones are
+     * owned by their creator and are never used */
+    if(zone == NULL || iso_zone_fits_size(zone, size) == false) {
+        UNLOCK_ROOT();
+        return NULL;
+    }
+
+#if CPU_PIN
+    if(zone->cpu_core != sched_getcpu()) {
+        UNLOCK_ROOT();
+        return NULL;
+    }
+#endif
+
+    UNMASK_ZONE_PTRS(zone);
+
+    bit_slot_t bit_slot = iso_scan_zone_free_slot_near(zone, hint);
+
+    if(bit_slot == BAD_BIT_SLOT) {
+        MASK_ZONE_PTRS(zone);
+        UNLOCK_ROOT();
+        return NULL;
+    }
+
+    remove_free_bit_slot(zone, bit_slot);
+    void *p = _iso_alloc_bitslot_from_zone(bit_slot, zone);
+    MASK_ZONE_PTRS(zone);
+
+    STATS_INC(allocs[STATS_SIZE_CLASS(zone->chunk_size)]);
+    STATS_ADD(bytes_in_use, zone->chunk_size);
+    STATS_INC(near_hits);
+
+    _unlock_root_after_alloc();
     return p;
 }
 
@@ -1227,7 +1881,7 @@ INTERNAL_HIDDEN INLINE void check_canary(iso_alloc_zone *zone, void *p) {
     return;
 }
 
-INTERNAL_HIDDEN INLINE int64_t check_canary_no_abort(iso_alloc_zone *zone, void *p) {
+INTERNAL_HIDDEN int64_t check_canary_no_abort(iso_alloc_zone *zone, void *p) {
     return OK;
 }
 #else
@@ -1275,7 +1929,7 @@ INTERNAL_HIDDEN INLINE void check_canary(iso_alloc_zone *zone, void *p) {
     }
 }
 
-INTERNAL_HIDDEN INLINE int64_t check_canary_no_abort(iso_alloc_zone *zone, void *p) {
+INTERNAL_HIDDEN int64_t check_canary_no_abort(iso_alloc_zone *zone, void *p) {
     uint64_t v = *((uint64_t *) p);
     uint64_t canary = (zone->canary_secret ^ (uint64_t) p) & CANARY_VALIDATE_MASK;
 
@@ -1301,6 +1955,9 @@ INTERNAL_HIDDEN void iso_free_big_zone(iso_alloc_big_zone *big_zone, bool perman
         LOG_AND_ABORT("Double free of big zone 0x%p has been detected!", big_zone);
     }
 
+    STATS_INC(big_frees);
+    STATS_SUB(big_bytes_in_use, big_zone->size);
+
 #ifndef ENABLE_ASAN
     memset(big_zone->user_pages_start, POISON_BYTE, big_zone->size);
 #endif
@@ -1381,8 +2038,14 @@ INTERNAL_HIDDEN FLATTEN void iso_free_chunk_from_zone(iso_alloc_zone *zone, void
      * which could result in a page fault */
     bitmap_index_t b = bm[dwords_to_bit_slot];
 
-    /* Double free detection */
+    /* Double free detection. The bitmap has to be checked
+     * either way or a second free would corrupt the zone,
+     * zones without detection just ignore the free */
     if(UNLIKELY((GET_BIT(b, which_bit)) == 0)) {
+        if(UNLIKELY((zone->config & ZONE_DOUBLE_FREE_DETECTION) == 0)) {
+            return;
+        }
+
         LOG_AND_ABORT("Double free of chunk 0x%p detected from zone[%d] dwords_to_bit_slot=%lu bit_slot=%" PRIu64, p, zone->index, dwords_to_bit_slot, bit_slot);
     }
 
@@ -1396,40 +2059,53 @@ INTERNAL_HIDDEN FLATTEN void iso_free_chunk_from_zone(iso_alloc_zone *zone, void
         UNSET_BIT(b, which_bit);
         insert_free_bit_slot(zone, bit_slot);
         zone->is_full = false;
+        zone->chunks_was_used++;
+    } else {
+        zone->chunks_canary++;
+#if ZONE_RETIREMENT
+        zone->chunks_permanent++;
+#endif
     }
 
+    zone->chunks_in_use--;
+
     bm[dwords_to_bit_slot] = b;
 
-#if SANITIZE_CHUNKS
-    iso_clear_user_chunk(p, zone->chunk_size);
+#if !ENABLE_ASAN
+    if((zone->config & ZONE_CLEAR_CHUNK_ON_FREE) != 0) {
+        memset(p, POISON_BYTE, zone->chunk_size);
+    }
 #endif
 
     /* Now that we have free'd this chunk lets validate the
      * chunks before and after it. If they were previously
      * used and currently free they should have canaries
-     * we can verify */
+     * we can verify. The canary is always written so the
+     * zone can still be verified */
 #if !ENABLE_ASAN && !DISABLE_CANARY
     write_canary(zone, p);
 
-    if((chunk_number + 1) != GET_CHUNK_COUNT(zone)) {
-        bit_slot_t bit_slot_over = ((chunk_number + 1) << BITS_PER_CHUNK_SHIFT);
-        dwords_to_bit_slot = (bit_slot_over >> BITS_PER_QWORD_SHIFT);
-        which_bit = WHICH_BIT(bit_slot_over);
+    if((zone->config & ZONE_CANARY_CHECK_ON_FREE) != 0) {
+        if((chunk_number + 1) != GET_CHUNK_COUNT(zone)) {
+            bit_slot_t bit_slot_over = ((chunk_number + 1) << BITS_PER_CHUNK_SHIFT);
+            dwords_to_bit_slot = (bit_slot_over >> BITS_PER_QWORD_SHIFT);
+            which_bit = WHICH_BIT(bit_slot_over);
 
-        if((GET_BIT(bm[dwords_to_bit_slot], (which_bit + 1))) == 1) {
-            void *p_over = POINTER_FROM_BITSLOT(zone, bit_slot_over);
-            check_canary(zone, p_over);
+            if((GET_BIT(bm[dwords_to_bit_slot], (which_bit + 1))) == 1) {
+                void *p_over = POINTER_FROM_BITSLOT(zone, bit_slot_over);
+                check_canary(zone, p_over);
+            }
         }
-    }
 
-    if(chunk_number != 0) {
-        bit_slot_t bit_slot_under = ((chunk_number - 1) << BITS_PER_CHUNK_SHIFT);
-        dwords_to_bit_slot = (bit_slot_under >> BITS_PER_QWORD_SHIFT);
-        which_bit = WHICH_BIT(bit_slot_under);
+        if(chunk_number != 0) {
+            bit_slot_t bit_slot_under = ((chunk_number - 1) << BITS_PER_CHUNK_SHIFT);
+            dwords_to_bit_slot = (bit_slot_under >> BITS_PER_QWORD_SHIFT);
+            which_bit = WHICH_BIT(bit_slot_under);
 
-        if((GET_BIT(bm[dwords_to_bit_slot], (which_bit + 1))) == 1) {
-            void *p_under = POINTER_FROM_BITSLOT(zone, bit_slot_under);
-            check_canary(zone, p_under);
+            if((GET_BIT(bm[dwords_to_bit_slot], (which_bit + 1))) == 1) {
+                void *p_under = POINTER_FROM_BITSLOT(zone, bit_slot_under);
+                check_canary(zone, p_under);
+            }
         }
     }
 #endif
@@ -1442,9 +2118,10 @@ INTERNAL_HIDDEN FLATTEN void iso_free_chunk_from_zone(iso_alloc_zone *zone, void
         thread_zone_cache[thread_zone_cache_count].chunk_size = zone->chunk_size;
         thread_zone_cache_count++;
     } else {
-        thread_zone_cache_count = 0;
-        thread_zone_cache[thread_zone_cache_count].zone = zone;
-        thread_zone_cache[thread_zone_cache_count].chunk_size = zone->chunk_size;
+        /* Start over with this zone as the only entry */
+        thread_zone_cache[0].zone = zone;
+        thread_zone_cache[0].chunk_size = zone->chunk_size;
+        thread_zone_cache_count = 1;
     }
 #endif
 
@@ -1456,6 +2133,10 @@ INTERNAL_HIDDEN void _iso_free(void *p, bool permanent) {
         return;
     }
 
+#if HEAP_PROFILER
+    _iso_alloc_profile_free(p);
+#endif
+
 #if ALLOC_SANITY
     int32_t r = _iso_alloc_free_sane_sample(p);
 
@@ -1464,6 +2145,14 @@ INTERNAL_HIDDEN void _iso_free(void *p, bool permanent) {
     }
 #endif
 
+#if PER_CPU_CACHE
+    /* Hot Path: Keep the chunk in this CPU core's cache
+     * without taking the root lock */
+    if(_iso_cpu_cache_free(p, permanent) == true) {
+        return;
+    }
+#endif
+
     LOCK_ROOT();
 
 #if FUZZ_MODE
@@ -1474,8 +2163,19 @@ INTERNAL_HIDDEN void _iso_free(void *p, bool permanent) {
 
     if(zone != NULL) {
         UNMASK_ZONE_PTRS(zone);
+
+        STATS_INC(frees[STATS_SIZE_CLASS(zone->chunk_size)]);
+        STATS_SUB(bytes_in_use, zone->chunk_size);
+
         iso_free_chunk_from_zone(zone, p, permanent);
         MASK_ZONE_PTRS(zone);
+
+#if ZONE_RETIREMENT
+        if(UNLIKELY(zone->chunks_in_use == 0)) {
+            _iso_zone_emptied(zone);
+        }
+#endif
+
         UNLOCK_ROOT();
     } else {
         iso_alloc_big_zone *big_zone = iso_find_big_zone(p);
@@ -1542,6 +2242,9 @@ INTERNAL_HIDDEN size_t _iso_chunk_size(void *p) {
 
 INTERNAL_HIDDEN uint64_t _iso_alloc_detect_leaks_in_zone(iso_alloc_zone *zone) {
     LOCK_ROOT();
+#if PER_CPU_CACHE
+    _iso_cpu_cache_flush();
+#endif
     uint64_t leaks = _iso_alloc_zone_leak_detector(zone, false);
     UNLOCK_ROOT();
     return leaks;
@@ -1569,6 +2272,183 @@ INTERNAL_HIDDEN uint64_t _iso_alloc_zone_mem_usage(iso_alloc_zone *zone) {
     return zone_mem_usage;
 }
 
+/* Return the pages backing a run of free chunks to the
+ * kernel. Only whole pages inside the run are released.
+ * Chunks that overlap a released page lose the canary
+ * written when they were free'd so they are flipped from
+ * 01 (was used, now free) back to 00 (free, never used)
+ * which means their canaries are never checked again */
+INTERNAL_HIDDEN INLINE size_t _iso_alloc_release_free_run(iso_alloc_zone *zone, size_t first, size_t last, int32_t advice) {
+    uintptr_t start = (uintptr_t) zone->user_pages_start + (first * zone->chunk_size);
+    uintptr_t end = (uintptr_t) zone->user_pages_start + (last * zone->chunk_size);
+    uintptr_t page_start = ROUND_UP_PAGE(start);
+    uintptr_t page_end = end & ~((uintptr_t) _root->system_page_size - 1);
+
+    if(page_end <= page_start) {
+        return 0;
+    }
+
+    madvise((void *) page_start, page_end - page_start, advice);
+
+    bitmap_index_t *bm = (bitmap_index_t *) zone->bitmap_start;
+    size_t chunk = (page_start - (uintptr_t) zone->user_pages_start) / zone->chunk_size;
+    size_t last_chunk = ((page_end - (uintptr_t) zone->user_pages_start) + zone->chunk_size - 1) / zone->chunk_size;
+
+    for(; chunk < last_chunk; chunk++) {
+        bit_slot_t bit_slot = (chunk << BITS_PER_CHUNK_SHIFT);
+
+        if((GET_BIT(bm[bit_slot >> BITS_PER_QWORD_SHIFT], (WHICH_BIT(bit_slot) + 1))) == 1) {
+            UNSET_BIT(bm[bit_slot >> BITS_PER_QWORD_SHIFT], (WHICH_BIT(bit_slot) + 1));
+            zone->chunks_was_used--;
+        }
+    }
+
+    return (page_end - page_start);
+}
+
+/* Release every page in a zone that only holds free
+ * chunks with the given madvise advice. The caller must
+ * hold the root lock and have unmasked the zone pointers.
+ * Returns the number of bytes given back to the kernel */
+INTERNAL_HIDDEN size_t _iso_alloc_trim_zone(iso_alloc_zone *zone, int32_t advice) {
+    bitmap_index_t *bm = (bitmap_index_t *) zone->bitmap_start;
+    size_t chunk_count = GET_CHUNK_COUNT(zone);
+    size_t released = 0;
+    int64_t run_start = -1;
+
+    /* Iterate one past the last chunk so that a run of
+     * free chunks at the end of the zone is released */
+    for(size_t chunk = 0; chunk <= chunk_count; chunk++) {
+        bool is_free = false;
+
+        if(chunk < chunk_count) {
+            bit_slot_t bit_slot = (chunk << BITS_PER_CHUNK_SHIFT);
+            is_free = (GET_BIT(bm[bit_slot >> BITS_PER_QWORD_SHIFT], WHICH_BIT(bit_slot))) == 0;
+        }
+
+        if(is_free == true && run_start < 0) {
+            run_start = chunk;
+        } else if(is_free == false && run_start >= 0) {
+            released += _iso_alloc_release_free_run(zone, run_start, chunk, advice);
+            run_start = -1;
+        }
+    }
+
+    return released;
+}
+
+/* Frees every chunk in a custom zone at once. Chunks in
+ * use (10) become free chunks that were never used (00)
+ * so no canary is expected when they are handed out again.
+ * Free chunks (01) and canary chunks (11) keep their bits
+ * and the canaries already written into them, so no user
+ * page is touched unless release is set. Then every page
+ * that only holds free chunks is released with MADV_FREE
+ * and the chunks on it lose their canaries */
+INTERNAL_HIDDEN void _iso_alloc_zone_reset(iso_alloc_zone *zone, bool release) {
+    LOCK_ROOT();
+
+    if(zone->internally_managed == true) {
+        LOG_AND_ABORT("Zone[%d] is not a custom zone and cannot be reset", zone->index);
+    }
+
+#if PER_CPU_CACHE
+    /* Cached chunks are still marked as in use */
+    _iso_cpu_cache_flush();
+#endif
+
+    UNMASK_ZONE_PTRS(zone);
+    UNPOISON_ZONE(zone);
+
+    bitmap_index_t *bm = (bitmap_index_t *) zone->bitmap_start;
+    size_t max_bitmap_idx = GET_MAX_BITMASK_INDEX(zone);
+
+    /* Each chunk is a pair of bits, the low bit is set
+     * while in use and the high bit once it was used. Only
+     * pairs with both bits set keep their low bit. This
+     * loop has no branches and is vectorized */
+    for(size_t i = 0; i < max_bitmap_idx; i++) {
+        bitmap_index_t b = bm[i];
+        bm[i] = (b & RESET_HIGH_BITS_MASK) | (b & (b >> 1) & RESET_LOW_BITS_MASK);
+    }
+
+    /* Every chunk in use was free'd */
+    STATS_ADD(frees[STATS_SIZE_CLASS(zone->chunk_size)], zone->chunks_in_use);
+    STATS_SUB(bytes_in_use, zone->chunks_in_use * zone->chunk_size);
+
+    zone->chunks_in_use = 0;
+    zone->bump_chunk = 0;
+    zone->is_full = false;
+
+    if(release == true) {
+        _iso_alloc_trim_zone(zone, RESET_RELEASE_ADVICE);
+    }
+
+    zone->next_free_bit_slot = BAD_BIT_SLOT;
+    fill_free_bit_slot_cache(zone);
+    get_next_free_bit_slot(zone);
+
+    POISON_ZONE(zone);
+    MASK_ZONE_PTRS(zone);
+    UNLOCK_ROOT();
+}
+
+/* Gives free pages in all zones and all free big zones
+ * back to the kernel. Mappings are left in place so the
+ * pages will be faulted back in as zero pages when they
+ * are used again. Returns the number of bytes released */
+INTERNAL_HIDDEN size_t _iso_alloc_trim(void) {
+    size_t released = 0;
+
+    LOCK_ROOT();
+
+#if PER_CPU_CACHE
+    /* Cached chunks are still marked as in use */
+    _iso_cpu_cache_flush();
+#endif
+
+    for(uint32_t i = 0; i < _root->zones_used; i++) {
+        iso_alloc_zone *zone = &_root->zones[i];
+
+        if(zone->user_pages_start == NULL) {
+            continue;
+        }
+
+        UNMASK_ZONE_PTRS(zone);
+        released += _iso_alloc_trim_zone(zone, MADV_DONTNEED);
+        MASK_ZONE_PTRS(zone);
+    }
+
+    UNLOCK_ROOT();
+    LOCK_BIG_ZONE();
+
+    iso_alloc_big_zone *big = _root->big_zone_head;
+
+    if(big != NULL) {
+        big = UNMASK_BIG_ZONE_NEXT(_root->big_zone_head);
+    }
+
+    while(big != NULL) {
+        check_big_canary(big);
+
+        /* Free big zones were poisoned when they were free'd
+         * and are never read before they are handed out */
+        if(big->free == true) {
+            madvise(big->user_pages_start, big->size, MADV_DONTNEED);
+            released += big->size;
+        }
+
+        if(big->next != NULL) {
+            big = UNMASK_BIG_ZONE_NEXT(big->next);
+        } else {
+            big = NULL;
+        }
+    }
+
+    UNLOCK_BIG_ZONE();
+    return released;
+}
+
 #if UNIT_TESTING
 /* Some tests require getting access to IsoAlloc internals
  * that aren't supported by the API. We never want these
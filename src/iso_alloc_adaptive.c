@@ -0,0 +1,112 @@
+/* iso_alloc_adaptive.c - A secure memory allocator
+ * Copyright 2021 - chris.rohlf@gmail.com */
+
+#include "iso_alloc_internal.h"
+
+#if ADAPTIVE_ZONES
+iso_adaptive_zones _adaptive_zones;
+
+/* Returns true if chunks of this size would waste
+ * enough of the power of 2 zone they otherwise land
+ * in to be worth a zone of their own */
+INTERNAL_HIDDEN INLINE bool _iso_adaptive_is_wasteful(size_t chunk_size) {
+    size_t pow2 = (size_t) 1 << HEAP_USAGE_CLASS(chunk_size);
+
+    if(chunk_size < SMALLEST_ZONE) {
+        return false;
+    }
+
+    return ((pow2 - chunk_size) * ADAPTIVE_MIN_WASTE) >= pow2;
+}
+
+INTERNAL_HIDDEN iso_alloc_zone *_iso_adaptive_new_zone(uint32_t bucket) {
+    iso_alloc_zone *zone = _iso_new_zone(bucket << ADAPTIVE_BUCKET_SHIFT, true);
+
+    if(UNLIKELY(zone == NULL)) {
+        return NULL;
+    }
+
+    _adaptive_zones.routes[bucket] = zone->index + 1;
+    return zone;
+}
+
+/* Called once per window. Any bucket with sustained
+ * demand that doesn't have a route yet gets a right
+ * sized zone and all counts start over */
+INTERNAL_HIDDEN void _iso_adaptive_evaluate(void) {
+    for(uint32_t b = 1; b < ADAPTIVE_BUCKETS; b++) {
+        if(_adaptive_zones.routes[b] == 0 && _iso_adaptive_is_wasteful(b << ADAPTIVE_BUCKET_SHIFT) == true &&
+           (_adaptive_zones.counts[b] * ADAPTIVE_MIN_SHARE) >= ADAPTIVE_WINDOW) {
+            _adaptive_zones.streaks[b]++;
+        } else {
+            _adaptive_zones.streaks[b] = 0;
+        }
+
+        if(_adaptive_zones.streaks[b] >= ADAPTIVE_SUSTAIN_WINDOWS) {
+            if(_iso_adaptive_new_zone(b) != NULL) {
+                LOG("Created a dedicated zone for %d byte chunks", b << ADAPTIVE_BUCKET_SHIFT);
+            }
+
+            _adaptive_zones.streaks[b] = 0;
+        }
+
+        _adaptive_zones.counts[b] = 0;
+    }
+
+    _adaptive_zones.window_remaining = ADAPTIVE_WINDOW;
+}
+
+/* Counts an allocation of size bytes. This is called
+ * before the CPU cache is checked, without the root lock,
+ * so an update racing with another thread may be lost.
+ * That is fine for a heuristic. A used up window stays
+ * at 0 until _iso_adaptive_zone evaluates it */
+INTERNAL_HIDDEN void _iso_adaptive_count(size_t size) {
+    uint32_t bucket = ADAPTIVE_BUCKET(size);
+    uint32_t remaining = __atomic_load_n(&_adaptive_zones.window_remaining, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&_adaptive_zones.counts[bucket], __atomic_load_n(&_adaptive_zones.counts[bucket], __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+
+    if(remaining != 0) {
+        __atomic_store_n(&_adaptive_zones.window_remaining, remaining - 1, __ATOMIC_RELAXED);
+    }
+}
+
+/* Returns the dedicated zone for this size if there is
+ * one. A dedicated zone that filled up is replaced with
+ * a new one of the same size because the demand for it
+ * is still there. The caller must hold the root lock */
+INTERNAL_HIDDEN iso_alloc_zone *_iso_adaptive_zone(size_t size) {
+    uint32_t bucket = ADAPTIVE_BUCKET(size);
+
+    if(UNLIKELY(_adaptive_zones.window_remaining == 0)) {
+        _iso_adaptive_evaluate();
+    }
+
+    uint32_t route = _adaptive_zones.routes[bucket];
+
+    if(LIKELY(route == 0)) {
+        return NULL;
+    }
+
+    iso_alloc_zone *zone = &_root->zones[route - 1];
+
+    /* The zone may have been destroyed or its descriptor
+     * recycled for another chunk size */
+    if(UNLIKELY(zone->chunk_size != (bucket << ADAPTIVE_BUCKET_SHIFT))) {
+        _adaptive_zones.routes[bucket] = 0;
+        return NULL;
+    }
+
+    if(LIKELY(iso_does_zone_fit(zone, size) == true)) {
+        return zone;
+    }
+
+    if(zone->is_full == false) {
+        _adaptive_zones.routes[bucket] = 0;
+        return NULL;
+    }
+
+    return _iso_adaptive_new_zone(bucket);
+}
+#endif
@@ -0,0 +1,96 @@
+/* iso_alloc_arena.c - A secure memory allocator
+ * Copyright 2021 - chris.rohlf@gmail.com */
+
+#include "iso_alloc_internal.h"
+
+#if ZONE_ARENA
+/* Mapping each zone on its own costs two mmap calls, four
+ * guard pages and leaves about six VMAs behind. Zones in an
+ * arena slot cost two mprotect calls and share their guard
+ * pages with their neighbours */
+static uint8_t *_zone_arena;
+static uint32_t _zone_arena_used;
+
+#if THREAD_SUPPORT
+static atomic_flag _zone_arena_flag;
+
+#define LOCK_ZONE_ARENA()                                   \
+    while(atomic_flag_test_and_set(&_zone_arena_flag)) { \
+    }
+
+#define UNLOCK_ZONE_ARENA() \
+    atomic_flag_clear(&_zone_arena_flag);
+#else
+#define LOCK_ZONE_ARENA()
+#define UNLOCK_ZONE_ARENA()
+#endif
+
+/* This is called without the root lock by the zone pool
+ * thread so it uses g_page_size */
+INTERNAL_HIDDEN void _iso_zone_arena_map(size_t bitmap_size, void **bitmap_start, void **user_pages_start) {
+    size_t bitmap_region = ROUND_UP_PAGE(ZONE_MAX_BITMAP_SIZE);
+    size_t slot_size = bitmap_region + ZONE_USER_SIZE + (g_page_size << 1);
+
+    LOCK_ZONE_ARENA();
+
+    if(_zone_arena == NULL || _zone_arena_used == ZONE_ARENA_SLOTS) {
+        /* The first page is the guard page below the
+         * bitmap of the first slot */
+        void *p = mmap(0, g_page_size + (slot_size * ZONE_ARENA_SLOTS), PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+        if(p == MAP_FAILED) {
+            LOG_AND_ABORT("Failed to reserve a zone arena");
+        }
+
+        _zone_arena = (uint8_t *) p + g_page_size;
+        _zone_arena_used = 0;
+    }
+
+    uint8_t *slot = _zone_arena + (slot_size * _zone_arena_used);
+    _zone_arena_used++;
+
+    UNLOCK_ZONE_ARENA();
+
+    *user_pages_start = slot + bitmap_region + g_page_size;
+    mprotect_pages(*user_pages_start, ZONE_USER_SIZE, PROT_READ | PROT_WRITE);
+
+    /* User pages are accessed in an unpredictable order */
+    madvise(*user_pages_start, ZONE_USER_SIZE, MADV_RANDOM);
+
+#if PRE_POPULATE_PAGES
+    _iso_populate_pages(*user_pages_start, ZONE_USER_SIZE);
+#endif
+
+    /* A bitmap_size of 0 means the bitmap lives elsewhere
+     * and this part of the slot stays PROT_NONE */
+    if(bitmap_size == 0) {
+        return;
+    }
+
+    size_t bitmap_pages = ROUND_UP_PAGE(bitmap_size);
+    *bitmap_start = slot + (bitmap_region - bitmap_pages);
+    mprotect_pages(*bitmap_start, bitmap_pages, PROT_READ | PROT_WRITE);
+
+    /* Bitmap pages are accessed often and usually in
+     * sequential order */
+    madvise(*bitmap_start, bitmap_pages, MADV_SEQUENTIAL);
+
+#if PRE_POPULATE_PAGES
+    _iso_populate_pages(*bitmap_start, bitmap_pages);
+#endif
+}
+
+/* Slots are never handed out twice. Their pages go back
+ * to PROT_NONE and the memory is given back but the range
+ * stays reserved so no other mapping can end up between
+ * the guard pages of the neighbouring zones */
+INTERNAL_HIDDEN void _iso_zone_arena_unmap(void *bitmap_start, size_t bitmap_size, void *user_pages_start) {
+    if(bitmap_size != 0) {
+        mprotect_pages(bitmap_start, bitmap_size, PROT_NONE);
+        madvise(bitmap_start, ROUND_UP_PAGE(bitmap_size), MADV_DONTNEED);
+    }
+
+    mprotect_pages(user_pages_start, ZONE_USER_SIZE, PROT_NONE);
+    madvise(user_pages_start, ZONE_USER_SIZE, MADV_DONTNEED);
+}
+#endif
@@ -0,0 +1,155 @@
+/* iso_alloc_bitmap_arena.c - A secure memory allocator
+ * Copyright 2021 - chris.rohlf@gmail.com */
+
+#include "iso_alloc_internal.h"
+
+#if PACKED_BITMAPS
+/* A zone of 262144 byte chunks has an 8 byte bitmap but
+ * mapping it on its own costs a page, two guard pages and
+ * up to three VMAs. Small bitmaps are packed into shared
+ * arenas instead. Only the arenas have guard pages. These
+ * functions are called with the root lock held */
+static iso_bitmap_arena _bitmap_arenas[MAX_BITMAP_ARENAS];
+static uint32_t _bitmap_arena_count;
+
+INTERNAL_HIDDEN INLINE size_t _bitmap_slot_size(size_t size) {
+    size_t slot = PACKED_BITMAP_MIN;
+
+    while(slot < size) {
+        slot <<= 1;
+    }
+
+    return slot;
+}
+
+INTERNAL_HIDDEN INLINE uint32_t _bitmap_page_slots(size_t slot_size) {
+    uint32_t slots = g_page_size / slot_size;
+    return (slots > BITMAP_PAGE_SLOTS) ? BITMAP_PAGE_SLOTS : slots;
+}
+
+/* Takes the first free slot in a page that holds
+ * bitmaps of slot_size bytes */
+INTERNAL_HIDDEN void *_bitmap_page_take(iso_bitmap_arena *arena, uint32_t page, size_t slot_size) {
+    iso_bitmap_page *bp = &arena->pages[page];
+    uint32_t slots = _bitmap_page_slots(slot_size);
+
+    for(uint32_t i = 0; i < BITMAP_PAGE_WORDS; i++) {
+        uint64_t free_slots = ~bp->used[i];
+
+        if(free_slots == 0) {
+            continue;
+        }
+
+        uint32_t slot = (i << 6) + __builtin_ctzll(free_slots);
+
+        if(slot >= slots) {
+            return NULL;
+        }
+
+        bp->used[i] |= (1ULL << (slot & 63));
+        bp->slot_size = slot_size;
+        bp->in_use++;
+
+        return arena->start + (page * g_page_size) + (slot * slot_size);
+    }
+
+    return NULL;
+}
+
+/* Returns a zeroed slot for a bitmap of size bytes or
+ * NULL if the bitmap is too large to be packed or every
+ * arena is full, in which case the caller maps it */
+INTERNAL_HIDDEN void *_iso_bitmap_arena_alloc(size_t size) {
+    if(size > PACKED_BITMAP_MAX) {
+        return NULL;
+    }
+
+    size_t slot_size = _bitmap_slot_size(size);
+
+    /* Prefer a page that already holds bitmaps of this
+     * size so partially used pages fill up first */
+    for(uint32_t a = 0; a < _bitmap_arena_count; a++) {
+        iso_bitmap_arena *arena = &_bitmap_arenas[a];
+
+        for(uint32_t i = 0; i < BITMAP_ARENA_PAGES; i++) {
+            if(arena->pages[i].slot_size == slot_size && arena->pages[i].in_use < _bitmap_page_slots(slot_size)) {
+                return _bitmap_page_take(arena, i, slot_size);
+            }
+        }
+    }
+
+    for(uint32_t a = 0; a < _bitmap_arena_count; a++) {
+        iso_bitmap_arena *arena = &_bitmap_arenas[a];
+
+        for(uint32_t i = 0; i < BITMAP_ARENA_PAGES; i++) {
+            if(arena->pages[i].slot_size == 0) {
+                return _bitmap_page_take(arena, i, slot_size);
+            }
+        }
+    }
+
+    if(_bitmap_arena_count >= MAX_BITMAP_ARENAS) {
+        return NULL;
+    }
+
+    iso_bitmap_arena *arena = &_bitmap_arenas[_bitmap_arena_count];
+    arena->start = _iso_map_guarded_pages(BITMAP_ARENA_PAGES * g_page_size, MADV_SEQUENTIAL);
+    _bitmap_arena_count++;
+
+    return _bitmap_page_take(arena, 0, slot_size);
+}
+
+INTERNAL_HIDDEN iso_bitmap_arena *_bitmap_arena_for(void *p) {
+    for(uint32_t a = 0; a < _bitmap_arena_count; a++) {
+        iso_bitmap_arena *arena = &_bitmap_arenas[a];
+
+        if((uint8_t *) p >= arena->start && (uint8_t *) p < (arena->start + (BITMAP_ARENA_PAGES * g_page_size))) {
+            return arena;
+        }
+    }
+
+    return NULL;
+}
+
+/* Packed bitmaps share their pages with other zones so
+ * they must not be unmapped or madvise'd on their own */
+INTERNAL_HIDDEN bool _iso_bitmap_arena_owns(void *p) {
+    return _bitmap_arena_for(p) != NULL;
+}
+
+/* Returns true if p is a packed bitmap. Its slot is zeroed
+ * for the next zone and a page that no longer holds any
+ * bitmaps can be used for bitmaps of another size */
+INTERNAL_HIDDEN bool _iso_bitmap_arena_free(void *p) {
+    iso_bitmap_arena *arena = _bitmap_arena_for(p);
+
+    if(arena == NULL) {
+        return false;
+    }
+
+    size_t offset = (uint8_t *) p - arena->start;
+    uint32_t page = offset / g_page_size;
+    iso_bitmap_page *bp = &arena->pages[page];
+
+    if(bp->slot_size == 0 || (offset % bp->slot_size) != 0) {
+        LOG_AND_ABORT("Packed bitmap 0x%p is not in use", p);
+    }
+
+    uint32_t slot = (offset % g_page_size) / bp->slot_size;
+
+    if((bp->used[slot >> 6] & (1ULL << (slot & 63))) == 0) {
+        LOG_AND_ABORT("Packed bitmap 0x%p is not in use", p);
+    }
+
+    memset(p, 0x0, bp->slot_size);
+    bp->used[slot >> 6] &= ~(1ULL << (slot & 63));
+    bp->in_use--;
+
+    if(bp->in_use == 0) {
+        bp->slot_size = 0;
+        madvise(arena->start + (page * g_page_size), g_page_size, MADV_DONTNEED);
+    }
+
+    return true;
+}
+#endif
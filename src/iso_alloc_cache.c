@@ -0,0 +1,458 @@
+/* iso_alloc_cache.c - A secure memory allocator
+ * Copyright 2021 - chris.rohlf@gmail.com */
+
+#include "iso_alloc_internal.h"
+
+static iso_object_cache _object_caches[MAX_OBJECT_CACHES];
+static uint64_t _object_cache_generation;
+static __thread iso_cache_magazines _thread_magazines[MAX_OBJECT_CACHES];
+
+#if THREAD_SUPPORT
+static atomic_flag _object_caches_flag;
+static pthread_key_t _object_cache_key;
+static bool _object_cache_key_created;
+static __thread bool _object_cache_key_set;
+
+#define LOCK_OBJECT_CACHES()                                   \
+    while(atomic_flag_test_and_set(&_object_caches_flag)) { \
+    }
+
+#define UNLOCK_OBJECT_CACHES() \
+    atomic_flag_clear(&_object_caches_flag);
+#else
+#define LOCK_OBJECT_CACHES()
+#define UNLOCK_OBJECT_CACHES()
+#endif
+
+/* Returns the index of the cache zone holding chunk p
+ * and sets chunk to its number, or ERR if p is not a
+ * chunk in one of the cache zones. Zones are added
+ * without the cache lock held by readers, so the zone
+ * count is read before any of their entries */
+INTERNAL_HIDDEN INLINE int32_t _cache_chunk(iso_object_cache *cache, void *p, size_t *chunk) {
+    uintptr_t ptr = (uintptr_t) p;
+    uint32_t zone_count = __atomic_load_n(&cache->zone_count, __ATOMIC_ACQUIRE);
+
+    for(uint32_t i = 0; i < zone_count; i++) {
+        uintptr_t start = cache->zone_start[i];
+
+        if(ptr >= start && ptr < (start + ZONE_USER_SIZE)) {
+            if(((ptr - start) % cache->size) != 0) {
+                return ERR;
+            }
+
+            *chunk = (ptr - start) / cache->size;
+            return i;
+        }
+    }
+
+    return ERR;
+}
+
+/* Returns the cached bitmap word for chunk p and sets
+ * mask to its bit, or NULL if p is not a chunk in one
+ * of the cache zones */
+INTERNAL_HIDDEN INLINE uint64_t *_cache_slot(iso_object_cache *cache, void *p, uint64_t *mask) {
+    size_t chunk;
+    int32_t zone = _cache_chunk(cache, p, &chunk);
+
+    if(zone == ERR) {
+        return NULL;
+    }
+
+    *mask = 1ULL << (chunk & 63);
+    return &cache->cached[zone][chunk >> 6];
+}
+
+/* Returns true if the zone bitmap marks the chunk as in
+ * use. Cached objects stay in use so any other state
+ * means the chunk is free in its zone. Only this chunk's
+ * owner changes its bits so no root lock is needed */
+INTERNAL_HIDDEN INLINE bool _cache_chunk_in_use(iso_object_cache *cache, int32_t zone, size_t chunk) {
+    bitmap_index_t *bm = (bitmap_index_t *) cache->bitmap_start[zone];
+    bit_slot_t bit_slot = (chunk << BITS_PER_CHUNK_SHIFT);
+    int64_t which_bit = WHICH_BIT(bit_slot);
+    bitmap_index_t b = __atomic_load_n(&bm[bit_slot >> BITS_PER_QWORD_SHIFT], __ATOMIC_RELAXED);
+
+    return (GET_BIT(b, which_bit)) == 1 && (GET_BIT(b, (which_bit + 1))) == 0;
+}
+
+INTERNAL_HIDDEN INLINE uint64_t *_cache_bitmap_new(size_t size) {
+    size_t chunks = ZONE_USER_SIZE / size;
+    return (uint64_t *) _iso_calloc((chunks + 63) >> 6, sizeof(uint64_t));
+}
+
+/* Clears the cached bit of an object that is leaving a
+ * magazine. Other threads may update the same word */
+INTERNAL_HIDDEN INLINE void *_cache_uncache(iso_object_cache *cache, void *p) {
+    uint64_t mask;
+    uint64_t *word = _cache_slot(cache, p, &mask);
+    __atomic_fetch_and(word, ~mask, __ATOMIC_RELAXED);
+    return p;
+}
+
+/* Destructs every object in the magazine and returns
+ * them to their zones */
+INTERNAL_HIDDEN void _cache_flush_magazine(iso_object_cache *cache, iso_magazine *mag) {
+    for(uint32_t i = 0; i < mag->count; i++) {
+        _cache_uncache(cache, mag->objects[i]);
+
+        if(cache->dtor != NULL) {
+            cache->dtor(mag->objects[i]);
+        }
+
+        _iso_free(mag->objects[i], false);
+    }
+
+    mag->count = 0;
+}
+
+/* Hands a magazine to the depot. Full magazines beyond
+ * CACHE_DEPOT_MAX are flushed and kept as empty ones */
+INTERNAL_HIDDEN void _cache_depot_put(iso_object_cache *cache, iso_magazine *mag) {
+    if(mag == NULL) {
+        return;
+    }
+
+    LOCK_OBJECT_CACHE(cache);
+
+    if(mag->count != 0 && cache->full_count < CACHE_DEPOT_MAX) {
+        mag->next = cache->full;
+        cache->full = mag;
+        cache->full_count++;
+        UNLOCK_OBJECT_CACHE(cache);
+        return;
+    }
+
+    UNLOCK_OBJECT_CACHE(cache);
+
+    _cache_flush_magazine(cache, mag);
+
+    LOCK_OBJECT_CACHE(cache);
+    mag->next = cache->empty;
+    cache->empty = mag;
+    UNLOCK_OBJECT_CACHE(cache);
+}
+
+#if THREAD_SUPPORT
+/* Called when a thread exits so the objects in its
+ * magazines can be used by other threads */
+INTERNAL_HIDDEN void _cache_thread_exit(void *arg) {
+    for(uint32_t i = 0; i < MAX_OBJECT_CACHES; i++) {
+        iso_cache_magazines *m = &_thread_magazines[i];
+
+        if(m->generation != 0 && m->generation == _object_caches[i].generation) {
+            _cache_depot_put(&_object_caches[i], m->loaded);
+            _cache_depot_put(&_object_caches[i], m->previous);
+        } else {
+            _iso_free(m->loaded, false);
+            _iso_free(m->previous, false);
+        }
+
+        m->loaded = NULL;
+        m->previous = NULL;
+        m->generation = 0;
+    }
+}
+#endif
+
+INTERNAL_HIDDEN INLINE iso_cache_magazines *_cache_magazines(iso_object_cache *cache) {
+    iso_cache_magazines *m = &_thread_magazines[cache - _object_caches];
+
+    if(LIKELY(m->generation == cache->generation)) {
+        return m;
+    }
+
+    /* The cache in this slot was destroyed along with
+     * the objects in these magazines */
+    _iso_free(m->loaded, false);
+    _iso_free(m->previous, false);
+
+    m->loaded = NULL;
+    m->previous = NULL;
+    m->generation = cache->generation;
+
+#if THREAD_SUPPORT
+    if(_object_cache_key_set == false) {
+        pthread_setspecific(_object_cache_key, (void *) 1);
+        _object_cache_key_set = true;
+    }
+#endif
+
+    return m;
+}
+
+/* Makes a new object in one of the cache zones. A new
+ * zone is added once every zone is full */
+INTERNAL_HIDDEN void *_cache_new_object(iso_object_cache *cache) {
+    void *p = NULL;
+    uint32_t zone_count = __atomic_load_n(&cache->zone_count, __ATOMIC_ACQUIRE);
+
+    for(int32_t i = zone_count - 1; i >= 0 && p == NULL; i--) {
+        p = _iso_alloc(cache->zones[i], cache->size);
+    }
+
+    if(p == NULL) {
+        LOCK_OBJECT_CACHE(cache);
+
+        /* Another thread may have added a zone already */
+        if(cache->zone_count == zone_count && zone_count < CACHE_MAX_ZONES) {
+            iso_alloc_zone *zone = iso_new_zone(cache->size, false);
+
+            if(zone != NULL) {
+                LOCK_ROOT();
+                UNMASK_ZONE_PTRS(zone);
+                cache->zone_start[zone_count] = (uintptr_t) zone->user_pages_start;
+                cache->bitmap_start[zone_count] = (uintptr_t) zone->bitmap_start;
+                MASK_ZONE_PTRS(zone);
+                UNLOCK_ROOT();
+
+                cache->cached[zone_count] = _cache_bitmap_new(cache->size);
+                cache->zones[zone_count] = zone;
+                __atomic_store_n(&cache->zone_count, zone_count + 1, __ATOMIC_RELEASE);
+            }
+        }
+
+        zone_count = cache->zone_count;
+        UNLOCK_OBJECT_CACHE(cache);
+
+        for(int32_t i = zone_count - 1; i >= 0 && p == NULL; i--) {
+            p = _iso_alloc(cache->zones[i], cache->size);
+        }
+
+        if(p == NULL) {
+            return NULL;
+        }
+    }
+
+    if(cache->ctor != NULL) {
+        cache->ctor(p);
+    }
+
+    return p;
+}
+
+INTERNAL_HIDDEN iso_object_cache *_iso_cache_create(size_t size, void (*ctor)(void *), void (*dtor)(void *)) {
+    if(size == 0 || size > SMALL_SZ_MAX) {
+        return NULL;
+    }
+
+    iso_alloc_zone *zone = iso_new_zone(size, false);
+
+    if(zone == NULL) {
+        return NULL;
+    }
+
+    LOCK_OBJECT_CACHES();
+
+#if THREAD_SUPPORT
+    if(_object_cache_key_created == false) {
+        if(pthread_key_create(&_object_cache_key, _cache_thread_exit) != 0) {
+            LOG_AND_ABORT("Failed to create the object cache thread key");
+        }
+
+        _object_cache_key_created = true;
+    }
+#endif
+
+    iso_object_cache *cache = NULL;
+
+    for(uint32_t i = 0; i < MAX_OBJECT_CACHES; i++) {
+        if(_object_caches[i].generation == 0) {
+            cache = &_object_caches[i];
+            break;
+        }
+    }
+
+    if(cache == NULL) {
+        UNLOCK_OBJECT_CACHES();
+        _iso_alloc_destroy_zone(zone);
+        return NULL;
+    }
+
+    LOCK_ROOT();
+    UNMASK_ZONE_PTRS(zone);
+    cache->zone_start[0] = (uintptr_t) zone->user_pages_start;
+    cache->bitmap_start[0] = (uintptr_t) zone->bitmap_start;
+    cache->size = zone->chunk_size;
+    MASK_ZONE_PTRS(zone);
+    UNLOCK_ROOT();
+
+    cache->cached[0] = _cache_bitmap_new(cache->size);
+    cache->zones[0] = zone;
+    cache->zone_count = 1;
+    cache->ctor = ctor;
+    cache->dtor = dtor;
+    cache->full = NULL;
+    cache->empty = NULL;
+    cache->full_count = 0;
+    cache->generation = ++_object_cache_generation;
+
+    UNLOCK_OBJECT_CACHES();
+
+    return cache;
+}
+
+INTERNAL_HIDDEN void *_iso_cache_alloc(iso_object_cache *cache) {
+    iso_cache_magazines *m = _cache_magazines(cache);
+    iso_magazine *mag = m->loaded;
+
+    /* Hot Path: the object is already constructed */
+    if(LIKELY(mag != NULL && mag->count != 0)) {
+        return _cache_uncache(cache, mag->objects[--mag->count]);
+    }
+
+    if(m->previous != NULL && m->previous->count != 0) {
+        m->loaded = m->previous;
+        m->previous = mag;
+        return _cache_uncache(cache, m->loaded->objects[--m->loaded->count]);
+    }
+
+    /* Swap the empty previous magazine for a full one
+     * from the depot */
+    LOCK_OBJECT_CACHE(cache);
+
+    if(cache->full != NULL) {
+        iso_magazine *full = cache->full;
+        cache->full = full->next;
+        cache->full_count--;
+
+        if(m->previous != NULL) {
+            m->previous->next = cache->empty;
+            cache->empty = m->previous;
+        }
+
+        UNLOCK_OBJECT_CACHE(cache);
+
+        m->previous = m->loaded;
+        m->loaded = full;
+        return _cache_uncache(cache, full->objects[--full->count]);
+    }
+
+    UNLOCK_OBJECT_CACHE(cache);
+
+    return _cache_new_object(cache);
+}
+
+INTERNAL_HIDDEN void _iso_cache_free(iso_object_cache *cache, void *p) {
+    if(p == NULL) {
+        return;
+    }
+
+    size_t chunk;
+    int32_t zone = _cache_chunk(cache, p, &chunk);
+
+    if(UNLIKELY(zone == ERR)) {
+        LOG_AND_ABORT("Object 0x%p was not allocated from this cache", p);
+    }
+
+    /* An object that already went back to its zone, or
+     * a chunk that was never handed out, is not in use */
+    if(UNLIKELY(_cache_chunk_in_use(cache, zone, chunk) == false)) {
+        LOG_AND_ABORT("Double free of cached object 0x%p detected", p);
+    }
+
+    uint64_t mask = 1ULL << (chunk & 63);
+    uint64_t *word = &cache->cached[zone][chunk >> 6];
+
+    if(UNLIKELY(__atomic_fetch_or(word, mask, __ATOMIC_RELAXED) & mask)) {
+        LOG_AND_ABORT("Double free of cached object 0x%p detected", p);
+    }
+
+    iso_cache_magazines *m = _cache_magazines(cache);
+    iso_magazine *mag = m->loaded;
+
+    /* Hot Path: keep the object constructed */
+    if(LIKELY(mag != NULL && mag->count < CACHE_MAGAZINE_SZ)) {
+        mag->objects[mag->count++] = p;
+        return;
+    }
+
+    if(m->previous != NULL && m->previous->count == 0) {
+        m->loaded = m->previous;
+        m->previous = mag;
+        m->loaded->objects[m->loaded->count++] = p;
+        return;
+    }
+
+    /* Both magazines are full. The previous one goes to
+     * the depot and an empty one is loaded in its place */
+    _cache_depot_put(cache, m->previous);
+
+    LOCK_OBJECT_CACHE(cache);
+    iso_magazine *empty = cache->empty;
+
+    if(empty != NULL) {
+        cache->empty = empty->next;
+    }
+
+    UNLOCK_OBJECT_CACHE(cache);
+
+    if(empty == NULL) {
+        empty = (iso_magazine *) _iso_calloc(1, sizeof(iso_magazine));
+    }
+
+    m->previous = m->loaded;
+    m->loaded = empty;
+    empty->objects[empty->count++] = p;
+}
+
+/* Destructs the objects cached by the depot and the
+ * calling thread and destroys the cache zones. Objects
+ * still held by the program or cached by other threads
+ * are released without being destructed */
+INTERNAL_HIDDEN void _iso_cache_destroy(iso_object_cache *cache) {
+    iso_cache_magazines *m = _cache_magazines(cache);
+
+    LOCK_OBJECT_CACHES();
+    LOCK_OBJECT_CACHE(cache);
+
+    iso_magazine *full = cache->full;
+    iso_magazine *empty = cache->empty;
+    cache->full = NULL;
+    cache->empty = NULL;
+    cache->full_count = 0;
+
+    UNLOCK_OBJECT_CACHE(cache);
+
+    if(m->loaded != NULL) {
+        m->loaded->next = full;
+        full = m->loaded;
+    }
+
+    if(m->previous != NULL) {
+        m->previous->next = full;
+        full = m->previous;
+    }
+
+    m->loaded = NULL;
+    m->previous = NULL;
+
+    while(full != NULL) {
+        iso_magazine *next = full->next;
+        _cache_flush_magazine(cache, full);
+        _iso_free(full, false);
+        full = next;
+    }
+
+    while(empty != NULL) {
+        iso_magazine *next = empty->next;
+        _iso_free(empty, false);
+        empty = next;
+    }
+
+    for(uint32_t i = 0; i < cache->zone_count; i++) {
+        _iso_alloc_destroy_zone(cache->zones[i]);
+        _iso_free(cache->cached[i], false);
+        cache->zones[i] = NULL;
+        cache->zone_start[i] = 0;
+        cache->bitmap_start[i] = 0;
+        cache->cached[i] = NULL;
+    }
+
+    cache->zone_count = 0;
+    cache->generation = 0;
+    m->generation = 0;
+
+    UNLOCK_OBJECT_CACHES();
+}
@@ -0,0 +1,312 @@
+/* iso_alloc_cpu_cache.c - A secure memory allocator
+ * Copyright 2021 - chris.rohlf@gmail.com */
+
+#include "iso_alloc_internal.h"
+
+#if PER_CPU_CACHE
+#include <sched.h>
+
+/* glibc >= 2.35 registers an rseq area for every thread
+ * and exports its offset from the thread pointer. The
+ * kernel keeps the cpu_id field of that area current so
+ * reading it is a plain load instead of a vDSO call */
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 35))
+#include <sys/rseq.h>
+#define RSEQ_CPU_ID 1
+#endif
+
+iso_cpu_cache *_cpu_caches;
+uint32_t _cpu_cache_count;
+uint64_t _cpu_cache_secret;
+
+/* Indexed like _root->zones. Entries below the count are
+ * published with a release store and read with acquire */
+static iso_cpu_cache_zone _cpu_cache_zones[MAX_ZONES];
+static int32_t _cpu_cache_zone_count;
+
+#if RSEQ_CPU_ID
+INTERNAL_HIDDEN INLINE void *_thread_pointer(void) {
+#if __x86_64__
+    void *tp;
+    __asm__("mov %%fs:0, %0"
+            : "=r"(tp));
+    return tp;
+#else
+    return __builtin_thread_pointer();
+#endif
+}
+#endif
+
+INTERNAL_HIDDEN INLINE uint32_t _iso_current_cpu(void) {
+    uint32_t cpu = 0;
+
+#if RSEQ_CPU_ID
+    if(LIKELY(__rseq_size != 0)) {
+        struct rseq *rs = (struct rseq *) (_thread_pointer() + __rseq_offset);
+        cpu = __atomic_load_n(&rs->cpu_id, __ATOMIC_RELAXED);
+    } else {
+        cpu = sched_getcpu();
+    }
+#else
+    cpu = sched_getcpu();
+#endif
+
+    /* sched_getcpu() returns -1 on failure and the rseq
+     * cpu_id field is negative until it is registered */
+    if(UNLIKELY(cpu >= _cpu_cache_count)) {
+        cpu = (cpu == UINT32_MAX) ? 0 : (cpu % _cpu_cache_count);
+    }
+
+    return cpu;
+}
+
+/* Each per-CPU cache holds one stack per power of 2 size
+ * class between SMALLEST_ZONE and MAX_DEFAULT_ZONE_SZ */
+INTERNAL_HIDDEN INLINE int32_t _iso_cpu_cache_class(size_t size) {
+    if(size <= SMALLEST_ZONE) {
+        return (__builtin_ctzll(SMALLEST_ZONE) - PER_CPU_CACHE_MIN_SHIFT);
+    }
+
+    return ((BITS_PER_QWORD - __builtin_clzll(size - 1)) - PER_CPU_CACHE_MIN_SHIFT);
+}
+
+/* Cached chunks are still marked in use in their zone
+ * bitmap. This tag is written to the first qword of a
+ * chunk while it sits in a cache so we can detect a
+ * double free, or a write after free, of a cached chunk */
+INTERNAL_HIDDEN INLINE uint64_t _iso_cpu_cache_tag(void *p) {
+    return (_cpu_cache_secret ^ (uint64_t) p);
+}
+
+INTERNAL_HIDDEN void _iso_cpu_cache_init(void) {
+    if(_cpu_caches != NULL) {
+        return;
+    }
+
+    _cpu_cache_count = sysconf(_SC_NPROCESSORS_CONF);
+
+    if(_cpu_cache_count == 0 || _cpu_cache_count > MAX_CPU_CACHES) {
+        _cpu_cache_count = MAX_CPU_CACHES;
+    }
+
+    _cpu_cache_secret = rand_uint64();
+    _cpu_caches = (iso_cpu_cache *) mmap_rw_pages(sizeof(iso_cpu_cache) * _cpu_cache_count, false);
+}
+
+/* Pop a chunk from the current CPU's cache. This does
+ * not require the root lock. Returns NULL if the cache
+ * for this size class is empty */
+INTERNAL_HIDDEN void *_iso_cpu_cache_alloc(size_t size) {
+    if(UNLIKELY(_cpu_caches == NULL)) {
+        return NULL;
+    }
+
+    int32_t sc = _iso_cpu_cache_class(size);
+    iso_cpu_cache *cc = &_cpu_caches[_iso_current_cpu()];
+    void *p = NULL;
+
+    LOCK_CPU_CACHE(cc);
+
+    if(cc->count[sc] != 0) {
+        cc->count[sc]--;
+        p = cc->chunks[sc][cc->count[sc]];
+        cc->chunks[sc][cc->count[sc]] = NULL;
+    }
+
+    UNLOCK_CPU_CACHE(cc);
+
+    if(p == NULL) {
+        return NULL;
+    }
+
+    if(UNLIKELY(*(uint64_t *) p != _iso_cpu_cache_tag(p))) {
+        LOG_AND_ABORT("Chunk at 0x%p in CPU cache has been modified after it was free'd", p);
+    }
+
+    memset(p, 0x0, sizeof(uint64_t));
+
+    STATS_ATOMIC_ADD(cpu_cache_allocs[sc], 1);
+    STATS_ATOMIC_ADD(cpu_cache_bytes, (1UL << (sc + PER_CPU_CACHE_MIN_SHIFT)));
+    return p;
+}
+
+/* Stops the free path from finding a zone that is about
+ * to be unmapped or retired. The caller must hold the
+ * root lock */
+INTERNAL_HIDDEN void _iso_cpu_cache_zone_remove(iso_alloc_zone *zone) {
+    __atomic_store_n(&_cpu_cache_zones[zone->index].user_pages_start, 0, __ATOMIC_RELEASE);
+}
+
+/* Records whether the chunks of a zone can be cached and
+ * where its pages are. Called whenever a zone is set up
+ * or unmapped. The caller must hold the root lock and
+ * have unmasked the zone pointers */
+INTERNAL_HIDDEN void _iso_cpu_cache_zone_update(iso_alloc_zone *zone) {
+    iso_cpu_cache_zone *cz = &_cpu_cache_zones[zone->index];
+
+    /* Readers recheck user_pages_start after reading the
+     * rest of the entry so it is cleared first */
+    _iso_cpu_cache_zone_remove(zone);
+
+    /* Only zones whose chunk size exactly matches a size
+     * class can serve allocations from the cache */
+    if(zone->internally_managed == false || zone->user_pages_start == NULL ||
+       zone->chunk_size > MAX_DEFAULT_ZONE_SZ || (zone->chunk_size & (zone->chunk_size - 1)) != 0) {
+        return;
+    }
+
+    __atomic_store_n(&cz->bitmap_start, (uintptr_t) zone->bitmap_start ^ _cpu_cache_secret, __ATOMIC_RELAXED);
+    __atomic_store_n(&cz->chunk_size, zone->chunk_size, __ATOMIC_RELAXED);
+    __atomic_store_n(&cz->user_pages_start, (uintptr_t) zone->user_pages_start ^ _cpu_cache_secret, __ATOMIC_RELEASE);
+
+    if(zone->index >= _cpu_cache_zone_count) {
+        __atomic_store_n(&_cpu_cache_zone_count, zone->index + 1, __ATOMIC_RELEASE);
+    }
+}
+
+/* Finds the cacheable zone holding p without the root
+ * lock. Returns false if there isn't one */
+INTERNAL_HIDDEN INLINE bool _iso_cpu_cache_zone(void *p, iso_cpu_cache_zone *out) {
+    int32_t count = __atomic_load_n(&_cpu_cache_zone_count, __ATOMIC_ACQUIRE);
+
+    for(int32_t i = 0; i < count; i++) {
+        iso_cpu_cache_zone *cz = &_cpu_cache_zones[i];
+        uintptr_t start = __atomic_load_n(&cz->user_pages_start, __ATOMIC_ACQUIRE);
+
+        if(start == 0) {
+            continue;
+        }
+
+        start ^= _cpu_cache_secret;
+
+        if((uintptr_t) p < start || (uintptr_t) p >= (start + ZONE_USER_SIZE)) {
+            continue;
+        }
+
+        out->bitmap_start = __atomic_load_n(&cz->bitmap_start, __ATOMIC_RELAXED) ^ _cpu_cache_secret;
+        out->chunk_size = __atomic_load_n(&cz->chunk_size, __ATOMIC_RELAXED);
+        out->user_pages_start = start;
+
+        /* Make sure the entry didn't change while we read it */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if(__atomic_load_n(&cz->user_pages_start, __ATOMIC_RELAXED) != (start ^ _cpu_cache_secret)) {
+            return false;
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+/* Push a chunk onto the current CPU's cache instead of
+ * returning it to its zone. This does not require the
+ * root lock. Returns false if the chunk must take the
+ * normal free path, which checks it again under the lock.
+ *
+ * The canaries of the neighbouring chunks are not checked
+ * here. Another thread may be freeing a neighbour under
+ * the root lock and its bitmap and canary can't be read
+ * consistently without that lock. They are checked when
+ * the chunk leaves the cache through its zone */
+INTERNAL_HIDDEN bool _iso_cpu_cache_free(void *p, bool permanent) {
+    iso_cpu_cache_zone cz;
+
+    if(_cpu_caches == NULL || _iso_cpu_cache_zone(p, &cz) == false) {
+        return false;
+    }
+
+    /* Let iso_free_chunk_from_zone deal with bad pointers */
+    uint64_t chunk_offset = (uint64_t) ((uintptr_t) p - cz.user_pages_start);
+
+    if(IS_ALIGNED((uintptr_t) p) != 0 || (chunk_offset % cz.chunk_size) != 0) {
+        return false;
+    }
+
+    bit_slot_t bit_slot = ((chunk_offset / cz.chunk_size) << BITS_PER_CHUNK_SHIFT);
+    bitmap_index_t *bm = (bitmap_index_t *) cz.bitmap_start;
+    bitmap_index_t b = __atomic_load_n(&bm[bit_slot >> BITS_PER_QWORD_SHIFT], __ATOMIC_RELAXED);
+
+    if((GET_BIT(b, WHICH_BIT(bit_slot))) == 0) {
+        return false;
+    }
+
+    uint64_t tag = _iso_cpu_cache_tag(p);
+    uint64_t old = __atomic_load_n((uint64_t *) p, __ATOMIC_RELAXED);
+
+    if(UNLIKELY(old == tag)) {
+        LOG_AND_ABORT("Double free of chunk 0x%p detected from CPU cache", p);
+    }
+
+    if(permanent == true) {
+        return false;
+    }
+
+    int32_t sc = _iso_cpu_cache_class(cz.chunk_size);
+    iso_cpu_cache *cc = &_cpu_caches[_iso_current_cpu()];
+
+    LOCK_CPU_CACHE(cc);
+
+    if(cc->count[sc] >= PER_CPU_CACHE_SZ) {
+        UNLOCK_CPU_CACHE(cc);
+        return false;
+    }
+
+    /* Without the root lock two threads can free the same
+     * chunk at once. Only one of them can write the tag */
+    if(UNLIKELY(__atomic_compare_exchange_n((uint64_t *) p, &old, tag, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED) == false)) {
+        UNLOCK_CPU_CACHE(cc);
+        LOG_AND_ABORT("Double free of chunk 0x%p detected from CPU cache", p);
+    }
+
+#if SANITIZE_CHUNKS
+    iso_clear_user_chunk(p + sizeof(uint64_t), cz.chunk_size - sizeof(uint64_t));
+#endif
+
+    cc->chunks[sc][cc->count[sc]] = p;
+    cc->count[sc]++;
+
+    UNLOCK_CPU_CACHE(cc);
+
+    STATS_ATOMIC_ADD(cpu_cache_frees[STATS_SIZE_CLASS(cz.chunk_size)], 1);
+    STATS_ATOMIC_SUB(cpu_cache_bytes, cz.chunk_size);
+    return true;
+}
+
+/* Return every cached chunk to its zone. This is used
+ * before walking zone bitmaps so that cached chunks are
+ * not reported as leaks. The caller must hold the root lock */
+INTERNAL_HIDDEN void _iso_cpu_cache_flush(void) {
+    if(_cpu_caches == NULL) {
+        return;
+    }
+
+    for(uint32_t i = 0; i < _cpu_cache_count; i++) {
+        iso_cpu_cache *cc = &_cpu_caches[i];
+
+        LOCK_CPU_CACHE(cc);
+
+        for(int32_t sc = 0; sc < PER_CPU_CACHE_CLASSES; sc++) {
+            while(cc->count[sc] != 0) {
+                cc->count[sc]--;
+                void *p = cc->chunks[sc][cc->count[sc]];
+                cc->chunks[sc][cc->count[sc]] = NULL;
+
+                iso_alloc_zone *zone = iso_find_zone_range(p);
+
+                if(UNLIKELY(zone == NULL)) {
+                    LOG_AND_ABORT("Could not find zone for CPU cached chunk 0x%p", p);
+                }
+
+                UNMASK_ZONE_PTRS(zone);
+                memset(p, 0x0, sizeof(uint64_t));
+                iso_free_chunk_from_zone(zone, p, false);
+                MASK_ZONE_PTRS(zone);
+            }
+        }
+
+        UNLOCK_CPU_CACHE(cc);
+    }
+}
+#endif
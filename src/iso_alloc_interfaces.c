@@ -12,6 +12,10 @@ EXTERNAL_API void *iso_calloc(size_t nmemb, size_t size) {
     return _iso_calloc(nmemb, size);
 }
 
+EXTERNAL_API void *iso_alloc_near(void *hint, size_t size) {
+    return _iso_alloc_near(hint, size);
+}
+
 EXTERNAL_API void iso_free(void *p) {
     _iso_free(p, false);
     return;
@@ -132,12 +136,71 @@ EXTERNAL_API void iso_alloc_destroy_zone(iso_alloc_zone_handle *zone) {
     return;
 }
 
+EXTERNAL_API void iso_alloc_zone_reset(iso_alloc_zone_handle *zone, uint32_t flags) {
+    if(zone == NULL) {
+        return;
+    }
+
+    zone = (iso_alloc_zone_handle *) ((uintptr_t) zone ^ (uintptr_t) _root->zone_handle_mask);
+    _iso_alloc_zone_reset(zone, (flags & ISO_ZONE_RESET_RELEASE) != 0);
+}
+
 EXTERNAL_API iso_alloc_zone_handle *iso_alloc_new_zone(size_t size) {
     iso_alloc_zone_handle *zone = (iso_alloc_zone_handle *) iso_new_zone(size, false);
+
+    if(zone == NULL) {
+        return NULL;
+    }
+
     zone = (iso_alloc_zone_handle *) ((uintptr_t) zone ^ (uintptr_t) _root->zone_handle_mask);
     return zone;
 }
 
+EXTERNAL_API iso_alloc_zone_handle *iso_alloc_new_zone_with_config(size_t size, const iso_alloc_zone_configuration *config) {
+    if(config == NULL) {
+        return iso_alloc_new_zone(size);
+    }
+
+    uint8_t flags = 0;
+
+    if(config->random_allocation_pattern == true) {
+        flags |= ZONE_RANDOM_ALLOCATION_PATTERN;
+    }
+
+    if(config->adjacent_canary_verification_on_alloc == true) {
+        flags |= ZONE_CANARY_CHECK_ON_ALLOC;
+    }
+
+    if(config->adjacent_canary_verification_on_free == true) {
+        flags |= ZONE_CANARY_CHECK_ON_FREE;
+    }
+
+    if(config->clear_chunk_on_free == true) {
+        flags |= ZONE_CLEAR_CHUNK_ON_FREE;
+    }
+
+    if(config->double_free_detection == true) {
+        flags |= ZONE_DOUBLE_FREE_DETECTION;
+    }
+
+    iso_alloc_zone_handle *zone = (iso_alloc_zone_handle *) iso_new_zone_with_config(size, false, flags);
+
+    if(zone == NULL) {
+        return NULL;
+    }
+
+    zone = (iso_alloc_zone_handle *) ((uintptr_t) zone ^ (uintptr_t) _root->zone_handle_mask);
+    return zone;
+}
+
+EXTERNAL_API int32_t iso_alloc_reserve(size_t size, size_t count) {
+    return _iso_alloc_reserve(size, count);
+}
+
+EXTERNAL_API int32_t iso_alloc_set_watermark(size_t size, size_t free_chunks) {
+    return _iso_alloc_set_watermark(size, free_chunks);
+}
+
 EXTERNAL_API void iso_alloc_protect_root() {
     _iso_alloc_protect_root();
 }
@@ -190,6 +253,47 @@ EXTERNAL_API void iso_verify_zone(iso_alloc_zone_handle *zone) {
     return;
 }
 
+EXTERNAL_API int32_t iso_alloc_get_stats(struct iso_alloc_stats *stats) {
+    return _iso_alloc_get_stats(stats);
+}
+
+EXTERNAL_API iso_cache_handle *iso_cache_create(size_t size, iso_cache_ctor ctor, iso_cache_dtor dtor) {
+    iso_object_cache *cache = _iso_cache_create(size, ctor, dtor);
+
+    if(cache == NULL) {
+        return NULL;
+    }
+
+    return (iso_cache_handle *) ((uintptr_t) cache ^ (uintptr_t) _root->zone_handle_mask);
+}
+
+EXTERNAL_API void *iso_cache_alloc(iso_cache_handle *cache) {
+    if(cache == NULL) {
+        return NULL;
+    }
+
+    cache = (iso_cache_handle *) ((uintptr_t) cache ^ (uintptr_t) _root->zone_handle_mask);
+    return _iso_cache_alloc(cache);
+}
+
+EXTERNAL_API void iso_cache_free(iso_cache_handle *cache, void *p) {
+    if(cache == NULL) {
+        return;
+    }
+
+    cache = (iso_cache_handle *) ((uintptr_t) cache ^ (uintptr_t) _root->zone_handle_mask);
+    _iso_cache_free(cache, p);
+}
+
+EXTERNAL_API void iso_cache_destroy(iso_cache_handle *cache) {
+    if(cache == NULL) {
+        return;
+    }
+
+    cache = (iso_cache_handle *) ((uintptr_t) cache ^ (uintptr_t) _root->zone_handle_mask);
+    _iso_cache_destroy(cache);
+}
+
 #if EXPERIMENTAL
 EXTERNAL_API void iso_alloc_search_stack(void *p) {
     _iso_alloc_search_stack(p);
@@ -0,0 +1,196 @@
+/* iso_alloc_layout.c - A secure memory allocator
+ * Copyright 2021 - chris.rohlf@gmail.com */
+
+#include "iso_alloc_internal.h"
+
+#if RUNTIME_ZONE_LAYOUT
+#include <fcntl.h>
+
+/* A layout changes which chunks serve which sizes and
+ * names a file for us to read, so it is ignored when the
+ * program runs setuid or setgid */
+#if __GLIBC__
+#define LAYOUT_GETENV(name) secure_getenv(name)
+#else
+#define LAYOUT_GETENV(name) ((getuid() == geteuid() && getgid() == getegid()) ? getenv(name) : NULL)
+#endif
+
+/* This runs before any zones exist so it can't call
+ * malloc. The layout file is read into this buffer */
+static char _zone_layout_buf[ZONE_LAYOUT_MAX_FILE_SZ + 1];
+
+INTERNAL_HIDDEN INLINE bool _is_layout_separator(char c) {
+    return (c == ',' || c == ' ' || c == '\t' || c == '\n' || c == '\r');
+}
+
+/* Parses a single size:count[:prepopulate] entry and
+ * appends count zones of that size to the layout */
+INTERNAL_HIDDEN uint32_t _parse_zone_layout_entry(const char *entry, iso_zone_layout_entry *layout, uint32_t count) {
+    char *end = NULL;
+    uint64_t size = strtoull(entry, &end, 10);
+    uint64_t zones = 1;
+    bool prepopulate = false;
+
+    if(end == entry || size == 0 || size > SMALL_SZ_MAX) {
+        LOG_AND_ABORT("Invalid zone size in zone layout entry '%s'", entry);
+    }
+
+    if(*end == ':') {
+        entry = end + 1;
+        zones = strtoull(entry, &end, 10);
+
+        if(end == entry || zones == 0) {
+            LOG_AND_ABORT("Invalid zone count in zone layout entry '%s'", entry);
+        }
+    }
+
+    if(*end == ':') {
+        end++;
+
+        if(*end == 'y' || *end == 'Y' || *end == '1') {
+            prepopulate = true;
+        } else if(*end != 'n' && *end != 'N' && *end != '0') {
+            LOG_AND_ABORT("Invalid prepopulate value in zone layout entry '%s'", entry);
+        }
+    }
+
+    if(count + zones > MAX_DEFAULT_ZONES) {
+        LOG_AND_ABORT("Zone layout has more than %d zones", MAX_DEFAULT_ZONES);
+    }
+
+    for(uint64_t i = 0; i < zones; i++) {
+        layout[count].size = size;
+        layout[count].prepopulate = prepopulate;
+        count++;
+    }
+
+    return count;
+}
+
+/* Splits a layout string into entries. The string is
+ * modified in place */
+INTERNAL_HIDDEN uint32_t _parse_zone_layout(char *str, iso_zone_layout_entry *layout) {
+    uint32_t count = 0;
+
+    while(*str != '\0') {
+        if(_is_layout_separator(*str) == true) {
+            str++;
+            continue;
+        }
+
+        if(*str == '#') {
+            while(*str != '\0' && *str != '\n') {
+                str++;
+            }
+
+            continue;
+        }
+
+        char *entry = str;
+
+        while(*str != '\0' && *str != '#' && _is_layout_separator(*str) == false) {
+            str++;
+        }
+
+        /* Terminate the entry unless it ends the string or
+         * is followed by a comment we still need to skip */
+        if(*str != '\0' && *str != '#') {
+            *str = '\0';
+            str++;
+        } else if(*str == '#') {
+            *str = '\0';
+            str++;
+
+            while(*str != '\0' && *str != '\n') {
+                str++;
+            }
+        }
+
+        count = _parse_zone_layout_entry(entry, layout, count);
+    }
+
+    return count;
+}
+
+/* Reads the zone layout from the environment or from
+ * the file it names and returns the number of zones in
+ * it sorted by size. Returns 0 if neither is set */
+INTERNAL_HIDDEN uint32_t _iso_alloc_load_zone_layout(iso_zone_layout_entry *layout) {
+    char *env = LAYOUT_GETENV(ZONE_LAYOUT_ENV_STR);
+    uint32_t count = 0;
+
+    if(env != NULL) {
+        size_t len = strlen(env);
+
+        if(len > ZONE_LAYOUT_MAX_FILE_SZ) {
+            LOG_AND_ABORT("%s is longer than %d bytes", ZONE_LAYOUT_ENV_STR, ZONE_LAYOUT_MAX_FILE_SZ);
+        }
+
+        /* The environment must not be modified */
+        memcpy(_zone_layout_buf, env, len);
+        _zone_layout_buf[len] = '\0';
+    } else if((env = LAYOUT_GETENV(ZONE_LAYOUT_FILE_ENV_STR)) != NULL) {
+        int32_t fd = open(env, O_RDONLY | O_CLOEXEC);
+        ssize_t len = 0;
+
+        if(fd == ERR) {
+            LOG_AND_ABORT("Cannot open zone layout file %s", env);
+        }
+
+        len = read(fd, _zone_layout_buf, ZONE_LAYOUT_MAX_FILE_SZ + 1);
+        close(fd);
+
+        if(len < 0 || len > ZONE_LAYOUT_MAX_FILE_SZ) {
+            LOG_AND_ABORT("Cannot read zone layout file %s, the limit is %d bytes", env, ZONE_LAYOUT_MAX_FILE_SZ);
+        }
+
+        _zone_layout_buf[len] = '\0';
+    } else {
+        return 0;
+    }
+
+    count = _parse_zone_layout(_zone_layout_buf, layout);
+
+    if(count == 0) {
+        LOG_AND_ABORT("The zone layout doesn't contain any zones");
+    }
+
+    /* The smallest size classes always get a zone. Otherwise
+     * a small chunk is served from a much larger one and an
+     * overflow of it can stay inside its own chunk */
+    for(uint32_t size = SMALLEST_ZONE; size <= ZONE_LAYOUT_BASELINE_MAX; size <<= 1) {
+        uint32_t i = 0;
+
+        while(i < count && layout[i].size != size) {
+            i++;
+        }
+
+        if(i < count) {
+            continue;
+        }
+
+        if(count == MAX_DEFAULT_ZONES) {
+            LOG_AND_ABORT("Zone layout has more than %d zones", MAX_DEFAULT_ZONES);
+        }
+
+        layout[count].size = size;
+        layout[count].prepopulate = false;
+        count++;
+    }
+
+    /* Insertion sort, there are at most MAX_DEFAULT_ZONES */
+    for(uint32_t i = 1; i < count; i++) {
+        iso_zone_layout_entry e = layout[i];
+        int32_t j = i - 1;
+
+        while(j >= 0 && layout[j].size > e.size) {
+            layout[j + 1] = layout[j];
+            j--;
+        }
+
+        layout[j + 1] = e;
+    }
+
+    return count;
+}
+#endif
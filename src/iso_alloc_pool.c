@@ -0,0 +1,137 @@
+/* iso_alloc_pool.c - A secure memory allocator
+ * Copyright 2021 - chris.rohlf@gmail.com */
+
+#include "iso_alloc_internal.h"
+
+#if ZONE_POOL
+/* Mapping, guarding and faulting in the pages of a new
+ * zone is most of what it costs to create one. The pool
+ * thread does that work ahead of time, without the root
+ * lock, so the allocation that needs a new zone only has
+ * to write its canaries and fill its free slot cache */
+static iso_zone_pool_entry _zone_pool[ZONE_POOL_SZ];
+static uint32_t _zone_pool_count;
+static atomic_flag _zone_pool_flag;
+static pthread_t _zone_pool_thread;
+static int32_t _zone_pool_pipe[2] = {ERR, ERR};
+
+#define LOCK_ZONE_POOL()                                   \
+    while(atomic_flag_test_and_set(&_zone_pool_flag)) { \
+    }
+
+#define UNLOCK_ZONE_POOL() \
+    atomic_flag_clear(&_zone_pool_flag);
+
+/* Only this thread adds to the pool. It goes to sleep
+ * once the pool is full and a claim wakes it up again */
+static void *_zone_pool_thread_handler(void *unused) {
+    struct pollfd pfd;
+
+    pfd.fd = _zone_pool_pipe[0];
+    pfd.events = POLLIN;
+
+    while(true) {
+        LOCK_ZONE_POOL();
+        uint32_t count = _zone_pool_count;
+        UNLOCK_ZONE_POOL();
+
+        if(count < ZONE_POOL_SZ) {
+            iso_zone_pool_entry entry;
+            _iso_map_zone_pages(ZONE_MAX_BITMAP_SIZE, &entry.bitmap_start, &entry.user_pages_start);
+
+            _iso_populate_pages(entry.bitmap_start, ZONE_MAX_BITMAP_SIZE);
+            _iso_populate_pages(entry.user_pages_start, ZONE_USER_SIZE);
+
+            LOCK_ZONE_POOL();
+            _zone_pool[_zone_pool_count] = entry;
+            _zone_pool_count++;
+            UNLOCK_ZONE_POOL();
+            continue;
+        }
+
+        if(poll(&pfd, 1, -1) == ERR) {
+            if(errno == EINTR) {
+                continue;
+            }
+
+            LOG_AND_ABORT("Cannot poll the zone pool pipe");
+        }
+
+        _iso_wake_pipe_drain(pfd.fd);
+    }
+
+    return NULL;
+}
+
+INTERNAL_HIDDEN void _iso_zone_pool_init(void) {
+    if(_iso_wake_pipe_create(_zone_pool_pipe) == ERR) {
+        LOG_AND_ABORT("Cannot create the zone pool pipe");
+    }
+
+    if(pthread_create(&_zone_pool_thread, NULL, _zone_pool_thread_handler, NULL) != OK) {
+        LOG_AND_ABORT("Cannot create the zone pool thread");
+    }
+
+    pthread_detach(_zone_pool_thread);
+}
+
+/* Gives the zone the pages of a pooled zone. The bitmap
+ * is kept at the end of the pooled bitmap pages so it
+ * stays next to the guard page above it. Pages below it
+ * that a zone with larger chunks doesn't need are unmapped
+ * and the page right below it becomes the guard page. A
+ * bitmap that can be packed gives up all of the pages */
+INTERNAL_HIDDEN bool _iso_zone_pool_claim(iso_alloc_zone *zone) {
+    LOCK_ZONE_POOL();
+
+    if(_zone_pool_count == 0) {
+        UNLOCK_ZONE_POOL();
+        return false;
+    }
+
+    _zone_pool_count--;
+    iso_zone_pool_entry entry = _zone_pool[_zone_pool_count];
+    UNLOCK_ZONE_POOL();
+
+    size_t pool_bitmap_pages = ROUND_UP_PAGE(ZONE_MAX_BITMAP_SIZE);
+    size_t bitmap_pages = ROUND_UP_PAGE(zone->bitmap_size);
+    void *bitmap_start = NULL;
+
+#if PACKED_BITMAPS
+    bitmap_start = _iso_bitmap_arena_alloc(zone->bitmap_size);
+
+    /* The pooled bitmap pages aren't needed at all */
+    if(bitmap_start != NULL) {
+#if ZONE_ARENA
+        mprotect_pages(entry.bitmap_start, pool_bitmap_pages, PROT_NONE);
+        madvise(entry.bitmap_start, pool_bitmap_pages, MADV_DONTNEED);
+#else
+        munmap(entry.bitmap_start - g_page_size, pool_bitmap_pages + (g_page_size << 1));
+#endif
+    }
+#endif
+
+    if(bitmap_start == NULL && pool_bitmap_pages > bitmap_pages) {
+        bitmap_start = entry.bitmap_start + (pool_bitmap_pages - bitmap_pages);
+#if ZONE_ARENA
+        /* The pages stay reserved in the arena as part of
+         * the guard region below the bitmap */
+        mprotect_pages(entry.bitmap_start, pool_bitmap_pages - bitmap_pages, PROT_NONE);
+        madvise(entry.bitmap_start, pool_bitmap_pages - bitmap_pages, MADV_DONTNEED);
+#else
+        munmap(entry.bitmap_start - g_page_size, pool_bitmap_pages - bitmap_pages);
+        create_guard_page(bitmap_start - g_page_size);
+#endif
+    } else if(bitmap_start == NULL) {
+        bitmap_start = entry.bitmap_start;
+    }
+
+    zone->bitmap_start = bitmap_start;
+    zone->user_pages_start = entry.user_pages_start;
+
+    _iso_wake_pipe_write(_zone_pool_pipe[1]);
+
+    STATS_INC(zone_pool_hits);
+    return true;
+}
+#endif
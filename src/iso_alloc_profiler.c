@@ -9,6 +9,11 @@ INTERNAL_HIDDEN uint64_t _iso_alloc_detect_leaks() {
 
     LOCK_ROOT();
 
+#if PER_CPU_CACHE
+    /* Chunks sitting in CPU caches are not leaks */
+    _iso_cpu_cache_flush();
+#endif
+
     for(uint32_t i = 0; i < _root->zones_used; i++) {
         iso_alloc_zone *zone = &_root->zones[i];
         total_leaks += _iso_alloc_zone_leak_detector(zone, false);
@@ -116,7 +121,8 @@ INTERNAL_HIDDEN uint64_t __iso_alloc_zone_mem_usage(iso_alloc_zone *zone) {
     uint64_t mem_usage = 0;
     mem_usage += zone->bitmap_size;
     mem_usage += ZONE_USER_SIZE;
-    LOG("Zone[%d] holds %d byte chunks. Total bytes (%lu), megabytes (%lu)", zone->index, zone->chunk_size, mem_usage, (mem_usage / MEGABYTE_SIZE));
+    LOG("Zone[%d] holds %d byte chunks. Total bytes (%lu), megabytes (%lu), chunks in use (%d)", zone->index, zone->chunk_size, mem_usage,
+        (mem_usage / MEGABYTE_SIZE), zone->chunks_in_use);
     return (mem_usage / MEGABYTE_SIZE);
 }
 
@@ -156,44 +162,321 @@ INTERNAL_HIDDEN uint64_t __iso_alloc_big_zone_mem_usage() {
     return (mem_usage / MEGABYTE_SIZE);
 }
 
-#if HEAP_PROFILER
-INTERNAL_HIDDEN INLINE uint64_t _get_backtrace_hash(uint32_t frames) {
-    uint64_t hash = 0;
+/* Reads the chunk counters of every zone and walks the
+ * big zone list to build a snapshot of in use and free
+ * memory. Chunks
+ * sitting in a per-CPU cache are returned to their
+ * zone first so they are reported as free */
+INTERNAL_HIDDEN void _iso_alloc_heap_usage(iso_alloc_heap_usage *usage) {
+    memset(usage, 0x0, sizeof(iso_alloc_heap_usage));
+
+    LOCK_ROOT();
+
+#if PER_CPU_CACHE
+    _iso_cpu_cache_flush();
+#endif
+
+    for(uint32_t i = 0; i < _root->zones_used; i++) {
+        iso_alloc_zone *zone = &_root->zones[i];
+
+        if(zone->user_pages_start == NULL) {
+            continue;
+        }
 
-    hash ^= (uint64_t) __builtin_return_address(0);
+        uint64_t free_chunks = GET_FREE_CHUNK_COUNT(zone);
+        uint32_t c = HEAP_USAGE_CLASS(zone->chunk_size);
 
-    if(frames >= 1) {
-        hash ^= (uint64_t) __builtin_return_address(1);
+        usage->zone_bytes += ZONE_USER_SIZE;
+        usage->zone_in_use_bytes += ((uint64_t) zone->chunks_in_use * zone->chunk_size);
+        usage->zone_free_bytes += (free_chunks * zone->chunk_size);
+        usage->zone_free_chunks += free_chunks;
+        usage->canary_bytes += ((uint64_t) zone->chunks_canary * zone->chunk_size);
+        usage->free_chunks[c] += free_chunks;
+        usage->free_chunk_bytes[c] += (free_chunks * zone->chunk_size);
     }
 
-    if(frames >= 2) {
-        hash ^= (uint64_t) __builtin_return_address(2);
+    LOCK_BIG_ZONE();
+
+    iso_alloc_big_zone *big = _root->big_zone_head;
+
+    if(big != NULL) {
+        big = UNMASK_BIG_ZONE_NEXT(_root->big_zone_head);
     }
 
-    if(frames >= 3) {
-        hash ^= (uint64_t) __builtin_return_address(3);
+    while(big != NULL) {
+        _verify_big_zone(big);
+
+        usage->big_zones++;
+        usage->big_zone_bytes += big->size;
+
+        if(big->free == true) {
+            usage->big_free_zones++;
+        } else {
+            usage->big_in_use_bytes += big->size;
+        }
+
+        if(big->next != NULL) {
+            big = UNMASK_BIG_ZONE_NEXT(big->next);
+        } else {
+            big = NULL;
+        }
     }
 
-    if(frames >= 4) {
-        hash ^= (uint64_t) __builtin_return_address(4);
+    UNLOCK_BIG_ZONE();
+    UNLOCK_ROOT();
+}
+
+#if HEAP_PROFILER
+uint64_t _allocation_count;
+uint64_t _sampled_count;
+uint64_t _profiler_size_samples[PROFILER_SIZE_CLASSES];
+
+int32_t profiler_fd;
+
+zone_profiler_map_t _zone_profiler_map[SMALL_SZ_MAX];
+
+iso_profiler_stack *_profiler_stacks;
+iso_profiler_live_sample *_profiler_live;
+uint32_t _profiler_stack_count;
+uint32_t _profiler_live_count;
+uint64_t _profiler_dropped;
+
+static __thread iso_profiler_thread_state _profiler_thread;
+
+#if THREAD_SUPPORT
+static pthread_key_t _profiler_thread_key;
+static pthread_once_t _profiler_thread_key_once = PTHREAD_ONCE_INIT;
+#endif
+
+/* Set when the profiler data file is a stream of
+ * binary snapshots rather than the text format */
+static bool _profiler_snapshots;
+static uint8_t *_profiler_snapshot_buf;
+
+#if THREAD_SUPPORT
+static pthread_t _profiler_snapshot_thread;
+static int32_t _profiler_interval;
+static int32_t _profiler_signal_pipe[2] = {ERR, ERR};
+#endif
+
+/* Walk the frame pointer chain starting at our caller.
+ * Each frame holds the callers frame pointer followed
+ * by the return address. The walk stops at the first
+ * frame pointer that doesn't move up the stack or is
+ * not aligned, which is what we see when we reach code
+ * built without frame pointers */
+__attribute__((noinline)) INTERNAL_HIDDEN uint32_t _iso_alloc_profile_backtrace(void **frames, uint32_t max, uint32_t skip) {
+    void **fp = (void **) __builtin_frame_address(0);
+    uint32_t depth = 0;
+
+    while(fp != NULL && depth < max) {
+        void *ret = fp[1];
+        void **next = (void **) fp[0];
+
+        if(ret == NULL) {
+            break;
+        }
+
+        if(skip != 0) {
+            skip--;
+        } else {
+            frames[depth++] = ret;
+        }
+
+        if(next <= fp || ((uintptr_t) next & (sizeof(void *) - 1)) != 0 ||
+           ((uintptr_t) next - (uintptr_t) fp) > PROFILER_MAX_FRAME_SIZE) {
+            break;
+        }
+
+        fp = next;
+    }
+
+    return depth;
+}
+
+INTERNAL_HIDDEN INLINE uint64_t _iso_alloc_profile_stack_hash(void **frames, uint32_t depth) {
+    uint64_t hash = 0xcbf29ce484222325;
+
+    for(uint32_t i = 0; i < depth; i++) {
+        hash ^= (uint64_t) frames[i];
+        hash *= 0x100000001b3;
     }
 
     return hash;
 }
 
-INTERNAL_HIDDEN void _iso_alloc_profile() {
-    _allocation_count++;
+/* Find the stack table entry for this stack or claim
+ * an empty one. The table is open addressed and never
+ * shrinks. Returns -1 if the table is full. The caller
+ * must hold the root lock */
+INTERNAL_HIDDEN int32_t _iso_alloc_profile_find_stack(void **frames, uint32_t depth) {
+    uint64_t hash = _iso_alloc_profile_stack_hash(frames, depth);
+
+    for(uint32_t i = 0; i < PROFILER_STACK_TABLE_SZ; i++) {
+        uint32_t idx = (hash + i) & (PROFILER_STACK_TABLE_SZ - 1);
+        iso_profiler_stack *st = &_profiler_stacks[idx];
+
+        if(st->depth == 0) {
+            st->hash = hash;
+            st->depth = depth;
+            memcpy(st->frames, frames, depth * sizeof(void *));
+            _profiler_stack_count++;
+            return idx;
+        }
+
+        if(st->hash == hash && st->depth == depth && memcmp(st->frames, frames, depth * sizeof(void *)) == 0) {
+            return idx;
+        }
+    }
+
+    return ERR;
+}
+
+#define LIVE_SAMPLE_IDX(p) \
+    ((((uint64_t) (p) >> 4) * 0x9e3779b97f4a7c15) >> (BITS_PER_QWORD - __builtin_ctz(PROFILER_LIVE_SAMPLES)))
+
+/* A fast approximation of log2(q) for q >= 1. The
+ * integer part comes from the position of the highest
+ * set bit and the fractional part from a polynomial
+ * fit of log2(1 + t) on [0, 1). The error is below
+ * 0.0002 which is plenty for picking sample intervals
+ * and means we don't need to link against libm */
+INTERNAL_HIDDEN INLINE double _fast_log2(uint64_t q) {
+    int32_t e = (BITS_PER_QWORD - 1) - __builtin_clzll(q);
+    double t = (double) (q - (1ULL << e)) / (double) (1ULL << e);
+    return e + t * (1.4385467915 + t * (-0.6780814858 + t * (0.3236303682 + t * -0.0842850926)));
+}
+
+/* xorshift64* is more than good enough for choosing
+ * sample intervals and avoids a getrandom syscall */
+INTERNAL_HIDDEN INLINE uint64_t _profiler_rand(iso_profiler_thread_state *t) {
+    t->rng ^= t->rng >> 12;
+    t->rng ^= t->rng << 25;
+    t->rng ^= t->rng >> 27;
+    return t->rng * 0x2545f4914f6cdd1d;
+}
 
-    /* Don't run the profiler on every allocation */
-    if(LIKELY((rand_uint64() % PROFILER_ODDS) != 1)) {
+/* Returns a number of bytes drawn from an exponential
+ * distribution with a mean of PROFILER_SAMPLE_RATE. We
+ * take PROFILER_RNG_BITS random bits as q and use
+ * -ln(q / 2^bits) = (bits - log2(q)) * ln(2) */
+INTERNAL_HIDDEN INLINE int64_t _next_sample_interval(iso_profiler_thread_state *t) {
+    uint64_t q = (_profiler_rand(t) >> (BITS_PER_QWORD - PROFILER_RNG_BITS)) + 1;
+    double interval = (PROFILER_RNG_BITS - _fast_log2(q)) * 0.6931471805599453 * PROFILER_SAMPLE_RATE;
+    return (int64_t) interval + 1;
+}
+
+/* Folds this threads counters into the global ones.
+ * The caller must hold the root lock */
+INTERNAL_HIDDEN void _iso_alloc_profile_merge_thread(void) {
+    _allocation_count += _profiler_thread.allocation_count;
+    _sampled_count += _profiler_thread.sampled_count;
+    _profiler_thread.allocation_count = 0;
+    _profiler_thread.sampled_count = 0;
+}
+
+#if THREAD_SUPPORT
+/* Called when a thread exits so that the allocations
+ * it made since its last sample are not lost */
+static void _profiler_thread_exit(void *arg) {
+    LOCK_ROOT();
+    _iso_alloc_profile_merge_thread();
+    UNLOCK_ROOT();
+}
+
+/* Threads can allocate before _initialize_profiler runs
+ * so whichever needs the key first creates it */
+static void _profiler_create_thread_key(void) {
+    if(pthread_key_create(&_profiler_thread_key, _profiler_thread_exit) != 0) {
+        LOG_AND_ABORT("Failed to create the profiler thread key");
+    }
+}
+#endif
+
+INTERNAL_HIDDEN void _profiler_thread_init(iso_profiler_thread_state *t) {
+    t->rng = rand_uint64() | 1;
+    t->bytes_until_sample = _next_sample_interval(t);
+    t->initialized = true;
+
+#if THREAD_SUPPORT
+    pthread_once(&_profiler_thread_key_once, _profiler_create_thread_key);
+    pthread_setspecific(_profiler_thread_key, t);
+#endif
+}
+
+/* Called for every allocation without holding any
+ * lock. In the common case this only decrements the
+ * calling threads countdown. Returns true when this
+ * allocation should be sampled */
+INTERNAL_HIDDEN bool _iso_alloc_profile(size_t size) {
+    iso_profiler_thread_state *t = &_profiler_thread;
+
+    t->allocation_count++;
+    t->bytes_until_sample -= size;
+
+    if(LIKELY(t->bytes_until_sample > 0)) {
+        return false;
+    }
+
+    if(UNLIKELY(t->initialized == false)) {
+        _profiler_thread_init(t);
+        return false;
+    }
+
+    t->sampled_count++;
+    t->bytes_until_sample = _next_sample_interval(t);
+    return true;
+}
+
+/* Records a sampled allocation against its call stack
+ * and takes a snapshot of zone usage */
+INTERNAL_HIDDEN void _iso_alloc_profile_sample(void *p, size_t size) {
+    void *frames[PROFILER_STACK_DEPTH];
+    uint32_t depth = _iso_alloc_profile_backtrace(frames, PROFILER_STACK_DEPTH, PROFILER_SKIP_FRAMES);
+
+    LOCK_ROOT();
+
+    _iso_alloc_profile_merge_thread();
+
+    if(UNLIKELY(_root == NULL || _profiler_stacks == NULL || p == NULL)) {
+        UNLOCK_ROOT();
         return;
     }
 
-    _sampled_count++;
+    _profiler_size_samples[PROFILER_SIZE_CLASS(size)]++;
+
+    int32_t stack = ERR;
+
+    if(depth != 0) {
+        stack = _iso_alloc_profile_find_stack(frames, depth);
+    }
+
+    if(stack != ERR) {
+        iso_profiler_stack *st = &_profiler_stacks[stack];
+        st->alloc_count++;
+        st->alloc_bytes += size;
+
+        /* Remember this chunk so its free can be attributed
+         * back to this stack. If the live table is full we
+         * count the allocation but not its lifetime */
+        if(_profiler_live_count < (PROFILER_LIVE_SAMPLES >> 1)) {
+            uint32_t idx = LIVE_SAMPLE_IDX(p);
+
+            while(_profiler_live[idx].p != NULL) {
+                idx = (idx + 1) & (PROFILER_LIVE_SAMPLES - 1);
+            }
+
+            _profiler_live[idx].p = p;
+            _profiler_live[idx].size = size;
+            _profiler_live[idx].stack = stack;
+            __atomic_store_n(&_profiler_live_count, _profiler_live_count + 1, __ATOMIC_RELAXED);
 
-    /* Set the byte in the table. This will be transformed
-     * into a histogram when we dump the data upon exit */
-    caller_hg[(_get_backtrace_hash(PROFILER_STACK_DEPTH) & HG_SIZE)]++;
+            st->in_use_count++;
+            st->in_use_bytes += size;
+        }
+    } else {
+        _profiler_dropped++;
+    }
 
     for(uint32_t i = 0; i < _root->zones_used; i++) {
         uint32_t used = 0;
@@ -207,15 +490,422 @@ INTERNAL_HIDDEN void _iso_alloc_profile() {
          * the differences between canary and leaked chunks.
          * So lets just use the full count */
         if(zone->is_full) {
-            used = GET_CHUNK_COUNT(zone);
+            used = 100;
         } else {
-            used = _iso_alloc_zone_leak_detector(zone, true);
+            used = (uint32_t) (((uint64_t) (zone->chunks_in_use + zone->chunks_was_used) * 100) / GET_CHUNK_COUNT(zone));
         }
 
         if(used > CHUNK_USAGE_THRESHOLD) {
             _zone_profiler_map[zone->chunk_size].count++;
         }
     }
+
+    UNLOCK_ROOT();
+}
+
+/* Called for every free. Unless a sampled chunk is live
+ * this is a single relaxed load */
+INTERNAL_HIDDEN void _iso_alloc_profile_free(void *p) {
+    if(LIKELY(__atomic_load_n(&_profiler_live_count, __ATOMIC_RELAXED) == 0)) {
+        return;
+    }
+
+    LOCK_ROOT();
+
+    uint32_t idx = LIVE_SAMPLE_IDX(p);
+
+    while(_profiler_live[idx].p != NULL && _profiler_live[idx].p != p) {
+        idx = (idx + 1) & (PROFILER_LIVE_SAMPLES - 1);
+    }
+
+    if(_profiler_live[idx].p == NULL) {
+        UNLOCK_ROOT();
+        return;
+    }
+
+    iso_profiler_stack *st = &_profiler_stacks[_profiler_live[idx].stack];
+    st->in_use_count--;
+    st->in_use_bytes -= _profiler_live[idx].size;
+
+    /* Backward shift deletion keeps every remaining entry
+     * reachable from its home slot without tombstones */
+    uint32_t hole = idx;
+
+    for(uint32_t j = (idx + 1) & (PROFILER_LIVE_SAMPLES - 1); _profiler_live[j].p != NULL; j = (j + 1) & (PROFILER_LIVE_SAMPLES - 1)) {
+        uint32_t home = LIVE_SAMPLE_IDX(_profiler_live[j].p);
+
+        /* Move the entry into the hole unless its home
+         * slot lies cyclically in (hole, j] */
+        if(((j - home) & (PROFILER_LIVE_SAMPLES - 1)) >= ((j - hole) & (PROFILER_LIVE_SAMPLES - 1))) {
+            _profiler_live[hole] = _profiler_live[j];
+            hole = j;
+        }
+    }
+
+    memset(&_profiler_live[hole], 0x0, sizeof(iso_profiler_live_sample));
+    __atomic_store_n(&_profiler_live_count, _profiler_live_count - 1, __ATOMIC_RELAXED);
+
+    UNLOCK_ROOT();
+}
+
+/* Writes all len bytes of p to fd. A write can be
+ * interrupted or cut short by a full disk or pipe. On
+ * any other error the rest of the data is dropped */
+INTERNAL_HIDDEN void _profiler_write(int32_t fd, const void *p, size_t len) {
+    const uint8_t *b = (const uint8_t *) p;
+
+    while(len != 0) {
+        ssize_t w = write(fd, b, len);
+
+        if(w <= 0) {
+            if(w < 0 && errno == EINTR) {
+                continue;
+            }
+
+            break;
+        }
+
+        b += w;
+        len -= w;
+    }
+}
+
+/* A small buffered writer so the profiles can be
+ * written without calling malloc or issuing one
+ * write per field */
+typedef struct {
+    int32_t fd;
+    size_t len;
+    char buf[4096];
+} profiler_writer;
+
+INTERNAL_HIDDEN void _pw_flush(profiler_writer *w) {
+    if(w->len != 0) {
+        _profiler_write(w->fd, w->buf, w->len);
+        w->len = 0;
+    }
+}
+
+INTERNAL_HIDDEN void _pw_str(profiler_writer *w, const char *str) {
+    size_t len = strlen(str);
+
+    if(w->len + len > sizeof(w->buf)) {
+        _pw_flush(w);
+    }
+
+    memcpy(&w->buf[w->len], str, len);
+    w->len += len;
+}
+
+INTERNAL_HIDDEN void _pw_num(profiler_writer *w, uint64_t n) {
+    _pw_str(w, (char *) _fmt(n, 10));
+}
+
+INTERNAL_HIDDEN void _pw_hex(profiler_writer *w, uint64_t n) {
+    _pw_str(w, "0x");
+    _pw_str(w, (char *) _fmt(n, 16));
+}
+
+/* Writes the stack table as a gperftools heap profile
+ * which pprof reads directly. The heap_v2 header tells
+ * pprof we sample by bytes with an exponential interval
+ * so it can scale sampled counts back up. The contents
+ * of /proc/self/maps are appended for symbolization */
+INTERNAL_HIDDEN void _iso_alloc_profiler_write_pprof(int32_t fd) {
+    profiler_writer w;
+    uint64_t in_use_count = 0, in_use_bytes = 0;
+    uint64_t alloc_count = 0, alloc_bytes = 0;
+
+    w.fd = fd;
+    w.len = 0;
+
+    for(uint32_t i = 0; i < PROFILER_STACK_TABLE_SZ; i++) {
+        in_use_count += _profiler_stacks[i].in_use_count;
+        in_use_bytes += _profiler_stacks[i].in_use_bytes;
+        alloc_count += _profiler_stacks[i].alloc_count;
+        alloc_bytes += _profiler_stacks[i].alloc_bytes;
+    }
+
+    _pw_str(&w, "heap profile: ");
+    _pw_num(&w, in_use_count);
+    _pw_str(&w, ": ");
+    _pw_num(&w, in_use_bytes);
+    _pw_str(&w, " [");
+    _pw_num(&w, alloc_count);
+    _pw_str(&w, ": ");
+    _pw_num(&w, alloc_bytes);
+    _pw_str(&w, "] @ heap_v2/");
+    _pw_num(&w, PROFILER_SAMPLE_RATE);
+    _pw_str(&w, "\n");
+
+    for(uint32_t i = 0; i < PROFILER_STACK_TABLE_SZ; i++) {
+        iso_profiler_stack *st = &_profiler_stacks[i];
+
+        if(st->depth == 0) {
+            continue;
+        }
+
+        _pw_num(&w, st->in_use_count);
+        _pw_str(&w, ": ");
+        _pw_num(&w, st->in_use_bytes);
+        _pw_str(&w, " [");
+        _pw_num(&w, st->alloc_count);
+        _pw_str(&w, ": ");
+        _pw_num(&w, st->alloc_bytes);
+        _pw_str(&w, "] @");
+
+        for(uint32_t j = 0; j < st->depth; j++) {
+            _pw_str(&w, " ");
+            _pw_hex(&w, (uint64_t) st->frames[j]);
+        }
+
+        _pw_str(&w, "\n");
+    }
+
+    _pw_str(&w, "\nMAPPED_LIBRARIES:\n");
+    _pw_flush(&w);
+
+    int32_t maps_fd = open("/proc/self/maps", O_RDONLY);
+
+    if(maps_fd != ERR) {
+        ssize_t r;
+
+        while((r = read(maps_fd, w.buf, sizeof(w.buf))) > 0 || (r == ERR && errno == EINTR)) {
+            if(r > 0) {
+                _profiler_write(fd, w.buf, r);
+            }
+        }
+
+        close(maps_fd);
+    }
+}
+
+/* Appends one binary snapshot of the profiler state
+ * to the profiler data file. The caller must hold the
+ * root lock */
+INTERNAL_HIDDEN void _iso_alloc_profiler_snapshot(uint32_t reason) {
+    if(profiler_fd == ERR || _profiler_snapshot_buf == NULL) {
+        return;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    iso_profiler_snapshot_hdr *hdr = (iso_profiler_snapshot_hdr *) _profiler_snapshot_buf;
+    iso_profiler_snapshot_zone *zones = (iso_profiler_snapshot_zone *) (_profiler_snapshot_buf + sizeof(iso_profiler_snapshot_hdr));
+
+    hdr->magic = PROFILER_SNAPSHOT_MAGIC;
+    hdr->version = PROFILER_SNAPSHOT_VERSION;
+    hdr->reason = reason;
+    hdr->timestamp = ((uint64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+    hdr->allocated = _allocation_count;
+    hdr->sampled = _sampled_count;
+    hdr->dropped = _profiler_dropped;
+    memcpy(hdr->size_samples, _profiler_size_samples, sizeof(hdr->size_samples));
+    hdr->zone_entries = 0;
+    hdr->stack_entries = 0;
+
+    /* There are only a handful of distinct chunk sizes
+     * so a linear search of the entries is cheap */
+    for(uint32_t i = 0; i < _root->zones_used; i++) {
+        iso_alloc_zone *zone = &_root->zones[i];
+        iso_profiler_snapshot_zone *entry = NULL;
+
+        if(zone->user_pages_start == NULL) {
+            continue;
+        }
+
+        for(uint32_t j = 0; j < hdr->zone_entries; j++) {
+            if(zones[j].chunk_size == zone->chunk_size) {
+                entry = &zones[j];
+                break;
+            }
+        }
+
+        if(entry == NULL) {
+            entry = &zones[hdr->zone_entries++];
+            entry->chunk_size = zone->chunk_size;
+            entry->zones = 0;
+            entry->chunks = 0;
+            entry->chunks_in_use = 0;
+            entry->full_samples = _zone_profiler_map[zone->chunk_size].count;
+        }
+
+        entry->zones++;
+        entry->chunks += GET_CHUNK_COUNT(zone);
+        entry->chunks_in_use += zone->chunks_in_use;
+    }
+
+    iso_profiler_snapshot_stack *stacks = (iso_profiler_snapshot_stack *) &zones[hdr->zone_entries];
+
+    for(uint32_t i = 0; i < PROFILER_STACK_TABLE_SZ; i++) {
+        iso_profiler_stack *st = &_profiler_stacks[i];
+
+        if(st->depth == 0) {
+            continue;
+        }
+
+        iso_profiler_snapshot_stack *entry = &stacks[hdr->stack_entries++];
+        entry->hash = st->hash;
+        entry->alloc_count = st->alloc_count;
+        entry->alloc_bytes = st->alloc_bytes;
+        entry->in_use_count = st->in_use_count;
+        entry->in_use_bytes = st->in_use_bytes;
+    }
+
+    size_t size = (uint8_t *) &stacks[hdr->stack_entries] - _profiler_snapshot_buf;
+    hdr->length = size - sizeof(hdr->length);
+
+    /* The file is opened with O_APPEND and snapshots are
+     * only written with the root lock held so a snapshot
+     * that takes more than one write stays in one piece */
+    _profiler_write(profiler_fd, _profiler_snapshot_buf, size);
+}
+
+#if THREAD_SUPPORT
+/* We can't take the root lock from a signal handler
+ * so the handler only wakes up the snapshot thread */
+static void _profiler_signal_handler(int32_t sig) {
+    int32_t saved_errno = errno;
+    uint8_t b = 0;
+
+    /* A full pipe already has a wakeup waiting in it */
+    while(write(_profiler_signal_pipe[1], &b, sizeof(b)) == ERR && errno == EINTR) {
+    }
+
+    errno = saved_errno;
+}
+
+static void *_profiler_snapshot_thread_handler(void *unused) {
+    struct pollfd pfd;
+
+    pfd.fd = _profiler_signal_pipe[0];
+    pfd.events = POLLIN;
+
+    while(true) {
+        int32_t r = poll(&pfd, pfd.fd == ERR ? 0 : 1, _profiler_interval == 0 ? -1 : _profiler_interval * 1000);
+        uint32_t reason = PROFILER_SNAPSHOT_INTERVAL;
+
+        if(r == ERR) {
+            continue;
+        }
+
+        if(r > 0) {
+            /* Coalesce any signals that arrived together */
+            _iso_wake_pipe_drain(pfd.fd);
+            reason = PROFILER_SNAPSHOT_SIGNAL;
+        }
+
+        LOCK_ROOT();
+        _iso_alloc_profiler_snapshot(reason);
+        UNLOCK_ROOT();
+    }
+
+    return NULL;
+}
+
+INTERNAL_HIDDEN void _iso_alloc_profiler_start_snapshots(void) {
+    if(getenv(PROFILER_INTERVAL_ENV_STR) != NULL) {
+        _profiler_interval = atoi(getenv(PROFILER_INTERVAL_ENV_STR));
+    }
+
+    if(getenv(PROFILER_SIGNAL_ENV_STR) != NULL) {
+        int32_t sig = atoi(getenv(PROFILER_SIGNAL_ENV_STR));
+        struct sigaction sa;
+
+        if(pipe2(_profiler_signal_pipe, O_CLOEXEC | O_NONBLOCK) == ERR) {
+            LOG_AND_ABORT("Cannot create the profiler signal pipe");
+        }
+
+        memset(&sa, 0x0, sizeof(sa));
+        sa.sa_handler = _profiler_signal_handler;
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+
+        if(sigaction(sig, &sa, NULL) == ERR) {
+            LOG_AND_ABORT("Cannot install the profiler handler for signal %d", sig);
+        }
+    }
+
+    if(_profiler_interval <= 0 && _profiler_signal_pipe[0] == ERR) {
+        return;
+    }
+
+    if(_profiler_interval < 0) {
+        _profiler_interval = 0;
+    }
+
+    if(pthread_create(&_profiler_snapshot_thread, NULL, _profiler_snapshot_thread_handler, NULL) != OK) {
+        LOG_AND_ABORT("Cannot create the profiler snapshot thread");
+    }
+}
+#endif
+
+/* Writes the text format profiler data */
+INTERNAL_HIDDEN void _iso_alloc_profiler_write_text(void) {
+    _iso_alloc_printf(profiler_fd, "allocated=%lu\n", _allocation_count);
+    _iso_alloc_printf(profiler_fd, "sampled=%lu\n", _sampled_count);
+
+    for(uint32_t i = 0; i < HEAP_USAGE_CLASSES; i++) {
+        if(_profiler_size_samples[i] != 0) {
+            _iso_alloc_printf(profiler_fd, "sampled_size=%lu,count=%lu\n", (uint64_t) 1 << i, _profiler_size_samples[i]);
+        }
+    }
+
+    if(_profiler_size_samples[HEAP_USAGE_CLASSES] != 0) {
+        _iso_alloc_printf(profiler_fd, "sampled_size=big,count=%lu\n", _profiler_size_samples[HEAP_USAGE_CLASSES]);
+    }
+
+    for(uint32_t i = 0; i < _root->zones_used; i++) {
+        iso_alloc_zone *zone = &_root->zones[i];
+        _zone_profiler_map[zone->chunk_size].total++;
+    }
+
+    for(uint32_t i = 0; i < PROFILER_STACK_TABLE_SZ; i++) {
+        if(_profiler_stacks[i].depth != 0) {
+            _iso_alloc_printf(profiler_fd, "backtrace_hash=0x%x,calls=%lu\n", _profiler_stacks[i].hash, _profiler_stacks[i].alloc_count);
+        }
+    }
+
+    for(uint32_t i = 0; i < SMALL_SZ_MAX; i++) {
+        if(_zone_profiler_map[i].count != 0) {
+            _iso_alloc_printf(profiler_fd, "%d,%d,%d\n", i, _zone_profiler_map[i].total, _zone_profiler_map[i].count);
+        }
+    }
+}
+
+/* Writes all profiler data. The caller must hold
+ * the root lock */
+INTERNAL_HIDDEN void _iso_alloc_profiler_dump(void) {
+    /* Counters of other threads still running are merged
+     * each time they take a sample or when they exit */
+    _iso_alloc_profile_merge_thread();
+
+    if(profiler_fd == ERR) {
+        return;
+    }
+
+    if(_profiler_snapshots == true) {
+        _iso_alloc_profiler_snapshot(PROFILER_SNAPSHOT_EXIT);
+    } else {
+        _iso_alloc_profiler_write_text();
+    }
+
+    close(profiler_fd);
+    profiler_fd = ERR;
+
+    int32_t pprof_fd;
+
+    if(getenv(PROFILER_PPROF_ENV_STR) != NULL) {
+        pprof_fd = open(getenv(PROFILER_PPROF_ENV_STR), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    } else {
+        pprof_fd = open(PROFILER_PPROF_FILE_PATH, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    }
+
+    if(pprof_fd != ERR) {
+        _iso_alloc_profiler_write_pprof(pprof_fd);
+        close(pprof_fd);
+    }
 }
 #endif
 
@@ -224,15 +914,38 @@ INTERNAL_HIDDEN void _initialize_profiler() {
     /* We don't need thread safety for this file descriptor
      * as long as we guarantee to never use it if the root
      * is not locked */
+    int32_t flags = O_RDWR | O_CREAT;
+
+    /* Snapshots are appended so a file can hold many
+     * runs and survive the process being killed */
+    if(getenv(PROFILER_INTERVAL_ENV_STR) != NULL || getenv(PROFILER_SIGNAL_ENV_STR) != NULL) {
+        _profiler_snapshots = true;
+        flags = O_WRONLY | O_CREAT | O_APPEND;
+    }
+
     if(getenv(PROFILER_ENV_STR) != NULL) {
-        profiler_fd = open(getenv(PROFILER_ENV_STR), O_RDWR | O_CREAT, 0666);
+        profiler_fd = open(getenv(PROFILER_ENV_STR), flags, 0666);
     } else {
-        profiler_fd = open(PROFILER_FILE_PATH, O_RDWR | O_CREAT, 0666);
+        profiler_fd = open(PROFILER_FILE_PATH, flags, 0666);
     }
 
     if(profiler_fd == ERR) {
         LOG_AND_ABORT("Cannot open file descriptor for profiler.data");
     }
+
+    _profiler_stacks = (iso_profiler_stack *) mmap_rw_pages(sizeof(iso_profiler_stack) * PROFILER_STACK_TABLE_SZ, false);
+    _profiler_live = (iso_profiler_live_sample *) mmap_rw_pages(sizeof(iso_profiler_live_sample) * PROFILER_LIVE_SAMPLES, false);
+
+#if THREAD_SUPPORT
+    pthread_once(&_profiler_thread_key_once, _profiler_create_thread_key);
+#endif
+
+    if(_profiler_snapshots == true) {
+        _profiler_snapshot_buf = (uint8_t *) mmap_rw_pages(PROFILER_SNAPSHOT_MAX_SZ, false);
+#if THREAD_SUPPORT
+        _iso_alloc_profiler_start_snapshots();
+#endif
+    }
 #endif
     return;
 }
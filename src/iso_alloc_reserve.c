@@ -0,0 +1,276 @@
+/* iso_alloc_reserve.c - A secure memory allocator
+ * Copyright 2021 - chris.rohlf@gmail.com */
+
+#include "iso_alloc_internal.h"
+
+/* Creating a zone maps and guards its pages and writes
+ * its canaries while holding the root lock. Zones made
+ * ahead of time keep that work out of the allocation
+ * that would otherwise find every zone for its size full */
+
+#if THREAD_SUPPORT
+static iso_alloc_watermark _watermarks[MAX_WATERMARKS];
+static uint32_t _watermark_count;
+static atomic_flag _watermarks_flag;
+static pthread_t _provisioner_thread;
+static bool _provisioner_started;
+static int32_t _provisioner_pipe[2] = {ERR, ERR};
+
+#define LOCK_WATERMARKS()                                   \
+    while(atomic_flag_test_and_set(&_watermarks_flag)) { \
+    }
+
+#define UNLOCK_WATERMARKS() \
+    atomic_flag_clear(&_watermarks_flag);
+#endif
+
+/* The watermarks as of the last time the provisioner
+ * thread checked them, and how many more chunks each
+ * size could give out before it falls below its mark.
+ * These are only used with the root lock held. Frees
+ * aren't counted, so the thread may be woken early but
+ * is never woken late. A size that was already woken
+ * for has a slack of -1 until the thread checks again */
+static iso_alloc_watermark _armed_watermarks[MAX_WATERMARKS];
+static int64_t _watermark_slack[MAX_WATERMARKS];
+uint32_t _watermarks_armed;
+bool _provisioner_wake_pending;
+
+/* Called with the root lock held for every chunk taken
+ * from a zone while any watermark is armed */
+INTERNAL_HIDDEN void _iso_watermark_chunk_taken(iso_alloc_zone *zone) {
+    for(uint32_t i = 0; i < _watermarks_armed; i++) {
+        if(_watermark_slack[i] < 0 || iso_zone_fits_size(zone, _armed_watermarks[i].size) == false) {
+            continue;
+        }
+
+        if(_watermark_slack[i] == 0) {
+            _watermark_slack[i] = -1;
+            _provisioner_wake_pending = true;
+        } else {
+            _watermark_slack[i]--;
+        }
+    }
+}
+
+/* Creates zones, one root lock at a time, until count
+ * chunks of size bytes are free */
+INTERNAL_HIDDEN int32_t _iso_alloc_reserve(size_t size, size_t count) {
+    if(size == 0 || size > SMALL_SZ_MAX) {
+        return ERR;
+    }
+
+    size_t chunk_size = _iso_new_zone_chunk_size(size);
+
+    while(true) {
+        LOCK_ROOT();
+
+        if(UNLIKELY(_root == NULL)) {
+            g_page_size = sysconf(_SC_PAGESIZE);
+            iso_alloc_initialize_global_root();
+        }
+
+        if(_iso_free_chunks_for_size(size) >= count) {
+            UNLOCK_ROOT();
+            return OK;
+        }
+
+        if(_root->zones_used >= MAX_ZONES) {
+            UNLOCK_ROOT();
+            return ERR;
+        }
+
+        iso_alloc_zone *zone = _iso_new_zone(chunk_size, true);
+        UNLOCK_ROOT();
+
+        if(zone == NULL) {
+            return ERR;
+        }
+    }
+}
+
+#if THREAD_SUPPORT
+/* The provisioner and zone pool threads sleep in poll
+ * on a pipe until another thread writes a wakeup to it.
+ * Neither end of the pipe blocks. Returns ERR if the
+ * pipe can't be created */
+INTERNAL_HIDDEN int32_t _iso_wake_pipe_create(int32_t fds[2]) {
+    if(pipe(fds) == ERR) {
+        return ERR;
+    }
+
+    for(int32_t i = 0; i < 2; i++) {
+        if(fcntl(fds[i], F_SETFD, FD_CLOEXEC) == ERR || fcntl(fds[i], F_SETFL, O_NONBLOCK) == ERR) {
+            close(fds[0]);
+            close(fds[1]);
+            fds[0] = ERR;
+            fds[1] = ERR;
+            return ERR;
+        }
+    }
+
+    return OK;
+}
+
+/* Empties the pipe so the next poll sleeps until
+ * another wakeup is written to it */
+INTERNAL_HIDDEN void _iso_wake_pipe_drain(int32_t fd) {
+    uint8_t buf[64];
+    ssize_t r;
+
+    do {
+        r = read(fd, buf, sizeof(buf));
+    } while(r > 0 || (r == ERR && errno == EINTR));
+
+    if(r == ERR && errno != EAGAIN) {
+        LOG_AND_ABORT("Cannot read wakeup pipe %d", fd);
+    }
+}
+
+/* A full pipe already has a wakeup waiting in it */
+INTERNAL_HIDDEN void _iso_wake_pipe_write(int32_t fd) {
+    uint8_t b = 0;
+    ssize_t r;
+
+    do {
+        r = write(fd, &b, sizeof(b));
+    } while(r == ERR && errno == EINTR);
+
+    if(r == ERR && errno != EAGAIN) {
+        LOG_AND_ABORT("Cannot write wakeup pipe %d", fd);
+    }
+}
+
+/* Counts the chunks each size can give out before it
+ * falls below its mark. A size that couldn't be brought
+ * up to its mark isn't armed so the thread doesn't spin */
+static void _provisioner_arm(iso_alloc_watermark *watermarks, uint32_t count) {
+    LOCK_ROOT();
+
+    for(uint32_t i = 0; i < count; i++) {
+        uint64_t free_chunks = _iso_free_chunks_for_size(watermarks[i].size);
+
+        _armed_watermarks[i] = watermarks[i];
+        _watermark_slack[i] = (free_chunks >= watermarks[i].free_chunks) ? (free_chunks - watermarks[i].free_chunks) : -1;
+    }
+
+    _watermarks_armed = count;
+    UNLOCK_ROOT();
+}
+
+static void *_provisioner_thread_handler(void *unused) {
+    iso_alloc_watermark watermarks[MAX_WATERMARKS];
+    struct pollfd pfd;
+
+    pfd.fd = _provisioner_pipe[0];
+    pfd.events = POLLIN;
+
+    while(true) {
+        LOCK_WATERMARKS();
+        uint32_t count = _watermark_count;
+        memcpy(watermarks, _watermarks, sizeof(iso_alloc_watermark) * count);
+        UNLOCK_WATERMARKS();
+
+        for(uint32_t i = 0; i < count; i++) {
+            _iso_alloc_reserve(watermarks[i].size, watermarks[i].free_chunks);
+        }
+
+        _provisioner_arm(watermarks, count);
+
+        /* Sleep until an allocation takes a size below
+         * its mark or a watermark is changed */
+        if(poll(&pfd, 1, -1) == ERR) {
+            if(errno == EINTR) {
+                continue;
+            }
+
+            LOG_AND_ABORT("Cannot poll the zone provisioner pipe");
+        }
+
+        _iso_wake_pipe_drain(pfd.fd);
+    }
+
+    return NULL;
+}
+
+/* Wakes the provisioner thread so it can check the
+ * watermarks */
+INTERNAL_HIDDEN void _iso_alloc_provisioner_wake(void) {
+    if(__atomic_load_n(&_provisioner_started, __ATOMIC_ACQUIRE) == false ||
+       __atomic_load_n(&_watermark_count, __ATOMIC_RELAXED) == 0) {
+        return;
+    }
+
+    _iso_wake_pipe_write(_provisioner_pipe[1]);
+}
+
+/* Sets or replaces the watermark for the zones that
+ * serve size bytes. A free_chunks of 0 removes it. The
+ * provisioner thread is started with the first one */
+INTERNAL_HIDDEN int32_t _iso_alloc_set_watermark(size_t size, size_t free_chunks) {
+    if(size == 0 || size > SMALL_SZ_MAX) {
+        return ERR;
+    }
+
+    LOCK_WATERMARKS();
+
+    uint32_t i;
+
+    for(i = 0; i < _watermark_count; i++) {
+        if(_watermarks[i].size == size) {
+            break;
+        }
+    }
+
+    if(free_chunks == 0) {
+        if(i < _watermark_count) {
+            _watermark_count--;
+            _watermarks[i] = _watermarks[_watermark_count];
+        }
+
+        UNLOCK_WATERMARKS();
+        return OK;
+    }
+
+    if(i == MAX_WATERMARKS) {
+        UNLOCK_WATERMARKS();
+        return ERR;
+    }
+
+    _watermarks[i].size = size;
+    _watermarks[i].free_chunks = free_chunks;
+
+    if(i == _watermark_count) {
+        _watermark_count++;
+    }
+
+    if(_provisioner_started == false) {
+        if(_iso_wake_pipe_create(_provisioner_pipe) == ERR) {
+            LOG_AND_ABORT("Cannot create the zone provisioner pipe");
+        }
+
+        if(pthread_create(&_provisioner_thread, NULL, _provisioner_thread_handler, NULL) != OK) {
+            LOG_AND_ABORT("Cannot create the zone provisioner thread");
+        }
+
+        pthread_detach(_provisioner_thread);
+        __atomic_store_n(&_provisioner_started, true, __ATOMIC_RELEASE);
+    }
+
+    UNLOCK_WATERMARKS();
+
+    _iso_alloc_provisioner_wake();
+
+    return OK;
+}
+#else
+/* There is no thread to keep a watermark without
+ * thread support */
+INTERNAL_HIDDEN int32_t _iso_alloc_set_watermark(size_t size, size_t free_chunks) {
+    return ERR;
+}
+
+INTERNAL_HIDDEN void _iso_alloc_provisioner_wake(void) {
+    return;
+}
+#endif
@@ -0,0 +1,187 @@
+/* iso_alloc_retire.c - A secure memory allocator
+ * Copyright 2021 - chris.rohlf@gmail.com */
+
+#include "iso_alloc_internal.h"
+
+#if ZONE_RETIREMENT
+/* Zones are never removed from the root so an internal
+ * zone made for a burst of allocations would otherwise
+ * hold on to its pages until the process exits. All of
+ * these functions are called with the root lock held */
+uint64_t _zone_recycle_generation;
+
+static uint16_t _retire_pending[ZONE_RETIRE_BATCH];
+static uint32_t _retire_pending_count;
+static uint16_t _retired_zones[MAX_ZONES];
+static uint32_t _retired_count;
+
+/* A permanently free'd chunk must never be handed out
+ * again, and retiring a zone wipes its bitmap. So a zone
+ * with any of them is never retired */
+INTERNAL_HIDDEN INLINE bool _iso_zone_can_retire(iso_alloc_zone *zone) {
+    return zone->internally_managed == true && zone->is_retired == false && zone->chunks_in_use == 0 &&
+           zone->chunks_permanent == 0 && zone->index >= _default_zone_count;
+}
+
+/* The bitmap and user pages are wiped so nothing from
+ * the old zone survives into the one that recycles it.
+ * A stale pointer into the zone still finds it but its
+ * chunks are all free, so a free is caught as a double
+ * free, and it can't be allocated from until recycled */
+INTERNAL_HIDDEN void _iso_retire_zone(iso_alloc_zone *zone) {
+    UNMASK_ZONE_PTRS(zone);
+    UNPOISON_ZONE(zone);
+
+#if PER_CPU_CACHE
+    _iso_cpu_cache_zone_remove(zone);
+#endif
+
+    memset(zone->bitmap_start, 0x0, zone->bitmap_size);
+
+    /* Packed bitmaps share their page with other zones */
+    if(zone->bitmap_size >= _root->system_page_size) {
+        madvise(zone->bitmap_start, zone->bitmap_size, MADV_DONTNEED);
+    }
+
+    madvise(zone->user_pages_start, ZONE_USER_SIZE, MADV_DONTNEED);
+
+    zone->chunks_was_used = 0;
+    zone->chunks_canary = 0;
+    zone->bump_chunk = 0;
+    zone->next_free_bit_slot = BAD_BIT_SLOT;
+    zone->free_bit_slot_cache_index = 0;
+    zone->free_bit_slot_cache_usable = 0;
+    zone->is_full = true;
+    zone->is_retired = true;
+
+    POISON_ZONE(zone);
+    MASK_ZONE_PTRS(zone);
+
+    _retired_zones[_retired_count] = zone->index;
+    _retired_count++;
+
+    STATS_INC(zones_retired);
+}
+
+/* Retires the empty zones beyond the first ZONE_RETIRE_KEEP
+ * of each chunk size seen in the queue. Zones are visited
+ * in the order the allocator searches them so the ones
+ * that are kept are found first */
+INTERNAL_HIDDEN void _iso_retire_sweep(void) {
+    size_t sizes[ZONE_RETIRE_BATCH];
+    uint32_t empty[ZONE_RETIRE_BATCH];
+    uint32_t size_count = 0;
+
+    for(uint32_t i = 0; i < _retire_pending_count; i++) {
+        iso_alloc_zone *zone = &_root->zones[_retire_pending[i]];
+        uint32_t s = 0;
+
+        if(_iso_zone_can_retire(zone) == false) {
+            continue;
+        }
+
+        while(s < size_count && sizes[s] != zone->chunk_size) {
+            s++;
+        }
+
+        if(s == size_count) {
+            sizes[size_count] = zone->chunk_size;
+            empty[size_count] = 0;
+            size_count++;
+        }
+    }
+
+    _retire_pending_count = 0;
+
+    for(uint32_t i = _default_zone_count; i < _root->zones_used && size_count != 0; i++) {
+        iso_alloc_zone *zone = &_root->zones[i];
+        uint32_t s = 0;
+
+        if(_iso_zone_can_retire(zone) == false) {
+            continue;
+        }
+
+        while(s < size_count && sizes[s] != zone->chunk_size) {
+            s++;
+        }
+
+        if(s == size_count) {
+            continue;
+        }
+
+        empty[s]++;
+
+        if(empty[s] > ZONE_RETIRE_KEEP) {
+            _iso_retire_zone(zone);
+        }
+    }
+}
+
+/* Called when the last chunk in use in a zone is free'd.
+ * The zone is only queued here because it may well be
+ * used again right away */
+INTERNAL_HIDDEN void _iso_zone_emptied(iso_alloc_zone *zone) {
+    if(_iso_zone_can_retire(zone) == false) {
+        return;
+    }
+
+    for(uint32_t i = 0; i < _retire_pending_count; i++) {
+        if(_retire_pending[i] == zone->index) {
+            return;
+        }
+    }
+
+    _retire_pending[_retire_pending_count] = zone->index;
+    _retire_pending_count++;
+
+    if(_retire_pending_count == ZONE_RETIRE_BATCH) {
+        _iso_retire_sweep();
+    }
+}
+
+/* Returns the descriptor of a retired zone for a new zone
+ * of size byte chunks, or NULL if there are none. One that
+ * held chunks of the same size keeps its pages and mapped
+ * is set. Any other one is unmapped so the caller maps
+ * pages with a bitmap of the right size */
+INTERNAL_HIDDEN iso_alloc_zone *_iso_recycle_zone(size_t size, bool *mapped) {
+    if(_retired_count == 0) {
+        return NULL;
+    }
+
+    uint32_t r = _retired_count - 1;
+
+    for(uint32_t i = 0; i < _retired_count; i++) {
+        if(_root->zones[_retired_zones[i]].chunk_size == size) {
+            r = i;
+            break;
+        }
+    }
+
+    iso_alloc_zone *zone = &_root->zones[_retired_zones[r]];
+    _retired_count--;
+    _retired_zones[r] = _retired_zones[_retired_count];
+
+    UNMASK_ZONE_PTRS(zone);
+    UNPOISON_ZONE(zone);
+
+    if(zone->chunk_size == size) {
+        /* Anything written through a stale pointer since
+         * the zone was retired is thrown away */
+        madvise(zone->user_pages_start, ZONE_USER_SIZE, MADV_DONTNEED);
+        *mapped = true;
+    } else {
+        _unmap_zone(zone);
+        *mapped = false;
+    }
+
+    zone->is_retired = false;
+
+    /* The caller sets up the rest of the zone with new
+     * secrets, so the old pointer mask is gone */
+    _zone_recycle_generation++;
+    STATS_INC(zones_recycled);
+
+    return zone;
+}
+#endif
@@ -0,0 +1,64 @@
+/* iso_alloc_stats.c - A secure memory allocator
+ * Copyright 2021 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+
+#if ALLOC_STATS
+#if STATS_SIZE_CLASSES != ISO_ALLOC_STATS_SIZE_CLASSES
+#error "STATS_SIZE_CLASSES must match ISO_ALLOC_STATS_SIZE_CLASSES"
+#endif
+
+iso_alloc_stats_counters _stats;
+
+#define STATS_READ(f) \
+    __atomic_load_n(&_stats.f, __ATOMIC_RELAXED)
+#endif
+
+/* Takes a snapshot of the allocator counters. No locks
+ * are taken here so this is cheap enough to call often,
+ * but the counters may be slightly inconsistent with
+ * each other if other threads are allocating */
+INTERNAL_HIDDEN int32_t _iso_alloc_get_stats(struct iso_alloc_stats *stats) {
+    if(stats == NULL) {
+        return ERR;
+    }
+
+    memset(stats, 0x0, sizeof(struct iso_alloc_stats));
+
+#if ALLOC_STATS
+    for(int32_t i = 0; i < STATS_SIZE_CLASSES; i++) {
+        stats->allocs[i] = STATS_READ(allocs[i]) + STATS_READ(cpu_cache_allocs[i]);
+        stats->frees[i] = STATS_READ(frees[i]) + STATS_READ(cpu_cache_frees[i]);
+        stats->cpu_cache_hits += STATS_READ(cpu_cache_allocs[i]);
+    }
+
+    stats->allocs[STATS_BIG_CLASS] += STATS_READ(big_allocs);
+    stats->frees[STATS_BIG_CLASS] += STATS_READ(big_frees);
+
+    /* Chunks pushed to and popped from a CPU cache are
+     * counted without the root lock so they are kept
+     * apart from bytes_in_use */
+    stats->bytes_in_use = STATS_READ(bytes_in_use) + STATS_READ(cpu_cache_bytes) + STATS_READ(big_bytes_in_use);
+    stats->zones_created = STATS_READ(zones_created);
+    stats->cache_refills = STATS_READ(cache_refills);
+    stats->fast_path_hits = STATS_READ(fast_path_hits);
+    stats->slow_path_hits = STATS_READ(slow_path_hits);
+    stats->extra_slow_path_hits = STATS_READ(extra_slow_path_hits);
+    stats->near_hits = STATS_READ(near_hits);
+    stats->zone_pool_hits = STATS_READ(zone_pool_hits);
+    stats->zones_retired = STATS_READ(zones_retired);
+    stats->zones_recycled = STATS_READ(zones_recycled);
+    stats->big_zone_reuse_hits = STATS_READ(big_zone_reuse_hits);
+    stats->big_zone_new = STATS_READ(big_zone_new);
+    stats->lock_contention = STATS_READ(lock_contention);
+
+    if(_root != NULL) {
+        stats->zones_used = __atomic_load_n(&_root->zones_used, __ATOMIC_RELAXED);
+    }
+
+    return OK;
+#else
+    return ERR;
+#endif
+}
@@ -0,0 +1,313 @@
+/* iso_alloc_trace.c - A secure memory allocator
+ * Copyright 2021 - chris.rohlf@gmail.com */
+
+#include "iso_alloc_internal.h"
+
+#if ALLOC_TRACE
+#include <fcntl.h>
+#include <time.h>
+
+#if __linux__
+#include <sys/syscall.h>
+#endif
+
+static int32_t _trace_fd = ERR;
+static uint64_t _trace_start_ns;
+
+/* Every thread buffer is on this list so the destructor
+ * can flush threads that are still running */
+static iso_trace_buffer *_trace_buffers;
+static atomic_flag _trace_buffers_flag;
+
+static __thread iso_trace_buffer *_trace_buffer;
+
+#if THREAD_SUPPORT
+static pthread_key_t _trace_key;
+#endif
+
+#define LOCK_TRACE_BUFFERS()                                 \
+    while(atomic_flag_test_and_set(&_trace_buffers_flag)) { \
+    }
+
+#define UNLOCK_TRACE_BUFFERS() \
+    atomic_flag_clear(&_trace_buffers_flag);
+
+#define LOCK_TRACE_BUFFER(b)                     \
+    while(atomic_flag_test_and_set(&b->lock)) { \
+    }
+
+#define UNLOCK_TRACE_BUFFER(b) \
+    atomic_flag_clear(&b->lock);
+
+INTERNAL_HIDDEN INLINE uint64_t _trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+INTERNAL_HIDDEN INLINE uint32_t _trace_tid(void) {
+#if __linux__
+    return (uint32_t) syscall(SYS_gettid);
+#else
+    return (uint32_t) (uintptr_t) pthread_self();
+#endif
+}
+
+/* Appends the records published in the buffer to the
+ * trace with a single write. The file is opened with
+ * O_APPEND so buffers written by different threads never
+ * interleave. The caller must hold the buffer lock */
+INTERNAL_HIDDEN void _trace_write(iso_trace_buffer *buf, int32_t fd) {
+    uint32_t count = __atomic_load_n(&buf->count, __ATOMIC_ACQUIRE);
+
+    if(count == 0 || fd == ERR) {
+        __atomic_store_n(&buf->count, 0, __ATOMIC_RELAXED);
+        return;
+    }
+
+    size_t len = count * sizeof(iso_trace_record);
+    uint8_t *p = (uint8_t *) buf->records;
+
+    while(len != 0) {
+        ssize_t w = write(fd, p, len);
+
+        if(w <= 0) {
+            if(w < 0 && errno == EINTR) {
+                continue;
+            }
+
+            break;
+        }
+
+        p += w;
+        len -= w;
+    }
+
+    __atomic_store_n(&buf->count, 0, __ATOMIC_RELAXED);
+}
+
+/* Called by the thread that owns the buffer. The trace
+ * descriptor is read under the buffer lock so it can't be
+ * closed by the destructor while it is written to */
+INTERNAL_HIDDEN void _trace_flush(iso_trace_buffer *buf) {
+    LOCK_TRACE_BUFFER(buf);
+    _trace_write(buf, __atomic_load_n(&_trace_fd, __ATOMIC_RELAXED));
+    UNLOCK_TRACE_BUFFER(buf);
+}
+
+#if THREAD_SUPPORT
+/* Called when a thread exits with records left over */
+INTERNAL_HIDDEN void _trace_thread_exit(void *arg) {
+    iso_trace_buffer *buf = (iso_trace_buffer *) arg;
+    _trace_flush(buf);
+
+    LOCK_TRACE_BUFFERS();
+
+    iso_trace_buffer **b = &_trace_buffers;
+
+    while(*b != NULL && *b != buf) {
+        b = &(*b)->next;
+    }
+
+    if(*b != NULL) {
+        *b = buf->next;
+    }
+
+    UNLOCK_TRACE_BUFFERS();
+
+    _trace_buffer = NULL;
+    munmap(buf, sizeof(iso_trace_buffer));
+}
+#endif
+
+/* Thread buffers are mapped directly because this runs
+ * underneath malloc */
+INTERNAL_HIDDEN iso_trace_buffer *_trace_new_buffer(void) {
+    iso_trace_buffer *buf = mmap(NULL, sizeof(iso_trace_buffer), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if(buf == MAP_FAILED) {
+        return NULL;
+    }
+
+    buf->tid = _trace_tid();
+    buf->count = 0;
+    atomic_flag_clear(&buf->lock);
+
+    LOCK_TRACE_BUFFERS();
+    buf->next = _trace_buffers;
+    _trace_buffers = buf;
+    UNLOCK_TRACE_BUFFERS();
+
+#if THREAD_SUPPORT
+    pthread_setspecific(_trace_key, buf);
+#endif
+
+    return buf;
+}
+
+INTERNAL_HIDDEN void _iso_alloc_trace(uint32_t op, void *p, void *old, size_t size) {
+    if(UNLIKELY(__atomic_load_n(&_trace_fd, __ATOMIC_RELAXED) == ERR)) {
+        return;
+    }
+
+    /* free(NULL) does nothing so it isn't recorded */
+    if(op == TRACE_OP_FREE && p == NULL) {
+        return;
+    }
+
+    iso_trace_buffer *buf = _trace_buffer;
+
+    if(UNLIKELY(buf == NULL)) {
+        buf = _trace_buffer = _trace_new_buffer();
+
+        if(buf == NULL) {
+            return;
+        }
+    }
+
+    /* The destructor may reset count while we add to it,
+     * which only happens once tracing has stopped */
+    uint32_t count = __atomic_load_n(&buf->count, __ATOMIC_RELAXED);
+    iso_trace_record *r = &buf->records[count];
+    r->timestamp = _trace_now() - _trace_start_ns;
+    r->ptr = (uint64_t) p;
+    r->old_ptr = (uint64_t) old;
+    r->size = size;
+    r->tid = buf->tid;
+    r->op = op;
+
+    __atomic_store_n(&buf->count, count + 1, __ATOMIC_RELEASE);
+
+    if(UNLIKELY(count + 1 == TRACE_BUFFER_RECORDS)) {
+        _trace_flush(buf);
+    }
+}
+
+/* Creates a trace file for this process. An existing
+ * file, left by an earlier process with the same pid, is
+ * never truncated and a numbered name is used instead */
+INTERNAL_HIDDEN void _trace_open(void) {
+    char path[PATH_MAX];
+    char *base = getenv(TRACE_PATH_ENV_STR);
+    int32_t fd = ERR;
+
+    if(base == NULL) {
+        base = TRACE_DEFAULT_PATH;
+    }
+
+    for(int32_t i = 0; fd == ERR; i++) {
+        if(i == 0) {
+            snprintf(path, sizeof(path), "%s.%d", base, getpid());
+        } else {
+            snprintf(path, sizeof(path), "%s.%d.%d", base, getpid(), i);
+        }
+
+        fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, 0644);
+
+        if(fd == ERR && errno != EEXIST) {
+            LOG_AND_ABORT("Failed to open trace file %s", path);
+        }
+    }
+
+    iso_trace_header hdr;
+    hdr.magic = TRACE_MAGIC;
+    hdr.version = TRACE_VERSION;
+    hdr.start_ns = _trace_start_ns = _trace_now();
+
+    if(write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+        LOG_AND_ABORT("Failed to write the trace file header");
+    }
+
+    __atomic_store_n(&_trace_fd, fd, __ATOMIC_RELAXED);
+}
+
+#if THREAD_SUPPORT
+/* A thread that forks while another one holds the list
+ * lock would leave it held in the child */
+INTERNAL_HIDDEN void _trace_atfork_prepare(void) {
+    LOCK_TRACE_BUFFERS();
+}
+
+INTERNAL_HIDDEN void _trace_atfork_parent(void) {
+    UNLOCK_TRACE_BUFFERS();
+}
+
+/* The child inherits the records of its parent, which
+ * are in the parent's trace already, and the buffers of
+ * threads that don't exist in the child. Those are all
+ * dropped and the child starts a trace of its own */
+INTERNAL_HIDDEN void _trace_atfork_child(void) {
+    iso_trace_buffer *buf = _trace_buffers;
+
+    while(buf != NULL) {
+        iso_trace_buffer *next = buf->next;
+
+        if(buf != _trace_buffer) {
+            munmap(buf, sizeof(iso_trace_buffer));
+        }
+
+        buf = next;
+    }
+
+    _trace_buffers = _trace_buffer;
+
+    if(_trace_buffer != NULL) {
+        _trace_buffer->next = NULL;
+        _trace_buffer->tid = _trace_tid();
+        _trace_buffer->count = 0;
+        atomic_flag_clear(&_trace_buffer->lock);
+    }
+
+    UNLOCK_TRACE_BUFFERS();
+
+    if(_trace_fd != ERR) {
+        close(_trace_fd);
+        _trace_fd = ERR;
+        _trace_open();
+    }
+}
+#endif
+
+INTERNAL_HIDDEN void _iso_alloc_trace_init(void) {
+    if(_trace_fd != ERR) {
+        return;
+    }
+
+#if THREAD_SUPPORT
+    if(pthread_key_create(&_trace_key, _trace_thread_exit) != 0) {
+        LOG_AND_ABORT("Failed to create the trace buffer thread key");
+    }
+
+    if(pthread_atfork(_trace_atfork_prepare, _trace_atfork_parent, _trace_atfork_child) != 0) {
+        LOG_AND_ABORT("Failed to register the trace fork handlers");
+    }
+#endif
+
+    _trace_open();
+}
+
+/* Stops recording and flushes every thread buffer. A
+ * thread still allocating while the program exits loses
+ * the records it makes after this point */
+INTERNAL_HIDDEN void _iso_alloc_trace_dtor(void) {
+    int32_t fd = _trace_fd;
+
+    if(fd == ERR) {
+        return;
+    }
+
+    __atomic_store_n(&_trace_fd, ERR, __ATOMIC_RELAXED);
+
+    LOCK_TRACE_BUFFERS();
+
+    for(iso_trace_buffer *buf = _trace_buffers; buf != NULL; buf = buf->next) {
+        LOCK_TRACE_BUFFER(buf);
+        _trace_write(buf, fd);
+        UNLOCK_TRACE_BUFFER(buf);
+    }
+
+    UNLOCK_TRACE_BUFFERS();
+
+    close(fd);
+}
+#endif
@@ -4,6 +4,10 @@
 #include "iso_alloc.h"
 #include "iso_alloc_internal.h"
 
+#if MALLOC_HOOK && __GLIBC__
+#include <malloc.h>
+#endif
+
 /* The MALLOC_HOOK configuration allows us to hook the usual
  * malloc interfaces and redirect them to the iso_alloc API.
  * This may not be desired, especially if you intend to call
@@ -14,40 +18,55 @@
 #if MALLOC_HOOK
 
 EXTERNAL_API void *__libc_malloc(size_t s) {
-    return iso_alloc(s);
+    void *p = iso_alloc(s);
+    TRACE_OP(TRACE_OP_MALLOC, p, NULL, s);
+    return p;
 }
 
 EXTERNAL_API void *malloc(size_t s) {
-    return iso_alloc(s);
+    void *p = iso_alloc(s);
+    TRACE_OP(TRACE_OP_MALLOC, p, NULL, s);
+    return p;
 }
 
 EXTERNAL_API void __libc_free(void *p) {
+    TRACE_OP(TRACE_OP_FREE, p, NULL, 0);
     iso_free(p);
 }
 
 EXTERNAL_API void free(void *p) {
+    TRACE_OP(TRACE_OP_FREE, p, NULL, 0);
     iso_free(p);
 }
 
 EXTERNAL_API void *__libc_calloc(size_t n, size_t s) {
-    return iso_calloc(n, s);
+    void *p = iso_calloc(n, s);
+    TRACE_OP(TRACE_OP_CALLOC, p, NULL, n * s);
+    return p;
 }
 
 EXTERNAL_API void *calloc(size_t n, size_t s) {
-    return iso_calloc(n, s);
+    void *p = iso_calloc(n, s);
+    TRACE_OP(TRACE_OP_CALLOC, p, NULL, n * s);
+    return p;
 }
 
 EXTERNAL_API void *__libc_realloc(void *p, size_t s) {
-    return iso_realloc(p, s);
+    void *r = iso_realloc(p, s);
+    TRACE_OP(TRACE_OP_REALLOC, r, p, s);
+    return r;
 }
 
 EXTERNAL_API void *realloc(void *p, size_t s) {
-    return iso_realloc(p, s);
+    void *r = iso_realloc(p, s);
+    TRACE_OP(TRACE_OP_REALLOC, r, p, s);
+    return r;
 }
 
 EXTERNAL_API int __posix_memalign(void **r, size_t a, size_t s) {
     /* All iso_alloc allocations are 8 byte aligned */
     *r = iso_alloc(s);
+    TRACE_OP(TRACE_OP_MALLOC, *r, NULL, s);
 
     if(*r != NULL) {
         return 0;
@@ -62,29 +81,165 @@ EXTERNAL_API int posix_memalign(void **r, size_t alignment, size_t s) {
 
 EXTERNAL_API void *__libc_memalign(size_t align, size_t s) {
     /* All iso_alloc allocations are 8 byte aligned */
-    return iso_alloc(s);
+    void *p = iso_alloc(s);
+    TRACE_OP(TRACE_OP_MALLOC, p, NULL, s);
+    return p;
 }
 
 EXTERNAL_API void *memalign(size_t alignment, size_t s) {
     /* All iso_alloc allocations are 8 byte aligned */
-    return iso_alloc(s);
+    void *p = iso_alloc(s);
+    TRACE_OP(TRACE_OP_MALLOC, p, NULL, s);
+    return p;
 }
 
 EXTERNAL_API size_t malloc_usable_size(void *ptr) {
     return iso_chunksz(ptr);
 }
 
+#if __GLIBC__
+/* The glibc malloc introspection interfaces. These would
+ * otherwise resolve to glibc and report on its own arenas
+ * which are unused once malloc is hooked. Zones are
+ * reported as the main arena and big zones, which are
+ * each their own mapping, are reported as mmap'd chunks */
+#if __GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33)
+EXTERNAL_API struct mallinfo2 mallinfo2(void) {
+    struct mallinfo2 mi;
+    iso_alloc_heap_usage usage;
+
+    _iso_alloc_heap_usage(&usage);
+    memset(&mi, 0x0, sizeof(mi));
+
+    mi.arena = usage.zone_bytes;
+    mi.ordblks = usage.zone_free_chunks;
+    mi.hblks = usage.big_zones;
+    mi.hblkhd = usage.big_zone_bytes;
+    mi.uordblks = usage.zone_in_use_bytes;
+    mi.fordblks = usage.zone_free_bytes;
+    return mi;
+}
+#endif
+
+/* The int fields of mallinfo overflow with more than
+ * 2GB of heap so we clamp them instead of wrapping */
+#define MALLINFO_CLAMP(v) \
+    (((v) > INT_MAX) ? INT_MAX : (int) (v))
+
+EXTERNAL_API struct mallinfo mallinfo(void) {
+    struct mallinfo mi;
+    iso_alloc_heap_usage usage;
+
+    _iso_alloc_heap_usage(&usage);
+    memset(&mi, 0x0, sizeof(mi));
+
+    mi.arena = MALLINFO_CLAMP(usage.zone_bytes);
+    mi.ordblks = MALLINFO_CLAMP(usage.zone_free_chunks);
+    mi.hblks = MALLINFO_CLAMP(usage.big_zones);
+    mi.hblkhd = MALLINFO_CLAMP(usage.big_zone_bytes);
+    mi.uordblks = MALLINFO_CLAMP(usage.zone_in_use_bytes);
+    mi.fordblks = MALLINFO_CLAMP(usage.zone_free_bytes);
+    return mi;
+}
+
+/* Same layout as the glibc output so existing log
+ * scrapers keep working */
+EXTERNAL_API void malloc_stats(void) {
+    iso_alloc_heap_usage usage;
+
+    _iso_alloc_heap_usage(&usage);
+
+    _iso_alloc_printf(STDERR_FILENO, "Arena 0:\n");
+    _iso_alloc_printf(STDERR_FILENO, "system bytes     = %lu\n", usage.zone_bytes);
+    _iso_alloc_printf(STDERR_FILENO, "in use bytes     = %lu\n", usage.zone_in_use_bytes);
+    _iso_alloc_printf(STDERR_FILENO, "Total (incl. mmap):\n");
+    _iso_alloc_printf(STDERR_FILENO, "system bytes     = %lu\n", usage.zone_bytes + usage.big_zone_bytes);
+    _iso_alloc_printf(STDERR_FILENO, "in use bytes     = %lu\n", usage.zone_in_use_bytes + usage.big_in_use_bytes);
+    _iso_alloc_printf(STDERR_FILENO, "max mmap regions = %lu\n", usage.big_zones);
+    _iso_alloc_printf(STDERR_FILENO, "max mmap bytes   = %lu\n", usage.big_zone_bytes);
+}
+
+/* Emits the same XML schema as glibc. Free chunks are
+ * grouped by power of 2 size class. The snapshot is
+ * taken before writing to fp because stdio may call
+ * back into malloc */
+EXTERNAL_API int malloc_info(int options, FILE *fp) {
+    if(options != 0 || fp == NULL) {
+        errno = EINVAL;
+        return ERR;
+    }
+
+    iso_alloc_heap_usage usage;
+    _iso_alloc_heap_usage(&usage);
+
+    uint64_t system = usage.zone_bytes + usage.big_zone_bytes;
+    uint64_t big_free_bytes = usage.big_zone_bytes - usage.big_in_use_bytes;
+
+    fprintf(fp, "<malloc version=\"1\">\n<heap nr=\"0\">\n<sizes>\n");
+
+    for(uint32_t i = 0; i < HEAP_USAGE_CLASSES; i++) {
+        if(usage.free_chunks[i] == 0) {
+            continue;
+        }
+
+        fprintf(fp, "  <size from=\"%" PRIu64 "\" to=\"%" PRIu64 "\" total=\"%" PRIu64 "\" count=\"%" PRIu64 "\"/>\n",
+                (i == 0) ? 1 : (1UL << (i - 1)) + 1, 1UL << i, usage.free_chunk_bytes[i], usage.free_chunks[i]);
+    }
+
+    fprintf(fp, "</sizes>\n");
+    fprintf(fp, "<total type=\"fast\" count=\"0\" size=\"0\"/>\n");
+    fprintf(fp, "<total type=\"rest\" count=\"%" PRIu64 "\" size=\"%" PRIu64 "\"/>\n", usage.zone_free_chunks, usage.zone_free_bytes);
+    fprintf(fp, "<system type=\"current\" size=\"%" PRIu64 "\"/>\n", usage.zone_bytes);
+    fprintf(fp, "<system type=\"max\" size=\"%" PRIu64 "\"/>\n", usage.zone_bytes);
+    fprintf(fp, "<aspace type=\"total\" size=\"%" PRIu64 "\"/>\n", usage.zone_bytes);
+    fprintf(fp, "<aspace type=\"mprotect\" size=\"%" PRIu64 "\"/>\n", usage.zone_bytes);
+    fprintf(fp, "</heap>\n");
+    fprintf(fp, "<total type=\"fast\" count=\"0\" size=\"0\"/>\n");
+    fprintf(fp, "<total type=\"rest\" count=\"%" PRIu64 "\" size=\"%" PRIu64 "\"/>\n", usage.zone_free_chunks + usage.big_free_zones,
+            usage.zone_free_bytes + big_free_bytes);
+    fprintf(fp, "<total type=\"mmap\" count=\"%" PRIu64 "\" size=\"%" PRIu64 "\"/>\n", usage.big_zones, usage.big_zone_bytes);
+    fprintf(fp, "<system type=\"current\" size=\"%" PRIu64 "\"/>\n", system);
+    fprintf(fp, "<system type=\"max\" size=\"%" PRIu64 "\"/>\n", system);
+    fprintf(fp, "<aspace type=\"total\" size=\"%" PRIu64 "\"/>\n", system);
+    fprintf(fp, "<aspace type=\"mprotect\" size=\"%" PRIu64 "\"/>\n", system);
+    fprintf(fp, "</malloc>\n");
+    return OK;
+}
+
+/* Releases free pages in zones and free big zones back
+ * to the kernel. The pad argument is ignored because
+ * there is no single top of heap to leave padding at.
+ * Returns 1 if any memory was released, 0 otherwise */
+EXTERNAL_API int malloc_trim(size_t pad) {
+    return (_iso_alloc_trim() != 0) ? 1 : 0;
+}
+
+/* IsoAlloc has no tunables that map onto the glibc
+ * ones. Known parameters are accepted and ignored so
+ * programs that tune glibc keep working. Unknown
+ * parameters are rejected like glibc does */
+EXTERNAL_API int mallopt(int param, int value) {
+    if(param == M_MXFAST || param == M_TRIM_THRESHOLD || param == M_TOP_PAD ||
+       param == M_MMAP_THRESHOLD || param == M_MMAP_MAX || param == M_CHECK_ACTION ||
+       param == M_PERTURB || param == M_ARENA_TEST || param == M_ARENA_MAX) {
+        return 1;
+    }
+
+    return 0;
+}
+#endif
+
 static void *libc_malloc(size_t s, const void *caller) {
-    return iso_alloc(s);
+    return malloc(s);
 }
 static void *libc_realloc(void *ptr, size_t s, const void *caller) {
-    return iso_realloc(ptr, s);
+    return realloc(ptr, s);
 }
 static void libc_free(void *ptr, const void *caller) {
-    iso_free(ptr);
+    free(ptr);
 }
 static void *libc_memalign(size_t align, size_t s, const void *caller) {
-    return iso_alloc(s);
+    return memalign(align, s);
 }
 
 void *(*__malloc_hook)(size_t, const void *) = &libc_malloc;
@@ -0,0 +1,50 @@
+/* iso_alloc adaptive_zones_test.c
+ * Copyright 2021 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+
+#define ALLOCATIONS (ADAPTIVE_WINDOW * (ADAPTIVE_SUSTAIN_WINDOWS + 1))
+
+int main(int argc, char *argv[]) {
+#if ADAPTIVE_ZONES
+    /* 80 byte chunks waste over a third of a 128 byte chunk */
+    void *p = iso_alloc(80);
+
+    if(iso_chunksz(p) <= 80) {
+        LOG_AND_ABORT("Allocation of 80 bytes should start out in a power of 2 zone, got %d", iso_chunksz(p));
+    }
+
+    iso_free(p);
+
+    for(int32_t i = 0; i < ALLOCATIONS; i++) {
+        p = iso_alloc(80);
+        iso_free(p);
+    }
+
+    p = iso_alloc(80);
+
+    if(iso_chunksz(p) != 80) {
+        LOG_AND_ABORT("Sustained allocations of 80 bytes should get a dedicated zone, got %d", iso_chunksz(p));
+    }
+
+    iso_free(p);
+
+    /* 120 bytes doesn't waste enough of a 128 byte chunk */
+    for(int32_t i = 0; i < ALLOCATIONS; i++) {
+        p = iso_alloc(120);
+        iso_free(p);
+    }
+
+    p = iso_alloc(120);
+
+    if(iso_chunksz(p) == 120) {
+        LOG_AND_ABORT("Allocations of 120 bytes should not get a dedicated zone");
+    }
+
+    iso_free(p);
+    iso_verify_zones();
+#endif
+
+    return 0;
+}
@@ -0,0 +1,181 @@
+/* iso_alloc allocator_tests.cpp
+ * Copyright 2021 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.hpp"
+#include "iso_alloc_internal.h"
+#include <list>
+#include <map>
+#include <memory_resource>
+#include <vector>
+
+#define NODES 10000
+
+typedef std::map<uint64_t, uint64_t, std::less<uint64_t>, iso::allocator<std::pair<const uint64_t, uint64_t>>> iso_map;
+
+int test_map() {
+    iso_map m;
+
+    for(uint64_t i = 0; i < NODES; i++) {
+        m[i] = i * 2;
+    }
+
+    for(uint64_t i = 0; i < NODES; i++) {
+        if(m[i] != i * 2) {
+            LOG_AND_ABORT("Map lost the value for key %lu", i);
+        }
+    }
+
+    for(uint64_t i = 0; i < NODES; i += 2) {
+        m.erase(i);
+    }
+
+    if(m.size() != NODES / 2) {
+        LOG_AND_ABORT("Map has %lu nodes, expected %d", m.size(), NODES / 2);
+    }
+
+    return OK;
+}
+
+/* Single objects come from the zone made for the type */
+int test_type_zone() {
+    iso::allocator<uint64_t> a;
+    uint64_t *p[NODES];
+
+    for(int i = 0; i < NODES; i++) {
+        p[i] = a.allocate(1);
+        *p[i] = i;
+    }
+
+    if(iso_alloc_detect_zone_leaks(iso::type_zone<uint64_t>::get()) != NODES) {
+        LOG_AND_ABORT("Expected all %d chunks in the zone for uint64_t", NODES);
+    }
+
+    for(int i = 0; i < NODES; i++) {
+        a.deallocate(p[i], 1);
+    }
+
+    return OK;
+}
+
+int test_list() {
+    std::list<uint64_t, iso::allocator<uint64_t>> l;
+
+    for(uint64_t i = 0; i < NODES; i++) {
+        l.push_back(i);
+    }
+
+    uint64_t i = 0;
+
+    for(auto v : l) {
+        if(v != i++) {
+            LOG_AND_ABORT("List value %lu is out of order", v);
+        }
+    }
+
+    l.clear();
+    return OK;
+}
+
+/* n > 1 requests fall back to iso_alloc */
+int test_vector() {
+    std::vector<uint64_t, iso::allocator<uint64_t>> v;
+
+    for(uint64_t i = 0; i < NODES; i++) {
+        v.push_back(i);
+    }
+
+    if(v[NODES - 1] != NODES - 1) {
+        LOG_AND_ABORT("Vector lost its last value");
+    }
+
+    return OK;
+}
+
+int test_zone_resource() {
+    iso::zone_resource r(ZONE_64);
+    void *p[NODES];
+
+    for(int i = 0; i < NODES; i++) {
+        p[i] = r.allocate(ZONE_64 - (i % 32), alignof(uint64_t));
+        memset(p[i], 0x41, ZONE_64 - (i % 32));
+    }
+
+    if(iso_alloc_detect_zone_leaks(r.zone()) != NODES) {
+        LOG_AND_ABORT("Expected all %d chunks in the private zone", NODES);
+    }
+
+    for(int i = 0; i < NODES; i++) {
+        r.deallocate(p[i], ZONE_64 - (i % 32), alignof(uint64_t));
+    }
+
+    /* Too large for the zone */
+    void *big = r.allocate(ZONE_64 * 4);
+    r.deallocate(big, ZONE_64 * 4);
+
+    {
+        std::pmr::list<uint64_t> l(&r);
+        std::pmr::map<uint64_t, uint64_t> m(&r);
+
+        for(uint64_t i = 0; i < NODES; i++) {
+            l.push_back(i);
+            m[i] = i;
+        }
+
+        if(iso_alloc_detect_zone_leaks(r.zone()) != NODES * 2) {
+            LOG_AND_ABORT("Expected every node in the private zone");
+        }
+    }
+
+    if(iso_alloc_detect_zone_leaks(r.zone()) != 0) {
+        LOG_AND_ABORT("Private zone still has chunks in use");
+    }
+
+    return OK;
+}
+
+struct pooled_object {
+    static uint64_t constructed;
+    uint64_t id;
+    uint64_t uses;
+
+    pooled_object() noexcept : id(++constructed), uses(0) {}
+};
+
+uint64_t pooled_object::constructed;
+
+int test_object_pool() {
+    iso::object_pool<pooled_object> pool;
+    pooled_object *p[NODES];
+
+    for(int i = 0; i < NODES; i++) {
+        p[i] = pool.get();
+        p[i]->uses++;
+    }
+
+    for(int i = 0; i < NODES; i++) {
+        pool.put(p[i]);
+    }
+
+    uint64_t constructed = pooled_object::constructed;
+
+    /* The most recently put back object comes out first
+     * and keeps its state */
+    pooled_object *o = pool.get();
+
+    if(o != p[NODES - 1] || o->uses != 1 || pooled_object::constructed != constructed) {
+        LOG_AND_ABORT("Expected a cached object without running the constructor");
+    }
+
+    pool.put(o);
+    return OK;
+}
+
+int main(int argc, char *argv[]) {
+    test_type_zone();
+    test_map();
+    test_list();
+    test_vector();
+    test_zone_resource();
+    test_object_pool();
+    return OK;
+}
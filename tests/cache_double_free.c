@@ -0,0 +1,13 @@
+/* iso_alloc cache_double_free.c
+ * Copyright 2021 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+
+int main(int argc, char *argv[]) {
+    iso_cache_handle *cache = iso_cache_create(128, NULL, NULL);
+    void *p = iso_cache_alloc(cache);
+    iso_cache_free(cache, p);
+    iso_cache_free(cache, p);
+    return OK;
+}
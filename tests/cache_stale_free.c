@@ -0,0 +1,28 @@
+/* iso_alloc cache_stale_free.c
+ * Copyright 2021 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+
+/* Two magazines are held by this thread and the depot
+ * keeps CACHE_DEPOT_MAX full ones. The magazine after
+ * those is flushed back to the zone */
+#define OBJECTS (CACHE_MAGAZINE_SZ * (CACHE_DEPOT_MAX + 3))
+#define FLUSHED (CACHE_MAGAZINE_SZ * CACHE_DEPOT_MAX)
+
+int main(int argc, char *argv[]) {
+    iso_cache_handle *cache = iso_cache_create(128, NULL, NULL);
+    void *p[OBJECTS];
+
+    for(int32_t i = 0; i < OBJECTS; i++) {
+        p[i] = iso_cache_alloc(cache);
+    }
+
+    for(int32_t i = 0; i < OBJECTS; i++) {
+        iso_cache_free(cache, p[i]);
+    }
+
+    /* This object is free in its zone, not cached */
+    iso_cache_free(cache, p[FLUSHED]);
+    return OK;
+}
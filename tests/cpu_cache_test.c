@@ -0,0 +1,153 @@
+/* iso_alloc cpu_cache_test.c
+ * Copyright 2021 - chris.rohlf@gmail.com */
+
+/* For sched_setaffinity */
+#define _GNU_SOURCE
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+
+#define THREADS 4
+#define CHUNKS 64
+
+#if PER_CPU_CACHE
+static void *churn(void *arg) {
+    void *p[CHUNKS];
+
+    for(int32_t i = 0; i < 10000; i++) {
+        for(int32_t j = 0; j < CHUNKS; j++) {
+            size_t size = ZONE_16 << (j % 8);
+            p[j] = iso_alloc(size);
+            memset(p[j], 0x41, size);
+        }
+
+        for(int32_t j = 0; j < CHUNKS; j++) {
+            iso_free(p[j]);
+        }
+    }
+
+    return NULL;
+}
+#endif
+
+int main(int argc, char *argv[]) {
+#if PER_CPU_CACHE
+    struct iso_alloc_stats before, after;
+    void *p[PER_CPU_CACHE_SZ * 2];
+    cpu_set_t cpus, all_cpus;
+
+    /* Every chunk has to be free'd and allocated on the
+     * same core for the cache to hand it back */
+    sched_getaffinity(0, sizeof(all_cpus), &all_cpus);
+    CPU_ZERO(&cpus);
+    CPU_SET(sched_getcpu(), &cpus);
+
+    if(sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+        LOG_AND_ABORT("Failed to pin the test to one CPU");
+    }
+
+    /* A free'd chunk is handed back out by the cache and
+     * stays counted as in use while it is cached. Frees
+     * into the cache don't take the root lock but are
+     * still counted */
+    iso_alloc_get_stats(&before);
+    void *c = iso_alloc(ZONE_64);
+    iso_free(c);
+    void *r = iso_alloc(ZONE_64);
+    iso_alloc_get_stats(&after);
+
+    if(r != c || after.cpu_cache_hits != before.cpu_cache_hits + 1) {
+        LOG_AND_ABORT("Expected chunk 0x%p back from the CPU cache, got 0x%p", c, r);
+    }
+
+    if(after.bytes_in_use != before.bytes_in_use + ZONE_64) {
+        LOG_AND_ABORT("Expected %d more bytes in use, got %lu", ZONE_64, after.bytes_in_use - before.bytes_in_use);
+    }
+
+    if(after.frees[STATS_SIZE_CLASS(ZONE_64)] != before.frees[STATS_SIZE_CLASS(ZONE_64)] + 1) {
+        LOG_AND_ABORT("Expected the free into the CPU cache to be counted");
+    }
+
+    iso_free(r);
+
+    /* Only PER_CPU_CACHE_SZ chunks of a size class are
+     * cached, the rest go back to their zone */
+    for(int32_t i = 0; i < PER_CPU_CACHE_SZ * 2; i++) {
+        p[i] = iso_alloc(ZONE_128);
+    }
+
+    for(int32_t i = 0; i < PER_CPU_CACHE_SZ * 2; i++) {
+        iso_free(p[i]);
+    }
+
+    iso_alloc_get_stats(&before);
+
+    for(int32_t i = 0; i < PER_CPU_CACHE_SZ * 2; i++) {
+        p[i] = iso_alloc(ZONE_128);
+    }
+
+    iso_alloc_get_stats(&after);
+
+    if(after.cpu_cache_hits - before.cpu_cache_hits != PER_CPU_CACHE_SZ) {
+        LOG_AND_ABORT("Expected %d CPU cache hits, got %lu", PER_CPU_CACHE_SZ, after.cpu_cache_hits - before.cpu_cache_hits);
+    }
+
+    for(int32_t i = 0; i < PER_CPU_CACHE_SZ * 2; i++) {
+        iso_free(p[i]);
+    }
+
+    /* Leak detection flushes every cached chunk back to
+     * its zone, so the next allocation misses the cache */
+    iso_alloc_detect_leaks();
+    iso_verify_zones();
+    iso_alloc_get_stats(&before);
+    r = iso_alloc(ZONE_128);
+    iso_alloc_get_stats(&after);
+
+    if(after.cpu_cache_hits != before.cpu_cache_hits || after.bytes_in_use != before.bytes_in_use + ZONE_128) {
+        LOG_AND_ABORT("Expected the CPU cache to be empty after a flush");
+    }
+
+    iso_free(r);
+
+    /* Chunks from custom zones are never cached */
+    iso_alloc_zone_handle *zone = iso_alloc_new_zone(ZONE_256);
+    c = iso_alloc_from_zone(zone, ZONE_256);
+    iso_free(c);
+    iso_alloc_get_stats(&before);
+    r = iso_alloc(ZONE_256);
+    iso_alloc_get_stats(&after);
+
+    if(r == c || after.cpu_cache_hits != before.cpu_cache_hits) {
+        LOG_AND_ABORT("Chunk from a custom zone was kept in the CPU cache");
+    }
+
+    iso_free(r);
+    iso_alloc_destroy_zone(zone);
+
+    /* Let the threads run on every core again */
+    sched_setaffinity(0, sizeof(all_cpus), &all_cpus);
+
+    pthread_t t[THREADS];
+    iso_alloc_get_stats(&before);
+
+    for(int32_t i = 0; i < THREADS; i++) {
+        pthread_create(&t[i], NULL, churn, NULL);
+    }
+
+    for(int32_t i = 0; i < THREADS; i++) {
+        pthread_join(t[i], NULL);
+    }
+
+    iso_alloc_get_stats(&after);
+
+    if(after.cpu_cache_hits == before.cpu_cache_hits) {
+        LOG_AND_ABORT("No allocation from the threads was served by a CPU cache");
+    }
+
+    iso_alloc_detect_leaks();
+    iso_verify_zones();
+#endif
+
+    return OK;
+}
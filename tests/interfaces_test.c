@@ -6,6 +6,10 @@
 
 #include <assert.h>
 
+#if MALLOC_HOOK && __GLIBC__
+#include <malloc.h>
+#endif
+
 int main(int argc, char *argv[]) {
     /* Test iso_calloc() */
     void *p = iso_calloc(10, 2);
@@ -61,6 +65,102 @@ int main(int argc, char *argv[]) {
 
     iso_free(p);
 
+    /* Fill the zone, free some chunks and reset it. Every
+     * chunk should be usable again */
+    void **zone_chunks = calloc(ZONE_USER_SIZE / 256, sizeof(void *));
+
+    for(int32_t r = 0; r < 4; r++) {
+        size_t count = 0;
+
+        while((zone_chunks[count] = iso_alloc_from_zone(zone, 256)) != NULL) {
+            memset(zone_chunks[count], 0x41, 256);
+            count++;
+        }
+
+        if(count < (ZONE_USER_SIZE / 256) / 2) {
+            LOG_AND_ABORT("Only allocated %d chunks after reset %d", count, r);
+        }
+
+        for(size_t i = 0; i < count; i += 3) {
+            iso_free(zone_chunks[i]);
+        }
+
+        iso_alloc_zone_reset(zone, (r & 1) ? ISO_ZONE_RESET_RELEASE : 0);
+        iso_verify_zone(zone);
+
+        if(iso_alloc_detect_zone_leaks(zone) != 0) {
+            LOG_AND_ABORT("Zone still has chunks in use after a reset");
+        }
+    }
+
+    free(zone_chunks);
+
+    iso_alloc_destroy_zone(zone);
+
+    /* A trusted zone hands out chunks in address order and
+     * ignores a double free */
+    iso_alloc_zone_configuration trusted = {0};
+    zone = iso_alloc_new_zone_with_config(128, &trusted);
+
+    if(zone == NULL) {
+        LOG_AND_ABORT("Could not create a zone with a configuration");
+    }
+
+    uint8_t *seq[1024];
+    int32_t adjacent = 0;
+
+    for(int32_t i = 0; i < 1024; i++) {
+        seq[i] = iso_alloc_from_zone(zone, 128);
+
+        if(seq[i] == NULL || (i != 0 && seq[i] <= seq[i - 1])) {
+            LOG_AND_ABORT("Zone without a random allocation pattern returned 0x%p after 0x%p", seq[i], seq[i - 1]);
+        }
+
+        if(i != 0 && seq[i] == seq[i - 1] + 128) {
+            adjacent++;
+        }
+    }
+
+    /* Only canary chunks are skipped */
+    if(adjacent < 1000) {
+        LOG_AND_ABORT("Only %d of 1024 sequential chunks were adjacent", adjacent);
+    }
+
+    /* Free'd chunks are reused last in first out */
+    iso_free(seq[10]);
+    iso_free(seq[20]);
+
+    if(iso_alloc_from_zone(zone, 128) != seq[20] || iso_alloc_from_zone(zone, 128) != seq[10]) {
+        LOG_AND_ABORT("Free'd chunks were not reused last in first out");
+    }
+
+    iso_free(seq[0]);
+    iso_free(seq[0]);
+    iso_verify_zone(zone);
+
+    /* A reset starts again from the start of the zone */
+    iso_alloc_zone_reset(zone, 0);
+
+    if(iso_alloc_from_zone(zone, 128) != seq[0]) {
+        LOG_AND_ABORT("Sequential zone did not start over after a reset");
+    }
+
+    iso_alloc_destroy_zone(zone);
+
+    iso_alloc_zone_configuration hardened = {true, true, true, true, true};
+    zone = iso_alloc_new_zone_with_config(128, &hardened);
+    uint8_t *c = iso_alloc_from_zone(zone, 128);
+    memset(c, 0x41, 128);
+    iso_free(c);
+
+    /* The canaries are written over the first and last 8 bytes */
+    for(int32_t i = 8; i < 120; i++) {
+        if(c[i] != POISON_BYTE) {
+            LOG_AND_ABORT("Chunk was not cleared on free");
+        }
+    }
+
+    iso_verify_zone(zone);
     iso_alloc_destroy_zone(zone);
 
     p = iso_alloc(1024);
@@ -80,6 +180,218 @@ int main(int argc, char *argv[]) {
     iso_free(p);
     iso_free(r);
 
+    /* Test iso_alloc_near() */
+    uint8_t *hint = iso_alloc(64);
+    void *near[64];
+
+    for(int32_t i = 0; i < 64; i++) {
+        near[i] = iso_alloc_near(hint, 64);
+        memset(near[i], 0x41, 64);
+    }
+
+    /* The window around the hint holds 3 pages of chunks
+     * minus canaries and chunks already in use, so only
+     * the first few are guaranteed to be close to it */
+    for(int32_t i = 0; i < 8; i++) {
+        uint8_t *n = near[i];
+
+        if(iso_chunksz(n) != iso_chunksz(hint) || (n > hint ? n - hint : hint - n) >= (2 * sysconf(_SC_PAGESIZE))) {
+            LOG_AND_ABORT("iso_alloc_near returned 0x%p which is not near 0x%p", n, hint);
+        }
+    }
+
+    /* Chunks taken near the hint must not be handed out
+     * again by the free bit slot cache */
+    void *more[1024];
+
+    for(int32_t i = 0; i < 1024; i++) {
+        more[i] = iso_alloc(64);
+    }
+
+    for(int32_t i = 0; i < 1024; i++) {
+        iso_free(more[i]);
+    }
+
+    for(int32_t i = 0; i < 64; i++) {
+        iso_free(near[i]);
+    }
+
+    iso_free(hint);
+    iso_free(iso_alloc_near(NULL, 64));
+
+    struct iso_alloc_stats before, after;
+
+#if ALLOC_STATS
+    /* Test iso_alloc_get_stats() */
+    uint64_t allocs_before = 0, allocs_after = 0;
+
+    if(iso_alloc_get_stats(&before) != OK) {
+        LOG_AND_ABORT("iso_alloc_get_stats failed");
+    }
+
+    p = iso_alloc(64);
+    iso_alloc_get_stats(&after);
+
+    for(int32_t i = 0; i < ISO_ALLOC_STATS_SIZE_CLASSES; i++) {
+        allocs_before += before.allocs[i];
+        allocs_after += after.allocs[i];
+    }
+
+    if(allocs_after <= allocs_before || after.zones_created == 0 || after.bytes_in_use < 64) {
+        LOG_AND_ABORT("iso_alloc_get_stats did not count an allocation of 64 bytes");
+    }
+
+    iso_free(p);
+#endif
+
+    /* A zone reset counts every chunk it frees */
+    zone = iso_alloc_new_zone(256);
+
+    for(int32_t i = 0; i < 1000; i++) {
+        iso_alloc_from_zone(zone, 256);
+    }
+
+    iso_alloc_get_stats(&before);
+    iso_alloc_zone_reset(zone, 0);
+    iso_alloc_get_stats(&after);
+
+#if ALLOC_STATS
+    if(before.bytes_in_use - after.bytes_in_use != 256000) {
+        LOG_AND_ABORT("iso_alloc_zone_reset did not subtract 256000 bytes in use");
+    }
+#endif
+
+    iso_alloc_destroy_zone(zone);
+
+    /* Test iso_alloc_reserve(). The reserved zones must
+     * serve every allocation without creating a zone */
+    void *reserved[2048];
+
+    if(iso_alloc_reserve(ZONE_8192, 2048) != OK) {
+        LOG_AND_ABORT("iso_alloc_reserve failed");
+    }
+
+    iso_alloc_get_stats(&before);
+
+    for(int32_t i = 0; i < 2048; i++) {
+        reserved[i] = iso_alloc(ZONE_8192);
+    }
+
+    iso_alloc_get_stats(&after);
+
+#if ALLOC_STATS
+    if(after.extra_slow_path_hits != before.extra_slow_path_hits) {
+        LOG_AND_ABORT("Created a zone after reserving 2048 chunks of %d bytes", ZONE_8192);
+    }
+#endif
+
+    for(int32_t i = 0; i < 2048; i++) {
+        iso_free(reserved[i]);
+    }
+
+#if THREAD_SUPPORT && ALLOC_STATS
+    /* Test iso_alloc_set_watermark(). The provisioner
+     * thread creates a zone for a size no zone serves.
+     * Starting the thread allocates too, so it is started
+     * with a watermark the default zones already meet */
+    iso_alloc_set_watermark(ZONE_64, 1);
+    usleep(100000);
+    iso_alloc_get_stats(&before);
+
+    if(iso_alloc_set_watermark(20000, 64) != OK) {
+        LOG_AND_ABORT("iso_alloc_set_watermark failed");
+    }
+
+    for(int32_t i = 0; i < 1000; i++) {
+        iso_alloc_get_stats(&after);
+
+        if(after.zones_created > before.zones_created) {
+            break;
+        }
+
+        usleep(1000);
+    }
+
+    p = iso_alloc(20000);
+    iso_alloc_get_stats(&after);
+
+    if(after.zones_created == before.zones_created || after.extra_slow_path_hits != before.extra_slow_path_hits) {
+        LOG_AND_ABORT("The provisioner thread did not create a zone for 20000 byte chunks");
+    }
+
+    iso_free(p);
+
+    /* Taking the size below its mark wakes the thread,
+     * which adds a zone before any allocation needs one */
+    void *w[ZONE_USER_SIZE / 20000];
+    int32_t taken = 0;
+    before = after;
+
+    for(; taken < ZONE_USER_SIZE / 20000; taken++) {
+        w[taken] = iso_alloc(20000);
+        usleep(100);
+        iso_alloc_get_stats(&after);
+
+        if(after.zones_created > before.zones_created) {
+            break;
+        }
+    }
+
+    if(after.zones_created == before.zones_created || after.extra_slow_path_hits != before.extra_slow_path_hits) {
+        LOG_AND_ABORT("The provisioner thread did not add a zone before 20000 byte chunks ran out");
+    }
+
+    for(int32_t i = 0; i <= taken && i < ZONE_USER_SIZE / 20000; i++) {
+        iso_free(w[i]);
+    }
+
+    iso_alloc_set_watermark(20000, 0);
+    iso_alloc_set_watermark(ZONE_64, 0);
+#endif
+
+#if MALLOC_HOOK && __GLIBC__
+    /* Test the glibc malloc introspection hooks */
+    void *chunks[64];
+    struct mallinfo2 mi_before = mallinfo2();
+
+    for(int32_t i = 0; i < 64; i++) {
+        chunks[i] = iso_alloc(4096);
+        memset(chunks[i], 0x41, 4096);
+    }
+
+    struct mallinfo2 mi_after = mallinfo2();
+
+    if(mi_after.uordblks < mi_before.uordblks + (64 * 4096)) {
+        LOG_AND_ABORT("mallinfo2 did not report 64 chunks of 4096 bytes in use");
+    }
+
+    for(int32_t i = 0; i < 64; i++) {
+        iso_free(chunks[i]);
+    }
+
+    if(malloc_trim(0) != 1) {
+        LOG_AND_ABORT("malloc_trim did not release any pages");
+    }
+
+    /* Trimmed chunks must be usable again */
+    for(int32_t i = 0; i < 64; i++) {
+        chunks[i] = iso_alloc(4096);
+        memset(chunks[i], 0x42, 4096);
+    }
+
+    for(int32_t i = 0; i < 64; i++) {
+        iso_free(chunks[i]);
+    }
+
+    if(malloc_info(0, stdout) != 0 || malloc_info(1, stdout) == 0) {
+        LOG_AND_ABORT("malloc_info returned an unexpected value");
+    }
+
+    if(mallopt(M_ARENA_MAX, 1) != 1) {
+        LOG_AND_ABORT("mallopt rejected M_ARENA_MAX");
+    }
+#endif
+
     iso_verify_zones();
 
     return 0;
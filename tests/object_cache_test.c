@@ -0,0 +1,134 @@
+/* iso_alloc object_cache_test.c
+ * Copyright 2021 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+
+#define OBJECT_MAGIC 0x4f424a4543544f4b
+#define OBJECTS 4096
+#define THREADS 4
+
+typedef struct {
+    uint64_t magic;
+    uint64_t uses;
+    uint8_t buffer[240];
+} test_object;
+
+static uint64_t ctor_calls;
+static uint64_t dtor_calls;
+
+static void test_object_ctor(void *p) {
+    test_object *o = (test_object *) p;
+    o->magic = OBJECT_MAGIC;
+    o->uses = 0;
+    __atomic_fetch_add(&ctor_calls, 1, __ATOMIC_RELAXED);
+}
+
+static void test_object_dtor(void *p) {
+    test_object *o = (test_object *) p;
+
+    if(o->magic != OBJECT_MAGIC) {
+        LOG_AND_ABORT("Destructing an object that was not constructed");
+    }
+
+    o->magic = 0;
+    __atomic_fetch_add(&dtor_calls, 1, __ATOMIC_RELAXED);
+}
+
+static iso_cache_handle *cache;
+
+static void *churn(void *arg) {
+    test_object *objects[64];
+
+    for(int32_t i = 0; i < OBJECTS; i++) {
+        for(int32_t j = 0; j < 64; j++) {
+            objects[j] = iso_cache_alloc(cache);
+
+            if(objects[j] == NULL || objects[j]->magic != OBJECT_MAGIC) {
+                LOG_AND_ABORT("Object cache returned an unconstructed object");
+            }
+
+            objects[j]->uses++;
+        }
+
+        for(int32_t j = 0; j < 64; j++) {
+            iso_cache_free(cache, objects[j]);
+        }
+    }
+
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    cache = iso_cache_create(sizeof(test_object), test_object_ctor, test_object_dtor);
+
+    if(cache == NULL) {
+        LOG_AND_ABORT("Failed to create an object cache");
+    }
+
+    /* Objects keep their state across free and alloc */
+    test_object *o = iso_cache_alloc(cache);
+    o->uses = 1;
+    iso_cache_free(cache, o);
+
+    test_object *r = iso_cache_alloc(cache);
+
+    if(r != o || r->uses != 1 || ctor_calls != 1) {
+        LOG_AND_ABORT("Expected the cached object back without calling the constructor");
+    }
+
+    iso_cache_free(cache, r);
+
+    /* More objects than the magazines hold spill into the
+     * depot and back into the zone */
+    test_object **objects = calloc(OBJECTS, sizeof(test_object *));
+
+    for(int32_t i = 0; i < OBJECTS; i++) {
+        objects[i] = iso_cache_alloc(cache);
+    }
+
+    for(int32_t i = 0; i < OBJECTS; i++) {
+        iso_cache_free(cache, objects[i]);
+    }
+
+    if(dtor_calls == 0) {
+        LOG_AND_ABORT("Expected objects beyond the depot to be destructed");
+    }
+
+    uint64_t constructed = ctor_calls;
+
+    for(int32_t i = 0; i < OBJECTS; i++) {
+        objects[i] = iso_cache_alloc(cache);
+    }
+
+    for(int32_t i = 0; i < OBJECTS; i++) {
+        iso_cache_free(cache, objects[i]);
+    }
+
+    free(objects);
+
+    if(ctor_calls - constructed >= OBJECTS) {
+        LOG_AND_ABORT("Every object was constructed again");
+    }
+
+    pthread_t t[THREADS];
+
+    for(int32_t i = 0; i < THREADS; i++) {
+        pthread_create(&t[i], NULL, churn, NULL);
+    }
+
+    for(int32_t i = 0; i < THREADS; i++) {
+        pthread_join(t[i], NULL);
+    }
+
+    /* Every object made is destructed exactly once */
+    iso_cache_destroy(cache);
+
+    if(ctor_calls != dtor_calls) {
+        LOG_AND_ABORT("Constructed %lu objects but destructed %lu", ctor_calls, dtor_calls);
+    }
+
+    iso_verify_zones();
+
+    return OK;
+}
@@ -0,0 +1,140 @@
+/* iso_alloc packed_bitmaps_test.c
+ * Copyright 2021 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+
+#define ZONES 64
+
+/* The zone pool thread maps zones ahead of time */
+#if ZONE_POOL
+#define PREMAPPED_MAPPINGS ((ZONE_POOL_SZ + 1) * 4)
+#else
+#define PREMAPPED_MAPPINGS 0
+#endif
+
+#if PACKED_BITMAPS && __linux__
+static int32_t count_mappings(void) {
+    FILE *f = fopen("/proc/self/maps", "r");
+    int32_t count = 0;
+    int32_t c;
+
+    if(f == NULL) {
+        LOG_AND_ABORT("Cannot open /proc/self/maps");
+    }
+
+    while((c = fgetc(f)) != EOF) {
+        if(c == '\n') {
+            count++;
+        }
+    }
+
+    fclose(f);
+    return count;
+}
+#endif
+
+int main(int argc, char *argv[]) {
+#if PACKED_BITMAPS && __linux__
+    iso_alloc_zone_handle *zones[ZONES];
+    size_t sizes[] = {ZONE_2048, ZONE_8192, SMALL_SZ_MAX / 2, SMALL_SZ_MAX};
+
+    /* Make sure the root and the first bitmap arena exist */
+    iso_free(iso_alloc(ZONE_64));
+    zones[0] = iso_alloc_new_zone(SMALL_SZ_MAX);
+
+    int32_t before = count_mappings();
+
+    for(int32_t i = 1; i < ZONES; i++) {
+        zones[i] = iso_alloc_new_zone(sizes[i % 4]);
+    }
+
+    /* Each zone adds its user pages and their guard pages
+     * but no bitmap pages */
+    int32_t mappings = count_mappings() - before;
+
+    if(mappings > ((ZONES - 1) * 3) + PREMAPPED_MAPPINGS) {
+        LOG_AND_ABORT("%d zones added %d mappings", ZONES - 1, mappings);
+    }
+
+    for(int32_t i = 0; i < ZONES; i++) {
+        size_t size = (i == 0) ? SMALL_SZ_MAX : sizes[i % 4];
+        void *p[32];
+
+        for(int32_t j = 0; j < 32; j++) {
+            p[j] = iso_alloc_from_zone(zones[i], size);
+            memset(p[j], 0x41, size);
+        }
+
+        for(int32_t j = 0; j < 32; j++) {
+            iso_free(p[j]);
+        }
+
+        iso_verify_zone(zones[i]);
+        iso_alloc_destroy_zone(zones[i]);
+    }
+
+    /* Large chunks from the default zones */
+    for(int32_t i = 0; i < 1024; i++) {
+        void *p = iso_alloc(ZONE_4096 + (i % 4) * ZONE_1024);
+        memset(p, 0x42, ZONE_4096);
+        iso_free(p);
+    }
+
+    /* A destroyed zone gives its pages back to the OS before
+     * it is primed for reuse. The zone next to it in the
+     * bitmap arena keeps its bitmap */
+    iso_alloc_zone_handle *keep = iso_alloc_new_zone(ZONE_2048);
+    iso_alloc_zone_handle *gone = iso_alloc_new_zone(ZONE_2048);
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    void *k[32];
+    void *g[32];
+    int32_t resident = 0;
+
+    for(int32_t j = 0; j < 32; j++) {
+        k[j] = iso_alloc_from_zone(keep, ZONE_2048);
+        g[j] = iso_alloc_from_zone(gone, ZONE_2048);
+        memset(k[j], 0x43, ZONE_2048);
+        memset(g[j], 0x44, ZONE_2048);
+    }
+
+    for(int32_t j = 0; j < 32; j++) {
+        iso_free(g[j]);
+    }
+
+    iso_alloc_destroy_zone(gone);
+
+    for(int32_t j = 0; j < 32; j++) {
+        unsigned char vec = 0;
+
+        if(mincore((void *) ((uintptr_t) g[j] & ~(page_size - 1)), page_size, &vec) != 0) {
+            LOG_AND_ABORT("mincore failed for 0x%p", g[j]);
+        }
+
+        resident += (vec & 1);
+    }
+
+    if(resident == 32) {
+        LOG_AND_ABORT("The pages of a destroyed zone were not given back");
+    }
+
+    /* The destroyed zone is reused for allocations of its
+     * size and its canaries have to survive the madvise */
+    for(int32_t i = 0; i < 8192; i++) {
+        void *p = iso_alloc(ZONE_2048);
+        memset(p, 0x45, ZONE_2048);
+        iso_free(p);
+    }
+
+    iso_verify_zone(keep);
+
+    for(int32_t j = 0; j < 32; j++) {
+        iso_free(k[j]);
+    }
+
+    iso_alloc_destroy_zone(keep);
+    iso_verify_zones();
+#endif
+
+    return OK;
+}
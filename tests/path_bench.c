@@ -0,0 +1,361 @@
+/* iso_alloc path_bench.c
+ * Copyright 2021 - chris.rohlf@gmail.com */
+
+/* Microbenchmarks for the individual paths inside the
+ * allocator. Each benchmark puts the allocator into a
+ * known state, times one path in isolation and checks
+ * the allocator statistics to make sure the intended
+ * path was taken. It must be built with the library
+ * sources, UNIT_TESTING and ALLOC_STATS. One JSON object
+ * is printed per path with the minimum, median and mean
+ * cost of an operation in timer ticks. On x86_64 and
+ * aarch64 ticks come from the cycle counter, everywhere
+ * else they are nanoseconds */
+
+#include "iso_alloc_internal.h"
+#include "iso_alloc.h"
+#include <time.h>
+
+#if !UNIT_TESTING || !ALLOC_STATS
+#error "path_bench requires UNIT_TESTING and ALLOC_STATS"
+#endif
+
+#define SAMPLES 100000
+#define ZONE_SAMPLES 64
+#define EXTRA_ZONES 256
+#define SCAN_ZONE_FILL 90
+
+#if __x86_64__
+#define TICK_UNIT "tsc"
+static inline uint64_t ticks(void) {
+    return __builtin_ia32_rdtsc();
+}
+#elif __aarch64__
+#define TICK_UNIT "cntvct"
+static inline uint64_t ticks(void) {
+    uint64_t v;
+    __asm__ volatile("isb; mrs %0, cntvct_el0"
+                     : "=r"(v));
+    return v;
+}
+#else
+#define TICK_UNIT "ns"
+static inline uint64_t ticks(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+#endif
+
+static uint64_t samples[SAMPLES];
+static uint64_t overhead;
+static struct iso_alloc_stats before;
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+/* Prints the result for n samples with the cost of
+ * reading the timer taken out */
+static void report(const char *path, uint32_t n) {
+    uint64_t total = 0;
+
+    for(uint32_t i = 0; i < n; i++) {
+        samples[i] = (samples[i] > overhead) ? samples[i] - overhead : 0;
+        total += samples[i];
+    }
+
+    qsort(samples, n, sizeof(uint64_t), compare_u64);
+
+    fprintf(stdout, "{\"path\":\"%s\",\"unit\":\"%s\",\"ops\":%u,\"zones\":%d,\"min\":%" PRIu64 ",\"median\":%" PRIu64 ",\"mean\":%" PRIu64 "}\n",
+            path, TICK_UNIT, n, _get_root()->zones_used, samples[0], samples[n / 2], total / n);
+}
+
+static void stats_begin(void) {
+    iso_alloc_get_stats(&before);
+}
+
+/* Aborts unless the counter moved by at least min since
+ * stats_begin was called */
+#define EXPECT_STAT(field, min)                                                                   \
+    do {                                                                                          \
+        struct iso_alloc_stats after;                                                             \
+        iso_alloc_get_stats(&after);                                                              \
+        if((after.field - before.field) < (min)) {                                                \
+            LOG_AND_ABORT("Expected %d " #field " but only saw %d", (min), after.field - before.field); \
+        }                                                                                         \
+    } while(0)
+
+static void calibrate(void) {
+    for(uint32_t i = 0; i < SAMPLES; i++) {
+        uint64_t s = ticks();
+        samples[i] = ticks() - s;
+    }
+
+    qsort(samples, SAMPLES, sizeof(uint64_t), compare_u64);
+    overhead = samples[0];
+}
+
+/* The zone this thread just used is at the front of
+ * the thread zone cache */
+static void bench_thread_cache_hit(void) {
+    iso_free(iso_alloc(ZONE_64));
+    stats_begin();
+
+    for(uint32_t i = 0; i < SAMPLES; i++) {
+        uint64_t s = ticks();
+        void *p = iso_alloc(ZONE_64);
+        samples[i] = ticks() - s;
+        iso_free(p);
+    }
+
+    EXPECT_STAT(fast_path_hits, SAMPLES);
+    report("alloc_thread_cache_hit", SAMPLES);
+
+    for(uint32_t i = 0; i < SAMPLES; i++) {
+        void *p = iso_alloc(ZONE_64);
+        uint64_t s = ticks();
+        iso_free(p);
+        samples[i] = ticks() - s;
+    }
+
+    report("free_small", SAMPLES);
+}
+
+/* The default zone for the size is the first one the
+ * search looks at */
+static void bench_find_zone_fit(void) {
+    for(uint32_t i = 0; i < SAMPLES; i++) {
+        LOCK_ROOT();
+        uint64_t s = ticks();
+        iso_alloc_zone *zone = iso_find_zone_fit(ZONE_64);
+        samples[i] = ticks() - s;
+        UNLOCK_ROOT();
+
+        if(zone == NULL) {
+            LOG_AND_ABORT("No zone fits %d bytes", ZONE_64);
+        }
+    }
+
+    report("find_zone_fit_hit", SAMPLES);
+}
+
+/* Every zone is marked full so the search visits all
+ * of them and fails */
+static void bench_find_zone_fit_miss(void) {
+    iso_alloc_root *root = _get_root();
+    static bool is_full[MAX_ZONES];
+
+    LOCK_ROOT();
+
+    for(int32_t i = 0; i < root->zones_used; i++) {
+        is_full[i] = root->zones[i].is_full;
+        root->zones[i].is_full = true;
+    }
+
+    for(uint32_t i = 0; i < SAMPLES; i++) {
+        uint64_t s = ticks();
+        iso_alloc_zone *zone = iso_find_zone_fit(SMALLEST_ZONE);
+        samples[i] = ticks() - s;
+
+        if(zone != NULL) {
+            LOG_AND_ABORT("Found zone %d when every zone is full", zone->index);
+        }
+    }
+
+    for(int32_t i = 0; i < root->zones_used; i++) {
+        root->zones[i].is_full = is_full[i];
+    }
+
+    UNLOCK_ROOT();
+
+    report("find_zone_fit_miss", SAMPLES);
+}
+
+/* The zone has no next free bit slot and an empty free
+ * bit slot cache so it must be refilled from the bitmap */
+static void bench_cache_refill(void) {
+    LOCK_ROOT();
+    iso_alloc_zone *zone = iso_find_zone_fit(ZONE_64);
+    UNLOCK_ROOT();
+
+    stats_begin();
+
+    for(uint32_t i = 0; i < SAMPLES; i++) {
+        LOCK_ROOT();
+        zone->next_free_bit_slot = BAD_BIT_SLOT;
+        zone->free_bit_slot_cache_usable = zone->free_bit_slot_cache_index;
+
+        uint64_t s = ticks();
+        iso_alloc_zone *z = is_zone_usable(zone, ZONE_64);
+        samples[i] = ticks() - s;
+        UNLOCK_ROOT();
+
+        if(z == NULL) {
+            LOG_AND_ABORT("Zone[%d] has no free slots", zone->index);
+        }
+    }
+
+    EXPECT_STAT(cache_refills, SAMPLES);
+    report("free_bit_slot_cache_refill", SAMPLES);
+}
+
+/* A private zone is filled to SCAN_ZONE_FILL percent so
+ * the first free slot is deep into the bitmap */
+static void bench_bitmap_scan(void) {
+    iso_alloc_zone_handle *handle = iso_alloc_new_zone(ZONE_1024);
+    iso_alloc_zone *zone = (iso_alloc_zone *) ((uintptr_t) handle ^ (uintptr_t) _get_root()->zone_handle_mask);
+    uint32_t count = ((ZONE_USER_SIZE / ZONE_1024) * SCAN_ZONE_FILL) / 100;
+    void **chunks = calloc(count, sizeof(void *));
+
+    for(uint32_t i = 0; i < count; i++) {
+        chunks[i] = iso_alloc_from_zone(handle, ZONE_1024);
+    }
+
+    LOCK_ROOT();
+    UNMASK_ZONE_PTRS(zone);
+
+    for(uint32_t i = 0; i < SAMPLES; i++) {
+        uint64_t s = ticks();
+        bit_slot_t b = iso_scan_zone_free_slot(zone);
+        samples[i] = ticks() - s;
+
+        /* Canaries make a whole free dword unlikely in a
+         * zone this full, so the fast scan may fail */
+        (void) b;
+    }
+
+    MASK_ZONE_PTRS(zone);
+    UNLOCK_ROOT();
+    report("bitmap_scan", SAMPLES);
+
+    LOCK_ROOT();
+    UNMASK_ZONE_PTRS(zone);
+
+    for(uint32_t i = 0; i < SAMPLES; i++) {
+        uint64_t s = ticks();
+        bit_slot_t b = iso_scan_zone_free_slot_slow(zone);
+        samples[i] = ticks() - s;
+
+        if(b == BAD_BIT_SLOT) {
+            LOG_AND_ABORT("Zone[%d] has no free slots", zone->index);
+        }
+    }
+
+    MASK_ZONE_PTRS(zone);
+    UNLOCK_ROOT();
+    report("bitmap_scan_slow", SAMPLES);
+
+    for(uint32_t i = 0; i < count; i++) {
+        iso_free(chunks[i]);
+    }
+
+    free(chunks);
+    iso_alloc_destroy_zone(handle);
+}
+
+/* Zones made here stay around and are used to show how
+ * the free path scales with the number of zones */
+static void bench_new_zone(uint32_t n) {
+    stats_begin();
+
+    for(uint32_t i = 0; i < n; i++) {
+        LOCK_ROOT();
+        uint64_t s = ticks();
+        iso_alloc_zone *zone = _iso_new_zone(ZONE_2048 + (i % 4) * 16, true);
+        samples[i] = ticks() - s;
+        UNLOCK_ROOT();
+
+        if(zone == NULL) {
+            LOG_AND_ABORT("Failed to create a zone");
+        }
+    }
+
+    EXPECT_STAT(zones_created, n);
+    report("new_zone", n);
+}
+
+/* The chunk lives in the last zone so every zone is
+ * searched to find it */
+static void bench_find_zone_range(void) {
+    iso_alloc_root *root = _get_root();
+    iso_alloc_zone *zone = &root->zones[root->zones_used - 1];
+
+    LOCK_ROOT();
+    UNMASK_ZONE_PTRS(zone);
+    void *p = zone->user_pages_start + zone->chunk_size;
+    MASK_ZONE_PTRS(zone);
+    UNLOCK_ROOT();
+
+    for(uint32_t i = 0; i < SAMPLES; i++) {
+        LOCK_ROOT();
+        uint64_t s = ticks();
+        iso_alloc_zone *z = iso_find_zone_range(p);
+        samples[i] = ticks() - s;
+        UNLOCK_ROOT();
+
+        if(z != zone) {
+            LOG_AND_ABORT("Found the wrong zone for 0x%p", p);
+        }
+    }
+
+    report("find_zone_range", SAMPLES);
+}
+
+static void bench_big_zones(void) {
+    size_t size = SMALL_SZ_MAX * 4;
+    void *big[ZONE_SAMPLES];
+
+    /* Every allocation maps a new big zone */
+    stats_begin();
+
+    for(uint32_t i = 0; i < ZONE_SAMPLES; i++) {
+        uint64_t s = ticks();
+        big[i] = iso_alloc(size + (i * g_page_size));
+        samples[i] = ticks() - s;
+    }
+
+    EXPECT_STAT(big_zone_new, ZONE_SAMPLES);
+    report("big_alloc_new", ZONE_SAMPLES);
+
+    for(uint32_t i = 0; i < ZONE_SAMPLES; i++) {
+        iso_free(big[i]);
+    }
+
+    /* The big zone free'd by the previous iteration is
+     * large enough to be reused */
+    iso_free(iso_alloc(size));
+    stats_begin();
+
+    for(uint32_t i = 0; i < SAMPLES / 10; i++) {
+        uint64_t s = ticks();
+        void *p = iso_alloc(size);
+        samples[i] = ticks() - s;
+        iso_free(p);
+    }
+
+    EXPECT_STAT(big_zone_reuse_hits, SAMPLES / 10);
+    report("big_alloc_reuse", SAMPLES / 10);
+}
+
+int main(int argc, char *argv[]) {
+    /* Make sure the root exists */
+    iso_free(iso_alloc(ZONE_64));
+
+    calibrate();
+
+    bench_thread_cache_hit();
+    bench_find_zone_fit();
+    bench_cache_refill();
+    bench_bitmap_scan();
+    bench_find_zone_fit_miss();
+    bench_find_zone_range();
+    bench_new_zone(EXTRA_ZONES);
+    bench_find_zone_fit_miss();
+    bench_find_zone_range();
+    bench_big_zones();
+
+    return OK;
+}
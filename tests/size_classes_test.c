@@ -0,0 +1,70 @@
+/* iso_alloc size_classes_test.c
+ * Copyright 2021 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+
+int main(int argc, char *argv[]) {
+#if SIZE_CLASSES
+    if(SIZE_CLASS_SIZE(SIZE_CLASS_COUNT - 1) != SMALL_SZ_MAX) {
+        LOG_AND_ABORT("The largest size class should be %d bytes, got %d", SMALL_SZ_MAX, SIZE_CLASS_SIZE(SIZE_CLASS_COUNT - 1));
+    }
+
+    /* Every size must round up to the smallest class
+     * that can hold it */
+    for(size_t sz = 1; sz <= SMALL_SZ_MAX; sz++) {
+        size_t c = SIZE_CLASS(sz);
+
+        if(c >= SIZE_CLASS_COUNT || SIZE_CLASS_SIZE(c) < sz || (c != 0 && SIZE_CLASS_SIZE(c - 1) >= sz)) {
+            LOG_AND_ABORT("Size %d maps to the wrong size class %d", sz, c);
+        }
+
+        if(IS_ALIGNED(SIZE_CLASS_SIZE(c)) != 0) {
+            LOG_AND_ABORT("Size class %d is not aligned", SIZE_CLASS_SIZE(c));
+        }
+    }
+
+    /* Both requests are larger than any default zone and
+     * should share one zone created for their size class */
+    void *p = iso_alloc(9000);
+    void *q = iso_alloc(9500);
+
+    if(iso_chunksz(p) != 10240 || iso_chunksz(q) != 10240) {
+        LOG_AND_ABORT("Allocations of 9000 and 9500 bytes should come from a 10240 byte zone, got %d and %d",
+                      iso_chunksz(p), iso_chunksz(q));
+    }
+
+    iso_free(p);
+    iso_free(q);
+
+    /* A default zone of 8192 byte chunks would fit both
+     * but their size class is 5120 bytes */
+    p = iso_alloc(4100);
+    q = iso_alloc(5000);
+
+    if(iso_chunksz(p) != 5120 || iso_chunksz(q) != 5120) {
+        LOG_AND_ABORT("Allocations of 4100 and 5000 bytes should come from a 5120 byte zone, got %d and %d",
+                      iso_chunksz(p), iso_chunksz(q));
+    }
+
+    iso_free(p);
+    iso_free(q);
+
+    /* Smaller requests still use the power of 2 default
+     * zone rather than each making a zone for their class */
+    p = iso_alloc(65);
+    q = iso_alloc(100);
+
+    if(iso_chunksz(p) != ZONE_128 || iso_chunksz(q) != ZONE_128) {
+        LOG_AND_ABORT("Allocations of 65 and 100 bytes should come from the 128 byte default zone, got %d and %d",
+                      iso_chunksz(p), iso_chunksz(q));
+    }
+
+    iso_free(p);
+    iso_free(q);
+
+    iso_verify_zones();
+#endif
+
+    return 0;
+}
@@ -0,0 +1,437 @@
+/* iso_alloc thread_bench.c
+ * Copyright 2021 - chris.rohlf@gmail.com */
+
+/* A multithreaded allocator benchmark. Every alloc and
+ * free is timed individually and recorded in a per thread
+ * latency histogram. One JSON object is printed per run
+ * so results can be collected and compared over time.
+ *
+ * thread_bench [-t threads] [-w workload] [-n ops]
+ *
+ * Workloads are churn, mixed, xfree, larson and big.
+ * Built with -DMALLOC_PERF_TEST the system malloc is
+ * measured instead of IsoAlloc */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+#include <time.h>
+
+#if MALLOC_PERF_TEST
+#define alloc_mem malloc
+#define free_mem free
+#define ALLOCATOR_NAME "malloc"
+#else
+#define alloc_mem iso_alloc
+#define free_mem iso_free
+#define ALLOCATOR_NAME "isoalloc"
+#endif
+
+#define MAX_THREADS 256
+#define DEFAULT_OPS 1000000
+#define DEFAULT_BIG_OPS 20000
+
+/* Live allocations each thread keeps around */
+#define LIVE_SLOTS 1024
+
+/* Producer/consumer ring size, must be a power of 2 */
+#define RING_SLOTS 1024
+
+/* Latency histogram. Values below 32ns get a bucket each,
+ * above that each power of 2 is split into 32 buckets
+ * which keeps the error of a percentile under 3% */
+#define HIST_SUB_BITS 5
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_MAX_LG 40
+#define HIST_BUCKETS (HIST_SUB + ((HIST_MAX_LG - HIST_SUB_BITS + 1) * HIST_SUB))
+
+typedef struct {
+    uint64_t buckets[HIST_BUCKETS];
+    uint64_t count;
+    uint64_t max;
+} latency_hist;
+
+typedef struct {
+    latency_hist alloc;
+    latency_hist free;
+    uint64_t ops;
+    uint64_t rand;
+    uint32_t id;
+    pthread_t thread;
+} bench_thread;
+
+typedef struct {
+    _Atomic uint64_t head;
+    _Atomic uint64_t tail;
+    void *slots[RING_SLOTS];
+} bench_ring;
+
+typedef void (*workload_fn)(bench_thread *);
+
+static bench_thread threads[MAX_THREADS];
+static bench_ring rings[MAX_THREADS / 2];
+static uint32_t thread_count = 1;
+static uint64_t op_count = 0;
+static atomic_bool start_flag;
+
+/* Larson style runs pass arrays of live allocations
+ * between threads through this slot */
+static _Atomic(void **) larson_handoff;
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static inline uint64_t next_rand(bench_thread *t) {
+    /* xorshift64 */
+    t->rand ^= t->rand << 13;
+    t->rand ^= t->rand >> 7;
+    t->rand ^= t->rand << 17;
+    return t->rand;
+}
+
+static inline uint32_t hist_bucket(uint64_t v) {
+    if(v < HIST_SUB) {
+        return v;
+    }
+
+    uint32_t lg = (BITS_PER_QWORD - 1) - __builtin_clzll(v);
+
+    if(lg > HIST_MAX_LG) {
+        return HIST_BUCKETS - 1;
+    }
+
+    return HIST_SUB + ((lg - HIST_SUB_BITS) * HIST_SUB) + ((v >> (lg - HIST_SUB_BITS)) - HIST_SUB);
+}
+
+/* Returns the smallest value that lands in bucket b */
+static uint64_t hist_bucket_value(uint32_t b) {
+    if(b < HIST_SUB) {
+        return b;
+    }
+
+    uint32_t lg = ((b - HIST_SUB) / HIST_SUB) + HIST_SUB_BITS;
+    return (uint64_t) (HIST_SUB + ((b - HIST_SUB) % HIST_SUB)) << (lg - HIST_SUB_BITS);
+}
+
+static inline void hist_record(latency_hist *h, uint64_t v) {
+    h->buckets[hist_bucket(v)]++;
+    h->count++;
+
+    if(v > h->max) {
+        h->max = v;
+    }
+}
+
+static void hist_merge(latency_hist *dst, latency_hist *src) {
+    for(uint32_t i = 0; i < HIST_BUCKETS; i++) {
+        dst->buckets[i] += src->buckets[i];
+    }
+
+    dst->count += src->count;
+
+    if(src->max > dst->max) {
+        dst->max = src->max;
+    }
+}
+
+static uint64_t hist_percentile(latency_hist *h, double pct) {
+    uint64_t rank = (uint64_t) ((double) h->count * pct);
+    uint64_t seen = 0;
+
+    for(uint32_t i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+
+        if(seen > rank) {
+            return hist_bucket_value(i);
+        }
+    }
+
+    return h->max;
+}
+
+static inline void *timed_alloc(bench_thread *t, size_t size) {
+    uint64_t s = now_ns();
+    void *p = alloc_mem(size);
+    hist_record(&t->alloc, now_ns() - s);
+
+    if(p == NULL) {
+        LOG_AND_ABORT("Failed to allocate %lu bytes", size);
+    }
+
+    /* Touch the chunk like a real program would */
+    *(uint8_t *) p = 0x41;
+    t->ops++;
+    return p;
+}
+
+static inline void timed_free(bench_thread *t, void *p) {
+    uint64_t s = now_ns();
+    free_mem(p);
+    hist_record(&t->free, now_ns() - s);
+    t->ops++;
+}
+
+static inline size_t mixed_size(bench_thread *t) {
+    /* Favor small sizes like most programs do */
+    uint64_t r = next_rand(t);
+    uint32_t lg = 4 + (r % 10);
+
+    if(lg > 10 && (r & 0x300)) {
+        lg -= 6;
+    }
+
+    return (1 << lg) + ((r >> 16) % (1 << lg));
+}
+
+/* Same size churn. Allocate and free one size against
+ * a set of live allocations */
+static void churn_workload(bench_thread *t) {
+    void *live[LIVE_SLOTS] = {0};
+
+    for(uint64_t i = 0; i < op_count / 2; i++) {
+        uint32_t slot = i % LIVE_SLOTS;
+
+        if(live[slot] != NULL) {
+            timed_free(t, live[slot]);
+        }
+
+        live[slot] = timed_alloc(t, 64);
+    }
+
+    for(uint32_t i = 0; i < LIVE_SLOTS; i++) {
+        if(live[i] != NULL) {
+            free_mem(live[i]);
+        }
+    }
+}
+
+/* Random sizes replaced at random positions */
+static void mixed_workload(bench_thread *t) {
+    void *live[LIVE_SLOTS] = {0};
+
+    for(uint64_t i = 0; i < op_count / 2; i++) {
+        uint32_t slot = next_rand(t) % LIVE_SLOTS;
+
+        if(live[slot] != NULL) {
+            timed_free(t, live[slot]);
+        }
+
+        live[slot] = timed_alloc(t, mixed_size(t));
+    }
+
+    for(uint32_t i = 0; i < LIVE_SLOTS; i++) {
+        if(live[i] != NULL) {
+            free_mem(live[i]);
+        }
+    }
+}
+
+/* Threads are paired up. Even threads allocate and hand
+ * every chunk to their odd partner which frees it. An
+ * unpaired last thread does both on its own */
+static void xfree_workload(bench_thread *t) {
+    bench_ring *ring = &rings[t->id / 2];
+    bool paired = (t->id | 1) < thread_count;
+    uint64_t n = op_count / 2;
+
+    if(paired == false) {
+        churn_workload(t);
+        return;
+    }
+
+    if((t->id & 1) == 0) {
+        for(uint64_t i = 0; i < n; i++) {
+            void *p = timed_alloc(t, mixed_size(t));
+            uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+            while(head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= RING_SLOTS) {
+                sched_yield();
+            }
+
+            ring->slots[head & (RING_SLOTS - 1)] = p;
+            atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+        }
+    } else {
+        for(uint64_t i = 0; i < n; i++) {
+            uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+            while(atomic_load_explicit(&ring->head, memory_order_acquire) == tail) {
+                sched_yield();
+            }
+
+            void *p = ring->slots[tail & (RING_SLOTS - 1)];
+            atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+            timed_free(t, p);
+        }
+    }
+}
+
+/* Larson style server simulation. Each thread replaces
+ * random chunks in an array of live allocations and every
+ * round swaps its array with the one another thread left
+ * behind, so chunks are often free'd by another thread */
+static void larson_workload(bench_thread *t) {
+    void **live = calloc(LIVE_SLOTS, sizeof(void *));
+    uint64_t rounds = 16;
+    uint64_t per_round = (op_count / 2) / rounds;
+
+    for(uint64_t r = 0; r < rounds; r++) {
+        for(uint64_t i = 0; i < per_round; i++) {
+            uint32_t slot = next_rand(t) % LIVE_SLOTS;
+
+            if(live[slot] != NULL) {
+                timed_free(t, live[slot]);
+            }
+
+            live[slot] = timed_alloc(t, 16 + (next_rand(t) % 1008));
+        }
+
+        live = atomic_exchange(&larson_handoff, live);
+    }
+
+    for(uint32_t i = 0; i < LIVE_SLOTS; i++) {
+        if(live[i] != NULL) {
+            free_mem(live[i]);
+        }
+    }
+
+    free(live);
+}
+
+/* Allocations larger than SMALL_SZ_MAX */
+static void big_workload(bench_thread *t) {
+    void *live[16] = {0};
+
+    for(uint64_t i = 0; i < op_count / 2; i++) {
+        uint32_t slot = next_rand(t) % 16;
+
+        if(live[slot] != NULL) {
+            timed_free(t, live[slot]);
+        }
+
+        live[slot] = timed_alloc(t, SMALL_SZ_MAX + (next_rand(t) % (SMALL_SZ_MAX * 8)));
+    }
+
+    for(uint32_t i = 0; i < 16; i++) {
+        if(live[i] != NULL) {
+            free_mem(live[i]);
+        }
+    }
+}
+
+static workload_fn workload;
+
+static void *bench_thread_start(void *arg) {
+    bench_thread *t = (bench_thread *) arg;
+
+    while(atomic_load(&start_flag) == false) {
+        sched_yield();
+    }
+
+    workload(t);
+    return NULL;
+}
+
+static void print_hist(const char *name, latency_hist *h) {
+    fprintf(stdout, "\"%s\":{\"count\":%" PRIu64 ",\"p50_ns\":%" PRIu64 ",\"p99_ns\":%" PRIu64 ",\"p999_ns\":%" PRIu64 ",\"max_ns\":%" PRIu64 "}",
+            name, h->count, hist_percentile(h, 0.50), hist_percentile(h, 0.99), hist_percentile(h, 0.999), h->max);
+}
+
+static void usage(char *name) {
+    fprintf(stderr, "Usage: %s [-t threads] [-w churn|mixed|xfree|larson|big] [-n ops per thread]\n", name);
+    exit(ERR);
+}
+
+int main(int argc, char *argv[]) {
+    const char *workload_name = "mixed";
+    int opt;
+
+    while((opt = getopt(argc, argv, "t:w:n:")) != -1) {
+        if(opt == 't') {
+            thread_count = strtoul(optarg, NULL, 10);
+        } else if(opt == 'w') {
+            workload_name = optarg;
+        } else if(opt == 'n') {
+            op_count = strtoull(optarg, NULL, 10);
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    if(thread_count == 0 || thread_count > MAX_THREADS) {
+        usage(argv[0]);
+    }
+
+    if(strcmp(workload_name, "churn") == 0) {
+        workload = churn_workload;
+    } else if(strcmp(workload_name, "mixed") == 0) {
+        workload = mixed_workload;
+    } else if(strcmp(workload_name, "xfree") == 0) {
+        workload = xfree_workload;
+    } else if(strcmp(workload_name, "larson") == 0) {
+        workload = larson_workload;
+        atomic_store(&larson_handoff, calloc(LIVE_SLOTS, sizeof(void *)));
+    } else if(strcmp(workload_name, "big") == 0) {
+        workload = big_workload;
+    } else {
+        usage(argv[0]);
+    }
+
+    if(op_count == 0) {
+        op_count = (workload == big_workload) ? DEFAULT_BIG_OPS : DEFAULT_OPS;
+    }
+
+    for(uint32_t i = 0; i < thread_count; i++) {
+        threads[i].id = i;
+        threads[i].rand = 0x9e3779b97f4a7c15ULL * (i + 1);
+
+        if(pthread_create(&threads[i].thread, NULL, bench_thread_start, &threads[i]) != 0) {
+            LOG_AND_ABORT("Failed to create benchmark thread %d", i);
+        }
+    }
+
+    uint64_t start = now_ns();
+    atomic_store(&start_flag, true);
+
+    latency_hist *alloc_hist = calloc(1, sizeof(latency_hist));
+    latency_hist *free_hist = calloc(1, sizeof(latency_hist));
+    uint64_t total_ops = 0;
+
+    for(uint32_t i = 0; i < thread_count; i++) {
+        pthread_join(threads[i].thread, NULL);
+    }
+
+    double seconds = (double) (now_ns() - start) / 1000000000.0;
+
+    for(uint32_t i = 0; i < thread_count; i++) {
+        hist_merge(alloc_hist, &threads[i].alloc);
+        hist_merge(free_hist, &threads[i].free);
+        total_ops += threads[i].ops;
+    }
+
+    void **leftover = atomic_load(&larson_handoff);
+
+    if(leftover != NULL) {
+        for(uint32_t i = 0; i < LIVE_SLOTS; i++) {
+            if(leftover[i] != NULL) {
+                free_mem(leftover[i]);
+            }
+        }
+
+        free(leftover);
+    }
+
+    fprintf(stdout, "{\"allocator\":\"%s\",\"workload\":\"%s\",\"threads\":%u,\"ops\":%" PRIu64 ",\"seconds\":%f,\"ops_per_sec\":%.0f,",
+            ALLOCATOR_NAME, workload_name, thread_count, total_ops, seconds, (double) total_ops / seconds);
+    print_hist("alloc", alloc_hist);
+    fprintf(stdout, ",");
+    print_hist("free", free_hist);
+    fprintf(stdout, "}\n");
+
+    free(alloc_hist);
+    free(free_hist);
+
+    return OK;
+}
@@ -62,12 +62,13 @@ void run_test_threads() {
     pthread_t tt;
     pthread_create(&to, NULL, allocate, NULL);
     pthread_create(&tt, NULL, allocate, NULL);
+    pthread_join(to, NULL);
     pthread_join(tt, NULL);
-    pthread_exit(NULL);
 #endif
 }
 
 int main(int argc, char *argv[]) {
+    run_test_threads();
     iso_alloc_detect_leaks();
     iso_verify_zones();
     return OK;
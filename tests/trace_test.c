@@ -0,0 +1,192 @@
+/* iso_alloc trace_test.c
+ * Copyright 2021 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+#include <libgen.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define TEST_TRACE_PATH "/tmp/iso_alloc_trace_test"
+#define KEEP_SIZE 1234
+#define CHUNKS 64
+
+#if ALLOC_TRACE && MALLOC_HOOK
+/* Makes the calls that are traced. The trace is only
+ * complete once the destructor has flushed it */
+static void record(void) {
+    void *keep = malloc(KEEP_SIZE);
+    void *p[CHUNKS];
+
+    memset(keep, 0x41, KEEP_SIZE);
+
+    for(int32_t i = 0; i < CHUNKS; i++) {
+        p[i] = malloc(16 * (i + 1));
+    }
+
+    for(int32_t i = 0; i < CHUNKS; i += 2) {
+        p[i] = realloc(p[i], 32 * (i + 1));
+    }
+
+    free(NULL);
+
+    for(int32_t i = 0; i < CHUNKS; i++) {
+        free(p[i]);
+    }
+
+    free(calloc(CHUNKS, sizeof(uint64_t)));
+    exit(0);
+}
+
+/* Replays the trace at path with the replay tool and
+ * returns the number of chunks it left live */
+static uint64_t replay(const char *tool, const char *path) {
+    char out[4096];
+    int32_t fds[2];
+    ssize_t len = 0;
+    ssize_t r;
+    int status;
+
+    if(pipe(fds) != 0) {
+        LOG_AND_ABORT("Cannot create a pipe");
+    }
+
+    pid_t pid = fork();
+
+    if(pid == 0) {
+        /* The tool is built with its own copy of IsoAlloc */
+        unsetenv("LD_PRELOAD");
+        dup2(fds[1], STDOUT_FILENO);
+        execl(tool, tool, "-q", path, NULL);
+        _exit(ERR);
+    }
+
+    close(fds[1]);
+
+    while((r = read(fds[0], out + len, sizeof(out) - len - 1)) > 0 || (r == ERR && errno == EINTR)) {
+        len += (r > 0) ? r : 0;
+    }
+
+    out[len] = '\0';
+    close(fds[0]);
+
+    if(waitpid(pid, &status, 0) != pid || WIFEXITED(status) == false || WEXITSTATUS(status) != 0) {
+        LOG_AND_ABORT("Replaying %s failed: %s", path, out);
+    }
+
+    /* The forked child started a trace before the exec */
+    char child_path[PATH_MAX];
+    snprintf(child_path, sizeof(child_path), "%s.%d", TEST_TRACE_PATH, pid);
+    unlink(child_path);
+
+    char *live = strstr(out, "\"live_chunks\":");
+
+    if(live == NULL) {
+        LOG_AND_ABORT("Unexpected replay output: %s", out);
+    }
+
+    return strtoull(live + strlen("\"live_chunks\":"), NULL, 10);
+}
+#endif
+
+int main(int argc, char *argv[]) {
+#if ALLOC_TRACE && MALLOC_HOOK
+    char tool[PATH_MAX];
+    char path[PATH_MAX];
+    int status;
+
+    /* Traces are always written so run ourselves again
+     * with them going to /tmp instead of the cwd */
+    if(getenv(TRACE_PATH_ENV_STR) == NULL) {
+        snprintf(path, sizeof(path), "%s.%d", TRACE_DEFAULT_PATH, getpid());
+        unlink(path);
+        setenv(TRACE_PATH_ENV_STR, TEST_TRACE_PATH, 1);
+        execv("/proc/self/exe", argv);
+        LOG_AND_ABORT("Failed to execute this test with %s set", TRACE_PATH_ENV_STR);
+    }
+
+    snprintf(path, sizeof(path), "%s.%d", TEST_TRACE_PATH, getpid());
+    unlink(path);
+
+    /* The replay tool is built next to this test */
+    strncpy(path, argv[0], sizeof(path) - 1);
+    path[sizeof(path) - 1] = '\0';
+    snprintf(tool, sizeof(tool), "%s/iso_alloc_replay", dirname(path));
+
+    pid_t pid = fork();
+
+    if(pid == 0) {
+        record();
+    }
+
+    if(waitpid(pid, &status, 0) != pid || WIFEXITED(status) == false || WEXITSTATUS(status) != 0) {
+        LOG_AND_ABORT("The traced child failed");
+    }
+
+    snprintf(path, sizeof(path), "%s.%d", TEST_TRACE_PATH, pid);
+
+    int32_t fd = open(path, O_RDWR | O_APPEND);
+    struct stat st;
+
+    if(fd == ERR || fstat(fd, &st) != 0 || st.st_size < sizeof(iso_trace_header)) {
+        LOG_AND_ABORT("Cannot open trace file %s", path);
+    }
+
+    uint64_t count = (st.st_size - sizeof(iso_trace_header)) / sizeof(iso_trace_record);
+    iso_trace_record *records = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    iso_trace_record last;
+    uint64_t keep = 0;
+
+    if(records == MAP_FAILED) {
+        LOG_AND_ABORT("Cannot map trace file %s", path);
+    }
+
+    records = (iso_trace_record *) ((uint8_t *) records + sizeof(iso_trace_header));
+    memset(&last, 0x0, sizeof(last));
+
+    for(uint64_t i = 0; i < count; i++) {
+        if(records[i].op == TRACE_OP_FREE && records[i].ptr == 0) {
+            LOG_AND_ABORT("free(NULL) was recorded");
+        }
+
+        if(records[i].op == TRACE_OP_MALLOC && records[i].size == KEEP_SIZE) {
+            keep = records[i].ptr;
+        }
+
+        if(records[i].timestamp >= last.timestamp) {
+            last = records[i];
+        }
+    }
+
+    if(keep == 0 || count < CHUNKS * 2) {
+        LOG_AND_ABORT("The trace is missing records, it has %lu", count);
+    }
+
+    uint64_t live = replay(tool, path);
+
+    /* A realloc that failed returns NULL and leaves the
+     * chunk it was given in use */
+    iso_trace_record failed = last;
+    failed.timestamp = last.timestamp + 1;
+    failed.ptr = 0;
+    failed.old_ptr = keep;
+    failed.size = KEEP_SIZE * 2;
+    failed.op = TRACE_OP_REALLOC;
+
+    if(write(fd, &failed, sizeof(failed)) != sizeof(failed)) {
+        LOG_AND_ABORT("Cannot append to trace file %s", path);
+    }
+
+    close(fd);
+
+    uint64_t live_after = replay(tool, path);
+
+    unlink(path);
+
+    if(live_after != live) {
+        LOG_AND_ABORT("A failed realloc changed the live chunks from %lu to %lu", live, live_after);
+    }
+#endif
+
+    return 0;
+}
@@ -0,0 +1,72 @@
+/* iso_alloc zone_arena_test.c
+ * Copyright 2021 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+
+#define ZONES 64
+
+/* The zone pool thread maps zones ahead of time */
+#if ZONE_POOL
+#define PREMAPPED_MAPPINGS ((ZONE_POOL_SZ + 1) * 4)
+#else
+#define PREMAPPED_MAPPINGS 0
+#endif
+
+#if ZONE_ARENA && __linux__
+static int32_t count_mappings(void) {
+    FILE *f = fopen("/proc/self/maps", "r");
+    int32_t count = 0;
+    int32_t c;
+
+    if(f == NULL) {
+        LOG_AND_ABORT("Cannot open /proc/self/maps");
+    }
+
+    while((c = fgetc(f)) != EOF) {
+        if(c == '\n') {
+            count++;
+        }
+    }
+
+    fclose(f);
+    return count;
+}
+#endif
+
+int main(int argc, char *argv[]) {
+#if ZONE_ARENA && __linux__
+    iso_alloc_zone_handle *zones[ZONES];
+
+    /* Make sure the root and the first arena exist */
+    iso_free(iso_alloc(ZONE_64));
+    zones[0] = iso_alloc_new_zone(ZONE_1024);
+
+    int32_t before = count_mappings();
+
+    for(int32_t i = 1; i < ZONES; i++) {
+        zones[i] = iso_alloc_new_zone(ZONE_1024);
+    }
+
+    /* Each zone adds its bitmap, its user pages and the
+     * PROT_NONE ranges between them */
+    int32_t mappings = count_mappings() - before;
+
+    if(mappings > ((ZONES - 1) * 4) + PREMAPPED_MAPPINGS) {
+        LOG_AND_ABORT("%d zones added %d mappings", ZONES - 1, mappings);
+    }
+
+    for(int32_t i = 0; i < ZONES; i++) {
+        for(int32_t j = 0; j < 64; j++) {
+            void *p = iso_alloc_from_zone(zones[i], ZONE_1024);
+            memset(p, 0x41, ZONE_1024);
+            iso_free(p);
+        }
+
+        iso_verify_zone(zones[i]);
+        iso_alloc_destroy_zone(zones[i]);
+    }
+#endif
+
+    return OK;
+}
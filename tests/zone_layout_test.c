@@ -0,0 +1,55 @@
+/* iso_alloc zone_layout_test.c
+ * Copyright 2021 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+
+#define TEST_ZONE_LAYOUT "160:2:y, 96:1\n4096:1:n # comment"
+
+int main(int argc, char *argv[]) {
+#if RUNTIME_ZONE_LAYOUT
+    /* The zone layout is read when the library is loaded
+     * so we run ourselves again with it set */
+    if(getenv(ZONE_LAYOUT_ENV_STR) == NULL) {
+        setenv(ZONE_LAYOUT_ENV_STR, TEST_ZONE_LAYOUT, 1);
+        execv("/proc/self/exe", argv);
+        LOG_AND_ABORT("Failed to execute this test with %s set", ZONE_LAYOUT_ENV_STR);
+    }
+
+    /* Allocate the smallest size first, the thread zone
+     * cache would happily serve it from a larger zone. The
+     * layout doesn't list it but it still gets a zone */
+    void *s = iso_alloc(SMALLEST_ZONE);
+
+    if(iso_chunksz(s) != SMALLEST_ZONE) {
+        LOG_AND_ABORT("Allocation of %d bytes should come from a %d byte zone, got %d", SMALLEST_ZONE, SMALLEST_ZONE, iso_chunksz(s));
+    }
+
+    void *q = iso_alloc(90);
+
+    if(iso_chunksz(q) != 96) {
+        LOG_AND_ABORT("Allocation of 90 bytes should come from a 96 byte zone, got %d", iso_chunksz(q));
+    }
+
+    void *p = iso_alloc(150);
+
+    if(iso_chunksz(p) != 160) {
+        LOG_AND_ABORT("Allocation of 150 bytes should come from a 160 byte zone, got %d", iso_chunksz(p));
+    }
+
+    void *r = iso_alloc(3000);
+
+    if(iso_chunksz(r) != 4096) {
+        LOG_AND_ABORT("Allocation of 3000 bytes should come from a 4096 byte zone, got %d", iso_chunksz(r));
+    }
+
+    iso_free(p);
+    iso_free(q);
+    iso_free(r);
+    iso_free(s);
+
+    iso_verify_zones();
+#endif
+
+    return 0;
+}
@@ -0,0 +1,62 @@
+/* iso_alloc zone_pool_test.c
+ * Copyright 2021 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+
+#define CHUNKS_80 150000
+
+int main(int argc, char *argv[]) {
+#if ZONE_POOL
+    struct iso_alloc_stats before, after;
+    size_t sizes[] = {16384, 20480, 24576, 28672, 40960, 49152};
+
+    iso_alloc_get_stats(&before);
+
+    /* Give the pool thread time to refill between each
+     * zone that is created */
+    for(int32_t i = 0; i < sizeof(sizes) / sizeof(size_t); i++) {
+        usleep(100000);
+
+        uint8_t *p = iso_alloc(sizes[i]);
+        memset(p, 0x41, sizes[i]);
+        iso_free(p);
+    }
+
+    iso_alloc_get_stats(&after);
+
+    if(after.zone_pool_hits == before.zone_pool_hits) {
+        LOG_AND_ABORT("No zone was created from the zone pool");
+    }
+
+    /* A zone with a smaller bitmap than the pooled one
+     * and a zone that uses all of it */
+    usleep(100000);
+
+    if(iso_alloc_reserve(80, CHUNKS_80) != OK) {
+        LOG_AND_ABORT("Failed to reserve %d chunks of 80 bytes", CHUNKS_80);
+    }
+
+    usleep(100000);
+
+    if(iso_alloc_reserve(SMALLEST_ZONE, (ZONE_USER_SIZE / SMALLEST_ZONE) * 2) != OK) {
+        LOG_AND_ABORT("Failed to reserve two zones of %d byte chunks", SMALLEST_ZONE);
+    }
+
+    void **chunks = calloc(CHUNKS_80, sizeof(void *));
+
+    for(int32_t i = 0; i < CHUNKS_80; i++) {
+        chunks[i] = iso_alloc(80);
+        memset(chunks[i], 0x42, 80);
+    }
+
+    for(int32_t i = 0; i < CHUNKS_80; i++) {
+        iso_free(chunks[i]);
+    }
+
+    free(chunks);
+    iso_verify_zones();
+#endif
+
+    return OK;
+}
@@ -0,0 +1,126 @@
+/* iso_alloc zone_retirement_test.c
+ * Copyright 2021 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+
+#define BURST_SIZE 16384
+#define BURST_ZONES 12
+#define THREADS 4
+
+#if ZONE_RETIREMENT
+static void **burst(size_t size, uint32_t count) {
+    void **p = calloc(count, sizeof(void *));
+
+    for(uint32_t i = 0; i < count; i++) {
+        p[i] = iso_alloc(size);
+        memset(p[i], 0x41, size);
+    }
+
+    return p;
+}
+
+static void release(void **p, uint32_t count) {
+    for(uint32_t i = 0; i < count; i++) {
+        iso_free(p[i]);
+    }
+
+    free(p);
+}
+
+/* Each thread keeps zones in its thread zone cache while
+ * other threads retire and recycle them */
+static void *churn(void *arg) {
+    size_t size = (size_t) arg;
+
+    for(int32_t i = 0; i < 4; i++) {
+        release(burst(size, (ZONE_USER_SIZE / size) * 3), (ZONE_USER_SIZE / size) * 3);
+    }
+
+    return NULL;
+}
+#endif
+
+int main(int argc, char *argv[]) {
+#if ZONE_RETIREMENT
+    struct iso_alloc_stats before;
+    struct iso_alloc_stats after;
+    uint32_t count = (ZONE_USER_SIZE / BURST_SIZE) * BURST_ZONES;
+
+    iso_free(iso_alloc(ZONE_64));
+    iso_alloc_get_stats(&before);
+
+    /* Every zone from the burst is empty once it is free'd
+     * and all but one of them are retired */
+    release(burst(BURST_SIZE, count), count);
+    iso_alloc_get_stats(&after);
+
+#if ALLOC_STATS
+    if(after.zones_retired - before.zones_retired < ZONE_RETIRE_BATCH - ZONE_RETIRE_KEEP) {
+        LOG_AND_ABORT("Expected empty zones to be retired but only %lu were", after.zones_retired - before.zones_retired);
+    }
+#endif
+
+    iso_verify_zones();
+
+    /* The same burst again recycles the retired zones
+     * instead of adding new ones */
+    before = after;
+    release(burst(BURST_SIZE, count), count);
+    iso_alloc_get_stats(&after);
+
+#if ALLOC_STATS
+    if(after.zones_recycled == before.zones_recycled || after.zones_used > before.zones_used + 1) {
+        LOG_AND_ABORT("Expected retired zones to be recycled, %lu zones are in use", after.zones_used);
+    }
+#endif
+
+    /* Retired descriptors are recycled for other sizes */
+    count = (ZONE_USER_SIZE / (BURST_SIZE * 2)) * BURST_ZONES;
+    release(burst(BURST_SIZE * 2, count), count);
+
+    /* A zone holding a permanently free'd chunk is never
+     * retired, so that chunk is never handed out again */
+    uint32_t per_zone = ZONE_USER_SIZE / BURST_SIZE;
+    count = per_zone * BURST_ZONES;
+    void **perm = burst(BURST_SIZE, count);
+
+    for(uint32_t i = 0; i < count; i++) {
+        if((i % per_zone) == 0) {
+            iso_free_permanently(perm[i]);
+        } else {
+            iso_free(perm[i]);
+        }
+    }
+
+    for(int32_t r = 0; r < 2; r++) {
+        void **p = burst(BURST_SIZE, count);
+
+        for(uint32_t i = 0; i < count; i++) {
+            for(uint32_t j = 0; j < count; j += per_zone) {
+                if(p[i] == perm[j]) {
+                    LOG_AND_ABORT("Permanently free'd chunk 0x%p was allocated again", p[i]);
+                }
+            }
+        }
+
+        release(p, count);
+    }
+
+    free(perm);
+
+    pthread_t t[THREADS];
+
+    for(int32_t i = 0; i < THREADS; i++) {
+        pthread_create(&t[i], NULL, churn, (void *) (size_t) (BURST_SIZE << (i & 1)));
+    }
+
+    for(int32_t i = 0; i < THREADS; i++) {
+        pthread_join(t[i], NULL);
+    }
+
+    iso_verify_zones();
+#endif
+
+    return OK;
+}
@@ -0,0 +1,345 @@
+/* iso_alloc_profiler_tool.c - A secure memory allocator
+ * Copyright 2021 - chris.rohlf@gmail.com */
+
+/* Merges the data files written by the heap profiler
+ * and generates iso_alloc_target_config.h from them.
+ * Both the text format and binary snapshot streams
+ * are accepted. Only power of 2 zone sizes are
+ * generated, SIZE_CLASSES is ignored. See PROFILER.md */
+
+#include "iso_alloc_internal.h"
+
+#define TOOL_DEFAULT_OUTPUT "iso_alloc_target_config.h"
+
+/* A chunk size needs at least this % of all samples
+ * that fit in a default zone to get a default zone */
+#define TOOL_MIN_SAMPLE_SHARE 1
+
+/* No more than this many default zones are created and
+ * no chunk size gets more than TOOL_MAX_ZONES_PER_SIZE */
+#define TOOL_MAX_DEFAULT_ZONES 16
+#define TOOL_MAX_ZONES_PER_SIZE 4
+
+/* The smallest and largest default zone classes */
+#define TOOL_MIN_CLASS 4
+#define TOOL_MAX_CLASS 13
+
+/* Default zones up to this class are always created
+ * however rarely their sizes were sampled. Otherwise a
+ * small chunk is served from a much larger one and an
+ * overflow of it can stay inside its own chunk */
+#define TOOL_BASELINE_MAX_CLASS 7
+
+typedef struct {
+    uint64_t zones;        /* Most zones of this size seen in one run */
+    uint64_t full_samples; /* Samples that found one of them nearly full */
+} tool_zone_data;
+
+typedef struct {
+    uint32_t runs;
+    uint64_t allocated;
+    uint64_t sampled;
+    uint64_t stacks;
+    uint64_t size_samples[PROFILER_SIZE_CLASSES];
+    tool_zone_data zones[TOOL_MAX_CLASS + 1];
+} tool_profile;
+
+static tool_profile profile;
+
+static uint32_t chunk_size_class(uint64_t chunk_size) {
+    uint32_t c = HEAP_USAGE_CLASS(chunk_size);
+
+    if(c < TOOL_MIN_CLASS) {
+        c = TOOL_MIN_CLASS;
+    }
+
+    return c;
+}
+
+static void merge_zone(uint64_t chunk_size, uint64_t zones, uint64_t full_samples) {
+    uint32_t c = chunk_size_class(chunk_size);
+
+    /* Zones larger than MAX_DEFAULT_ZONE_SZ are always
+     * created on demand so we don't track them */
+    if(c > TOOL_MAX_CLASS) {
+        return;
+    }
+
+    if(zones > profile.zones[c].zones) {
+        profile.zones[c].zones = zones;
+    }
+
+    profile.zones[c].full_samples += full_samples;
+}
+
+static int32_t parse_text(FILE *fp, const char *path) {
+    char line[256];
+    uint64_t a, b, c;
+
+    while(fgets(line, sizeof(line), fp) != NULL) {
+        if(sscanf(line, "allocated=%" SCNu64, &a) == 1) {
+            profile.allocated += a;
+        } else if(sscanf(line, "sampled=%" SCNu64, &a) == 1) {
+            profile.sampled += a;
+        } else if(strncmp(line, "backtrace_hash=", 15) == 0) {
+            profile.stacks++;
+        } else if(sscanf(line, "sampled_size=%" SCNu64 ",count=%" SCNu64, &a, &b) == 2) {
+            profile.size_samples[PROFILER_SIZE_CLASS(a)] += b;
+        } else if(sscanf(line, "sampled_size=big,count=%" SCNu64, &b) == 1) {
+            profile.size_samples[HEAP_USAGE_CLASSES] += b;
+        } else if(sscanf(line, "%" SCNu64 ",%" SCNu64 ",%" SCNu64, &a, &b, &c) == 3) {
+            merge_zone(a, b, c);
+        } else if(line[0] != '\n') {
+            fprintf(stderr, "%s: ignoring unrecognized line: %s", path, line);
+        }
+    }
+
+    profile.runs++;
+    return OK;
+}
+
+/* Snapshot counters are cumulative so each run is
+ * represented by its last record. Runs end with an
+ * exit snapshot unless the process was killed, in
+ * which case the last record in the file is used */
+static void merge_snapshot(uint8_t *record) {
+    iso_profiler_snapshot_hdr *hdr = (iso_profiler_snapshot_hdr *) record;
+    iso_profiler_snapshot_zone *zones = (iso_profiler_snapshot_zone *) (record + sizeof(iso_profiler_snapshot_hdr));
+
+    profile.allocated += hdr->allocated;
+    profile.sampled += hdr->sampled;
+    profile.stacks += hdr->stack_entries;
+
+    for(uint32_t i = 0; i < PROFILER_SIZE_CLASSES; i++) {
+        profile.size_samples[i] += hdr->size_samples[i];
+    }
+
+    for(uint32_t i = 0; i < hdr->zone_entries; i++) {
+        merge_zone(zones[i].chunk_size, zones[i].zones, zones[i].full_samples);
+    }
+
+    profile.runs++;
+}
+
+static int32_t parse_snapshots(FILE *fp, const char *path) {
+    uint8_t *record = malloc(PROFILER_SNAPSHOT_MAX_SZ);
+    bool pending = false;
+    uint32_t length;
+
+    if(record == NULL) {
+        return ERR;
+    }
+
+    while(fread(&length, sizeof(length), 1, fp) == 1) {
+        iso_profiler_snapshot_hdr *hdr = (iso_profiler_snapshot_hdr *) record;
+
+        if(length + sizeof(length) > PROFILER_SNAPSHOT_MAX_SZ || length + sizeof(length) < sizeof(iso_profiler_snapshot_hdr)) {
+            fprintf(stderr, "%s: corrupt snapshot length %u\n", path, length);
+            break;
+        }
+
+        hdr->length = length;
+
+        /* A short read means the process was killed while
+         * writing this record. Use the one before it */
+        if(fread(record + sizeof(length), length, 1, fp) != 1) {
+            fprintf(stderr, "%s: ignoring truncated snapshot\n", path);
+            break;
+        }
+
+        if(hdr->magic != PROFILER_SNAPSHOT_MAGIC || hdr->version != PROFILER_SNAPSHOT_VERSION) {
+            fprintf(stderr, "%s: skipping snapshot with version %u\n", path, hdr->version);
+            continue;
+        }
+
+        pending = true;
+
+        if(hdr->reason == PROFILER_SNAPSHOT_EXIT) {
+            merge_snapshot(record);
+            pending = false;
+        }
+    }
+
+    /* The last run in the file never exited cleanly.
+     * The record buffer still holds its last snapshot
+     * unless a bad record followed it */
+    if(pending == true) {
+        iso_profiler_snapshot_hdr *hdr = (iso_profiler_snapshot_hdr *) record;
+
+        if(hdr->magic == PROFILER_SNAPSHOT_MAGIC && hdr->version == PROFILER_SNAPSHOT_VERSION) {
+            merge_snapshot(record);
+        }
+    }
+
+    free(record);
+    return OK;
+}
+
+static int32_t parse_file(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    uint32_t magic[2];
+    int32_t r;
+
+    if(fp == NULL) {
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return ERR;
+    }
+
+    if(fread(magic, sizeof(magic), 1, fp) == 1 && magic[1] == PROFILER_SNAPSHOT_MAGIC) {
+        rewind(fp);
+        r = parse_snapshots(fp, path);
+    } else {
+        rewind(fp);
+        r = parse_text(fp, path);
+    }
+
+    fclose(fp);
+    return r;
+}
+
+/* The bit slot cache holds free chunks so the next
+ * allocation doesn't have to scan the bitmap. When
+ * zones are often close to full those scans are the
+ * most expensive so we make the cache as large as the
+ * uint8_t indexes into it allow. Workloads that never
+ * fill a zone get a smaller cache and smaller zones */
+static uint32_t pick_bit_slot_cache_size(void) {
+    uint64_t full_samples = 0;
+
+    for(uint32_t c = TOOL_MIN_CLASS; c <= TOOL_MAX_CLASS; c++) {
+        full_samples += profile.zones[c].full_samples;
+    }
+
+    if(profile.sampled == 0) {
+        return 128;
+    }
+
+    /* The average number of nearly full zones seen by
+     * each sample */
+    if(full_samples >= profile.sampled) {
+        return 254;
+    } else if(full_samples * 10 < profile.sampled) {
+        return 64;
+    }
+
+    return 128;
+}
+
+static uint32_t pick_default_zones(uint64_t *zones) {
+    uint64_t samples[TOOL_MAX_CLASS + 1] = {0};
+    uint64_t total = 0;
+    uint32_t count = 0;
+
+    /* Sizes smaller than ZONE_16 are served from it and
+     * sizes above MAX_DEFAULT_ZONE_SZ from zones created
+     * on demand */
+    for(uint32_t i = 0; i < HEAP_USAGE_CLASSES; i++) {
+        uint32_t c = (i < TOOL_MIN_CLASS) ? TOOL_MIN_CLASS : i;
+
+        if(c <= TOOL_MAX_CLASS) {
+            samples[c] += profile.size_samples[i];
+            total += profile.size_samples[i];
+        }
+    }
+
+    /* Older profiles have no size histogram. The only
+     * signal left is which zones filled up */
+    if(total == 0) {
+        for(uint32_t c = TOOL_MIN_CLASS; c <= TOOL_MAX_CLASS; c++) {
+            samples[c] = profile.zones[c].full_samples;
+            total += samples[c];
+        }
+    }
+
+    for(uint32_t c = TOOL_MIN_CLASS; c <= TOOL_MAX_CLASS; c++) {
+        bool sampled = total != 0 && samples[c] != 0 && (samples[c] * 100) >= (total * TOOL_MIN_SAMPLE_SHARE);
+
+        if(sampled == false && c > TOOL_BASELINE_MAX_CLASS) {
+            continue;
+        }
+
+        /* Sizes that needed more than one zone at runtime
+         * start with more than one */
+        uint64_t n = profile.zones[c].zones;
+
+        if(n == 0 || sampled == false) {
+            n = 1;
+        } else if(n > TOOL_MAX_ZONES_PER_SIZE) {
+            n = TOOL_MAX_ZONES_PER_SIZE;
+        }
+
+        for(uint64_t i = 0; i < n && count < TOOL_MAX_DEFAULT_ZONES; i++) {
+            zones[count++] = (uint64_t) 1 << c;
+        }
+    }
+
+    /* Nothing useful was sampled, fall back to the
+     * SMALL_MEM_STARTUP profile above the baseline */
+    if(total == 0) {
+        zones[count++] = ZONE_256;
+        zones[count++] = ZONE_512;
+        zones[count++] = ZONE_1024;
+    }
+
+    return count;
+}
+
+static int32_t write_config(const char *path) {
+    uint64_t zones[TOOL_MAX_DEFAULT_ZONES];
+    uint32_t count = pick_default_zones(zones);
+    FILE *fp = fopen(path, "w");
+
+    if(fp == NULL) {
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return ERR;
+    }
+
+    fprintf(fp, "/* iso_alloc_target_config.h - Generated by iso_alloc_profiler_tool\n");
+    fprintf(fp, " * from %u profiler runs with %" PRIu64 " allocations, %" PRIu64 " samples\n", profile.runs, profile.allocated, profile.sampled);
+    fprintf(fp, " * and %" PRIu64 " unique stacks. Build with TARGET_CONFIG=1 to use it */\n", profile.stacks);
+    fprintf(fp, "#pragma once\n\n");
+    fprintf(fp, "/* ZONE_USER_SIZE * sizeof(default_zones) = ~%u mb */\n", (uint32_t) ((count * ZONE_USER_SIZE) / MEGABYTE_SIZE));
+    fprintf(fp, "#define SMALLEST_ZONE ZONE_%" PRIu64 "\n", zones[0]);
+    fprintf(fp, "#define BIT_SLOT_CACHE_SZ %u\n\n", pick_bit_slot_cache_size());
+    fprintf(fp, "static uint64_t default_zones[] = {");
+
+    for(uint32_t i = 0; i < count; i++) {
+        fprintf(fp, "%sZONE_%" PRIu64, i == 0 ? "" : ", ", zones[i]);
+    }
+
+    fprintf(fp, "};\n");
+    fclose(fp);
+    return OK;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-o iso_alloc_target_config.h] iso_alloc_profiler.data ...\n", name);
+}
+
+int main(int argc, char *argv[]) {
+    const char *output = TOOL_DEFAULT_OUTPUT;
+    int32_t i = 1;
+
+    if(argc > 2 && strcmp(argv[1], "-o") == 0) {
+        output = argv[2];
+        i = 3;
+    }
+
+    if(i >= argc) {
+        usage(argv[0]);
+        return ERR;
+    }
+
+    for(; i < argc; i++) {
+        if(parse_file(argv[i]) != OK) {
+            return ERR;
+        }
+    }
+
+    if(write_config(output) != OK) {
+        return ERR;
+    }
+
+    fprintf(stdout, "Merged %u runs into %s\n", profile.runs, output);
+    return OK;
+}
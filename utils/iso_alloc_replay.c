@@ -0,0 +1,330 @@
+/* iso_alloc_replay.c - A secure memory allocator
+ * Copyright 2021 - chris.rohlf@gmail.com */
+
+/* Replays a trace written by the ALLOC_TRACE recorder
+ * against IsoAlloc, or against the system malloc when
+ * built with -DMALLOC_PERF_TEST. Records from all threads
+ * are merged by timestamp and replayed on one thread so
+ * every run makes the same calls in the same order.
+ *
+ * iso_alloc_replay [-q] <trace file>
+ *
+ * Chunks are filled when they are allocated, like most
+ * programs would, unless -q is passed. One JSON object
+ * with the replay time, RSS and zone counts is printed */
+
+#include "iso_alloc_internal.h"
+#include "iso_alloc.h"
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#if MALLOC_PERF_TEST
+#define alloc_mem malloc
+#define calloc_mem calloc
+#define realloc_mem realloc
+#define free_mem free
+#define ALLOCATOR_NAME "malloc"
+#else
+#define alloc_mem iso_alloc
+#define calloc_mem iso_calloc
+#define realloc_mem iso_realloc
+#define free_mem iso_free
+#define ALLOCATOR_NAME "isoalloc"
+#endif
+
+/* Maps a recorded pointer to the chunk we allocated in
+ * its place. Open addressing with linear probing and
+ * backward shift deletion */
+typedef struct {
+    uint64_t key;
+    void *value;
+} replay_map_entry;
+
+static replay_map_entry *map;
+static uint64_t map_mask;
+static uint64_t live_chunks;
+
+static iso_trace_record *records;
+
+static void *map_pages(size_t size) {
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if(p == MAP_FAILED) {
+        LOG_AND_ABORT("Failed to map %lu bytes", size);
+    }
+
+    return p;
+}
+
+static inline uint64_t map_hash(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return key & map_mask;
+}
+
+/* Returns the chunk for key and removes it from the map */
+static void *map_remove(uint64_t key) {
+    uint64_t i = map_hash(key);
+
+    while(map[i].key != 0 && map[i].key != key) {
+        i = (i + 1) & map_mask;
+    }
+
+    if(map[i].key == 0) {
+        return NULL;
+    }
+
+    void *value = map[i].value;
+    uint64_t hole = i;
+
+    for(uint64_t j = (i + 1) & map_mask; map[j].key != 0; j = (j + 1) & map_mask) {
+        uint64_t home = map_hash(map[j].key);
+
+        /* Move entries whose probe sequence crosses the hole */
+        if(((j - home) & map_mask) >= ((j - hole) & map_mask)) {
+            map[hole] = map[j];
+            hole = j;
+        }
+    }
+
+    map[hole].key = 0;
+    map[hole].value = NULL;
+    live_chunks--;
+    return value;
+}
+
+static void map_insert(uint64_t key, void *value) {
+    uint64_t i = map_hash(key);
+
+    while(map[i].key != 0 && map[i].key != key) {
+        i = (i + 1) & map_mask;
+    }
+
+    /* Records from different threads can race around a
+     * reused pointer, keep the newest chunk */
+    if(map[i].key == key) {
+        free_mem(map[i].value);
+        live_chunks--;
+    }
+
+    map[i].key = key;
+    map[i].value = value;
+    live_chunks++;
+}
+
+static int compare_records(const void *a, const void *b) {
+    const uint32_t ia = *(const uint32_t *) a;
+    const uint32_t ib = *(const uint32_t *) b;
+
+    if(records[ia].timestamp != records[ib].timestamp) {
+        return (records[ia].timestamp < records[ib].timestamp) ? -1 : 1;
+    }
+
+    /* Keep the order records were written in */
+    return (ia < ib) ? -1 : (ia > ib);
+}
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static uint64_t current_rss(void) {
+#if __linux__
+    uint64_t pages = 0;
+    uint64_t resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+
+    if(fp == NULL) {
+        return 0;
+    }
+
+    if(fscanf(fp, "%" SCNu64 " %" SCNu64, &pages, &resident) != 2) {
+        resident = 0;
+    }
+
+    fclose(fp);
+    return resident * sysconf(_SC_PAGESIZE);
+#else
+    return 0;
+#endif
+}
+
+int main(int argc, char *argv[]) {
+    bool touch = true;
+    int opt;
+
+    while((opt = getopt(argc, argv, "q")) != -1) {
+        if(opt == 'q') {
+            touch = false;
+        } else {
+            fprintf(stderr, "Usage: %s [-q] <trace file>\n", argv[0]);
+            return ERR;
+        }
+    }
+
+    if(optind >= argc) {
+        fprintf(stderr, "Usage: %s [-q] <trace file>\n", argv[0]);
+        return ERR;
+    }
+
+    const char *path = argv[optind];
+    int32_t fd = open(path, O_RDONLY);
+    struct stat st;
+
+    if(fd == ERR || fstat(fd, &st) != 0) {
+        LOG_AND_ABORT("Cannot open trace file %s", path);
+    }
+
+    if(st.st_size < sizeof(iso_trace_header)) {
+        LOG_AND_ABORT("Trace file %s is too small", path);
+    }
+
+    uint8_t *trace = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if(trace == MAP_FAILED) {
+        LOG_AND_ABORT("Cannot map trace file %s", path);
+    }
+
+    close(fd);
+
+    iso_trace_header *hdr = (iso_trace_header *) trace;
+
+    if(hdr->magic != TRACE_MAGIC || hdr->version != TRACE_VERSION) {
+        LOG_AND_ABORT("%s is not a version %d trace file", path, TRACE_VERSION);
+    }
+
+    /* A partial record at the end is ignored */
+    uint64_t count = (st.st_size - sizeof(iso_trace_header)) / sizeof(iso_trace_record);
+    records = (iso_trace_record *) (trace + sizeof(iso_trace_header));
+
+    if(count > UINT32_MAX) {
+        LOG_AND_ABORT("Trace file %s has too many records", path);
+    }
+
+    /* The map never holds more entries than there are
+     * records, keep it at most half full */
+    uint64_t map_size = 16;
+
+    while(map_size < (count << 1)) {
+        map_size <<= 1;
+    }
+
+    map = map_pages(map_size * sizeof(replay_map_entry));
+    map_mask = map_size - 1;
+
+    uint32_t *order = map_pages((count + 1) * sizeof(uint32_t));
+
+    for(uint32_t i = 0; i < count; i++) {
+        order[i] = i;
+    }
+
+    qsort(order, count, sizeof(uint32_t), compare_records);
+
+    uint64_t ops = 0;
+    uint64_t start = now_ns();
+
+    for(uint64_t i = 0; i < count; i++) {
+        iso_trace_record *r = &records[order[i]];
+        void *p = NULL;
+
+        if(r->op == TRACE_OP_FREE) {
+            if(r->ptr != 0 && (p = map_remove(r->ptr)) != NULL) {
+                free_mem(p);
+                ops++;
+            }
+
+            continue;
+        }
+
+        /* The recorded call failed, so do we */
+        if(r->ptr == 0 && r->op != TRACE_OP_REALLOC) {
+            continue;
+        }
+
+        if(r->op == TRACE_OP_MALLOC) {
+            p = alloc_mem(r->size);
+        } else if(r->op == TRACE_OP_CALLOC) {
+            p = calloc_mem(1, r->size);
+        } else if(r->op == TRACE_OP_REALLOC) {
+            void *old = NULL;
+
+            /* A realloc that failed left the old chunk alone */
+            if(r->ptr == 0 && r->size != 0) {
+                continue;
+            }
+
+            if(r->old_ptr != 0) {
+                old = map_remove(r->old_ptr);
+            }
+
+            /* realloc(p, 0) free'd the chunk */
+            if(r->ptr == 0) {
+                if(old != NULL) {
+                    free_mem(old);
+                    ops++;
+                }
+
+                continue;
+            }
+
+            p = realloc_mem(old, r->size);
+        } else {
+            LOG_AND_ABORT("Unknown operation %d in trace record %d", r->op, order[i]);
+        }
+
+        if(p == NULL) {
+            LOG_AND_ABORT("Failed to allocate %lu bytes while replaying record %d", r->size, order[i]);
+        }
+
+        if(touch == true) {
+            memset(p, 0x41, r->size);
+        }
+
+        map_insert(r->ptr, p);
+        ops++;
+    }
+
+    double seconds = (double) (now_ns() - start) / 1000000000.0;
+    uint64_t rss = current_rss();
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+
+#if __APPLE__
+    uint64_t peak_rss = ru.ru_maxrss;
+#else
+    uint64_t peak_rss = (uint64_t) ru.ru_maxrss * 1024;
+#endif
+
+    uint64_t zones = 0;
+    uint64_t zones_created = 0;
+#if !MALLOC_PERF_TEST
+    struct iso_alloc_stats stats;
+
+    if(iso_alloc_get_stats(&stats) == OK) {
+        zones = stats.zones_used;
+        zones_created = stats.zones_created;
+    }
+#endif
+
+    fprintf(stdout, "{\"allocator\":\"%s\",\"trace\":\"%s\",\"records\":%" PRIu64 ",\"ops\":%" PRIu64 ",\"seconds\":%f,\"ops_per_sec\":%.0f,"
+                    "\"live_chunks\":%" PRIu64 ",\"rss_bytes\":%" PRIu64 ",\"peak_rss_bytes\":%" PRIu64 ",\"zones\":%" PRIu64 ",\"zones_created\":%" PRIu64 "}\n",
+            ALLOCATOR_NAME, path, count, ops, seconds, (double) ops / seconds, live_chunks, rss,
+            peak_rss, zones, zones_created);
+
+    for(uint64_t i = 0; i <= map_mask; i++) {
+        if(map[i].key != 0) {
+            free_mem(map[i].value);
+        }
+    }
+
+    munmap(order, (count + 1) * sizeof(uint32_t));
+    munmap(map, map_size * sizeof(replay_map_entry));
+    munmap(trace, st.st_size);
+
+    return OK;
+}
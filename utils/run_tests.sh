@@ -3,7 +3,8 @@
 # examples of code that should crash
 $(echo '' > test_output.txt)
 
-tests=("tests" "big_tests" "interfaces_test" "thread_tests")
+tests=("tests" "big_tests" "interfaces_test" "thread_tests" "zone_layout_test"
+       "size_classes_test" "object_cache_test")
 failure=0
 succeeded=0
 
@@ -29,7 +30,7 @@ for t in "${tests[@]}"; do
     fi
 done
 
-fail_tests=("double_free" "heap_overflow" "heap_underflow" "leaks_test"
+fail_tests=("double_free" "cache_double_free" "cache_stale_free" "heap_overflow" "heap_underflow" "leaks_test"
             "wild_free" "unaligned_free" "incorrect_chunk_size_multiple"
             "big_canary_test")
 
@@ -50,12 +51,38 @@ for t in "${fail_tests[@]}"; do
     fi
 done
 
-echo "$succeeded Tests passed"
-echo "$failure Tests failed"
-
 unset LD_LIBRARY_PATH
 unset LD_PRELOAD
 
+# Feature tests are built by make feature_tests against
+# a library with the feature enabled, in the directory
+# named before the test
+feature_tests=("per_cpu_cache/cpu_cache_test" "adaptive_zones/adaptive_zones_test"
+               "adaptive_cpu_cache/adaptive_zones_test" "zone_pool/zone_pool_test"
+               "zone_arena/zone_arena_test" "packed_bitmaps/packed_bitmaps_test"
+               "zone_retirement/zone_retirement_test" "alloc_trace/trace_test")
+
+for t in "${feature_tests[@]}"; do
+    lib_dir=build/features/$(dirname $t)
+    echo -n "Running $t feature test"
+    echo "Running $t feature test" >> test_output.txt 2>&1
+    $(LD_LIBRARY_PATH=$lib_dir LD_PRELOAD=$lib_dir/libisoalloc.so build/features/$t >> test_output.txt 2>&1)
+    ret=$?
+
+    if [ $ret -ne 0 ]; then
+        echo "... Failed"
+        echo "... Failed" >> test_output.txt 2>&1
+        failure=$((failure+1))
+    else
+        echo "... Succeeded"
+        echo "... Succeeded" >> test_output.txt 2>&1
+        succeeded=$((succeeded+1))
+    fi
+done
+
+echo "$succeeded Tests passed"
+echo "$failure Tests failed"
+
 if [ $failure -ne 0 ]; then
     exit -1
 else